@@ -0,0 +1,372 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include "AESHandler.h"
+#include "RSAHandler.h"
+#include "Utils.h"
+#include "PayloadParser.h"
+#include "SocketHandler.h"
+#include "MockServer.h"
+
+
+
+constexpr auto DEFAULT_RESULTS_PATH = "bench_results.json";
+constexpr double MIN_RUN_SECONDS = 0.2;
+
+
+// Every allocation made by the process is counted, the benchmarks report the delta per operation.
+static std::atomic<uint64_t> g_allocations{ 0 };
+static std::atomic<uint64_t> g_allocatedBytes{ 0 };
+
+void* operator new(size_t size) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+
+
+struct Result {
+	std::string name;
+	size_t bytesPerOp;
+	uint64_t iterations;
+	double nsPerOp;
+	double mbPerSec;
+	double allocsPerOp;
+	double allocBytesPerOp;
+};
+
+
+/**
+ * Run the operation until MIN_RUN_SECONDS passed, doubling the batch size each round.
+ */
+template <typename Func>
+Result run(const std::string& name, const size_t bytesPerOp, Func op, const uint64_t maxIterations = UINT64_MAX) {
+	using clock = std::chrono::steady_clock;
+	op();	// warm up
+
+	uint64_t iterations = 0;
+	uint64_t batch = 1;
+	double seconds = 0;
+	const uint64_t allocations = g_allocations.load();
+	const uint64_t allocatedBytes = g_allocatedBytes.load();
+
+	while (seconds < MIN_RUN_SECONDS && iterations < maxIterations) {
+		const auto start = clock::now();
+		for (uint64_t i = 0; i < batch; ++i) op();
+		seconds += std::chrono::duration<double>(clock::now() - start).count();
+		iterations += batch;
+		batch *= 2;
+	}
+
+	Result result;
+	result.name = name;
+	result.bytesPerOp = bytesPerOp;
+	result.iterations = iterations;
+	result.nsPerOp = seconds * 1e9 / iterations;
+	result.mbPerSec = bytesPerOp ? (static_cast<double>(bytesPerOp) * iterations / seconds) / (1024.0 * 1024.0) : 0;
+	result.allocsPerOp = static_cast<double>(g_allocations.load() - allocations) / iterations;
+	result.allocBytesPerOp = static_cast<double>(g_allocatedBytes.load() - allocatedBytes) / iterations;
+	return result;
+}
+
+
+// Keeps results alive so the compiler can not drop the benchmarked work.
+template <typename T>
+void consume(const T& value) {
+	static volatile size_t sink = 0;
+	sink = sink + value.size();
+}
+
+
+std::string randomBytes(const size_t size) {
+	std::string bytes(size, '\0');
+	for (size_t i = 0; i < size; ++i) bytes[i] = static_cast<char>(std::rand() & 0xFF);
+	return bytes;
+}
+
+
+
+void benchAES(std::vector<Result>& results) {
+	AESWrapper aes;
+	aes.generateKey();
+
+	for (const size_t size : { 64, 1024, 16 * 1024, 1024 * 1024 }) {
+		const std::string plain = randomBytes(size);
+		const std::string cipher = aes.encrypt(plain);
+		const auto* cipherBytes = reinterpret_cast<const uint8_t*>(cipher.data());
+
+		results.push_back(run("aes_encrypt/" + std::to_string(size), size, [&] { consume(aes.encrypt(plain)); }));
+		results.push_back(run("aes_decrypt/" + std::to_string(size), size, [&] { consume(aes.decrypt(cipherBytes, cipher.size())); }));
+	}
+}
+
+
+void benchRSA(std::vector<Result>& results) {
+	RSAPrivateWrapper rsaPrivate;
+	results.push_back(run("rsa_randomize_private_key", 0, [&] { rsaPrivate.randomizePrivateKey(); }, 64));
+
+	const std::string publicKey = rsaPrivate.getPublicKey();
+	RSAPublicWrapper rsaPublic;
+	rsaPublic.loadPublicKey(reinterpret_cast<const uint8_t*>(publicKey.data()));
+
+	const std::string symKey = randomBytes(SYM_KEY_SIZE);
+	const auto* symKeyBytes = reinterpret_cast<const uint8_t*>(symKey.data());
+	const std::string cipher = rsaPublic.encrypteRSA(symKeyBytes, symKey.size());
+	const auto* cipherBytes = reinterpret_cast<const uint8_t*>(cipher.data());
+
+	results.push_back(run("rsa_encrypt/" + std::to_string(SYM_KEY_SIZE), SYM_KEY_SIZE, [&] { consume(rsaPublic.encrypteRSA(symKeyBytes, symKey.size())); }));
+	results.push_back(run("rsa_decrypt/" + std::to_string(SYM_KEY_SIZE), SYM_KEY_SIZE, [&] { consume(rsaPrivate.decrypteRSA(cipherBytes, cipher.size())); }));
+}
+
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::AVX2: return "avx2";
+	case SimdLevel::SSSE3: return "ssse3";
+	default: return "scalar";
+	}
+}
+
+
+/**
+ * Every codec level the CPU supports must round trip and give the scalar output, for every size up
+ * to a few SIMD blocks, every byte value and hex or base64 text with a character changed or added.
+ */
+bool verifyCodecs() {
+	bool ok = true;
+	const auto expect = [&ok](bool passed, const char* what, SimdLevel level, size_t size) {
+		if (passed) return;
+		if (ok) std::cout << what << " failed on " << simdLevelName(level) << " for " << size << " bytes" << std::endl;
+		ok = false;
+	};
+
+	for (size_t size = 0; size <= 260 && ok; ++size) {
+		std::string bytes = randomBytes(size);
+		if (size == 256) for (size_t i = 0; i < size; ++i) bytes[i] = static_cast<char>(i);
+		const auto* raw = reinterpret_cast<const uint8_t*>(bytes.data());
+
+		Utils::setSimdLevel(SimdLevel::SCALAR);
+		std::string hex(2 * size, '\0');
+		Utils::hexEncode(raw, size, &hex[0]);
+		std::string base64(Utils::base64EncodedSize(size), '\0');
+		Utils::base64Encode(raw, size, &base64[0]);
+
+		for (int level = static_cast<int>(SimdLevel::SCALAR); level <= static_cast<int>(Utils::supportedSimdLevel()); ++level) {
+			const SimdLevel simd = static_cast<SimdLevel>(level);
+			Utils::setSimdLevel(simd);
+			std::string text(2 * size, '\0');
+			std::vector<uint8_t> decoded(Utils::base64DecodedMaxSize(base64.size() + 1));
+
+			Utils::hexEncode(raw, size, &text[0]);
+			expect(text == hex, "hex encode", simd, size);
+			expect(Utils::hexDecode(hex.data(), hex.size(), decoded.data()) && memcmp(decoded.data(), raw, size) == 0, "hex decode", simd, size);
+			for (size_t i = 0; i < hex.size(); ++i) {
+				text = hex;
+				text[i] = "g:@`\x80"[i % 5];
+				expect(!Utils::hexDecode(text.data(), text.size(), decoded.data()), "hex reject", simd, size);
+			}
+
+			text.assign(base64.size(), '\0');
+			Utils::base64Encode(raw, size, &text[0]);
+			expect(text == base64, "base64 encode", simd, size);
+			size_t length = Utils::base64Decode(base64.data(), base64.size(), decoded.data());
+			expect(length == size && memcmp(decoded.data(), raw, size) == 0, "base64 decode", simd, size);
+			for (size_t i = 0; i <= base64.size(); ++i) {
+				text = base64;
+				text.insert(i, 1, "\n=*\xff"[i % 4]);
+				length = Utils::base64Decode(text.data(), text.size(), decoded.data());
+				expect(length == size && memcmp(decoded.data(), raw, size) == 0, "base64 skip", simd, size);
+			}
+			expect(Utils::decodeBase64(Utils::encodeBase64(bytes)) == bytes, "base64 lines", simd, size);
+		}
+	}
+
+	Utils::setSimdLevel(Utils::supportedSimdLevel());
+	return ok;
+}
+
+
+void benchCodecs(std::vector<Result>& results) {
+	for (int level = static_cast<int>(SimdLevel::SCALAR); level <= static_cast<int>(Utils::supportedSimdLevel()); ++level) {
+		Utils::setSimdLevel(static_cast<SimdLevel>(level));
+		for (const size_t size : { CLIENT_ID_SIZE, static_cast<size_t>(640), static_cast<size_t>(64 * 1024) }) {
+			const std::string bytes = randomBytes(size);
+			const auto* raw = reinterpret_cast<const uint8_t*>(bytes.data());
+			const std::string hex = Utils::bytesToHex(raw, bytes.size());
+			const std::string base64 = Utils::encodeBase64(bytes);
+			const std::string suffix = std::string("/") + simdLevelName(static_cast<SimdLevel>(level)) + "/" + std::to_string(size);
+
+			results.push_back(run("bytes_to_hex" + suffix, size, [&] { consume(Utils::bytesToHex(raw, bytes.size())); }));
+			results.push_back(run("hex_to_bytes" + suffix, size, [&] { consume(Utils::hexToBytes(hex)); }));
+			results.push_back(run("encode_base64" + suffix, size, [&] { consume(Utils::encodeBase64(bytes)); }));
+			results.push_back(run("decode_base64" + suffix, size, [&] { consume(Utils::decodeBase64(base64)); }));
+
+			// the buffer codecs, without the strings around them
+			std::string text(Utils::base64EncodedSize(size) + 2 * size, '\0');
+			std::vector<uint8_t> decoded(size + 2);
+			results.push_back(run("hex_encode" + suffix, size, [&] { Utils::hexEncode(raw, size, &text[0]); }));
+			results.push_back(run("hex_decode" + suffix, size, [&] { Utils::hexDecode(hex.data(), hex.size(), decoded.data()); }));
+			results.push_back(run("base64_encode" + suffix, size, [&] { Utils::base64Encode(raw, size, &text[0]); }));
+			results.push_back(run("base64_decode" + suffix, size, [&] { Utils::base64Decode(base64.data(), base64.size(), decoded.data()); }));
+		}
+	}
+	Utils::setSimdLevel(Utils::supportedSimdLevel());
+}
+
+
+void benchPayloads(std::vector<Result>& results) {
+	for (const size_t count : { 10, 1000 }) {
+		std::vector<UnpackClient> clients(count);
+		for (size_t i = 0; i < count; ++i) {
+			memcpy(clients[i].clientId.id, &i, sizeof(i));
+			snprintf(reinterpret_cast<char*>(clients[i].name), NAME_SIZE, "user %zu", i);
+		}
+
+		std::vector<uint8_t> payload;
+		const size_t size = count * sizeof(UnpackClient);
+		results.push_back(run("pack_clients/" + std::to_string(count), size, [&] {
+			payload.clear();
+			for (const auto& client : clients) PayloadParser::packClient(client, payload);
+		}));
+
+		std::vector<UnpackClient> parsed;
+		results.push_back(run("parse_clients/" + std::to_string(count), size, [&] {
+			PayloadParser::parseClients(payload.data(), payload.size(), parsed);
+		}));
+	}
+
+	for (const size_t count : { 10, 1000 }) {
+		const std::string content = randomBytes(128);
+		UnpackMessage header;
+		header.msgType = TEXT_MESSAGE;
+		header.msgSize = static_cast<uint32_t>(content.size());
+
+		std::vector<uint8_t> payload;
+		const size_t size = count * (sizeof(UnpackMessage) + content.size());
+		results.push_back(run("pack_messages/" + std::to_string(count), size, [&] {
+			payload.clear();
+			for (size_t i = 0; i < count; ++i) {
+				header.messageID = static_cast<uint32_t>(i);
+				PayloadParser::packMessage(header, reinterpret_cast<const uint8_t*>(content.data()), payload);
+			}
+		}));
+
+		std::vector<ParsedMessage> parsed;
+		results.push_back(run("parse_messages/" + std::to_string(count), size, [&] {
+			PayloadParser::parseMessages(payload.data(), payload.size(), parsed);
+		}));
+	}
+}
+
+
+
+/**
+ * Whole request round trips against the in-process mock server, without injected latency
+ * this is the client side cost of a request plus loopback.
+ */
+void benchRoundTrips(std::vector<Result>& results) {
+	MockServer server;
+	if (!server.start()) return;
+	SocketHandler socket(server.address(), server.port());
+
+	ClientID self;
+	for (size_t i = 0; i < 100; ++i) {
+		RegistrationRequest req;
+		RegistrationResponse resp;
+		snprintf(reinterpret_cast<char*>(req.name), NAME_SIZE, "user %zu", i);
+		if (!socket.socketWrapper(reinterpret_cast<const uint8_t*>(&req), sizeof(req), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))) return;
+		self = resp.clientId;
+	}
+
+	RequestHeader listReq(GET_CLIENTS_LIST);
+	listReq.clientId = self;
+	std::vector<uint8_t> listResp(((sizeof(ResponseHeader) + 99 * sizeof(UnpackClient) + PACKET_SIZE - 1) / PACKET_SIZE) * PACKET_SIZE);
+	results.push_back(run("roundtrip_clients_list/100", listResp.size(), [&] {
+		socket.socketWrapper(reinterpret_cast<const uint8_t*>(&listReq), sizeof(listReq), listResp.data(), listResp.size());
+	}));
+
+	const std::string content = randomBytes(1024);
+	SendMessageRequest sendReq;
+	sendReq.header.clientId = self;
+	sendReq.clientId = self;
+	sendReq.msgType = TEXT_MESSAGE;
+	sendReq.contentSize = static_cast<uint32_t>(content.size());
+	sendReq.msgContent = reinterpret_cast<uint8_t*>(const_cast<char*>(content.data()));
+	const std::vector<uint8_t> packet = sendReq.pack();
+	MessageSentResponse sendResp;
+	results.push_back(run("roundtrip_send_message/1024", content.size(), [&] {
+		socket.socketWrapper(packet.data(), packet.size(), reinterpret_cast<uint8_t*>(&sendResp), sizeof(sendResp));
+	}, 4096));
+}
+
+
+
+std::string toJson(const std::vector<Result>& results) {
+	std::ostringstream out;
+	out << "{\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"bytes_per_op\": " << r.bytesPerOp << ", \"iterations\": " << r.iterations
+			<< ", \"ns_per_op\": " << r.nsPerOp << ", \"mb_per_sec\": " << r.mbPerSec
+			<< ", \"allocs_per_op\": " << r.allocsPerOp << ", \"alloc_bytes_per_op\": " << r.allocBytesPerOp << "}"
+			<< ((i + 1 < results.size()) ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return out.str();
+}
+
+
+void printTable(const std::vector<Result>& results) {
+	std::printf("%-32s %14s %12s %12s %14s\n", "benchmark", "ns/op", "MB/s", "allocs/op", "alloc B/op");
+	for (const auto& r : results) {
+		std::printf("%-32s %14.1f %12.1f %12.2f %14.1f\n", r.name.c_str(), r.nsPerOp, r.mbPerSec, r.allocsPerOp, r.allocBytesPerOp);
+	}
+}
+
+
+
+/**
+ * Usage: Benchmark [--filter <prefix>] [--json <path>]
+ */
+int main(int argc, char* argv[]) {
+	std::string filter;
+	std::string jsonPath = DEFAULT_RESULTS_PATH;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const std::string arg = argv[i];
+		if (arg == "--filter") filter = argv[i + 1];
+		else if (arg == "--json") jsonPath = argv[i + 1];
+	}
+
+	std::vector<Result> results;
+	if (filter.empty() || filter == "aes") benchAES(results);
+	if (filter.empty() || filter == "rsa") benchRSA(results);
+	if (filter.empty() || filter == "codec") {
+		if (!verifyCodecs()) return 1;
+		benchCodecs(results);
+	}
+	if (filter.empty() || filter == "payload") benchPayloads(results);
+	if (filter.empty() || filter == "roundtrip") benchRoundTrips(results);
+
+	printTable(results);
+
+	std::ofstream json(jsonPath, std::ios::trunc);
+	if (!json.is_open()) {
+		std::cout << "Can not write results to '" << jsonPath << "'" << std::endl;
+		return 1;
+	}
+	json << toJson(results);
+	return 0;
+}
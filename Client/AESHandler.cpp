@@ -58,6 +58,45 @@ const std::string AESWrapper::decrypt(const uint8_t* cipher, size_t length)  {
 
 
 
+/**
+ * Deflates and encrypts in one pipeline, fed a chunk at a time, so a large file is never held
+ * compressed and encrypted at once.
+ */
+const std::string AESWrapper::encryptDeflated(const uint8_t* plain, size_t length) {
+	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };
+
+	CryptoPP::AES::Encryption aesEncryption(m_key, SYM_KEY_SIZE);
+	CryptoPP::CBC_Mode_ExternalCipher::Encryption cbcEncryption(aesEncryption, iv);
+
+	std::string cipher;
+	CryptoPP::Deflator deflator(new CryptoPP::StreamTransformationFilter(cbcEncryption, new CryptoPP::StringSink(cipher)), COMPRESSION_LEVEL);
+	for (size_t offset = 0; offset < length; offset += COMPRESSION_CHUNK_SIZE) {
+		deflator.Put(plain + offset, std::min(COMPRESSION_CHUNK_SIZE, length - offset));
+	}
+	deflator.MessageEnd();
+
+	return cipher;
+}
+
+
+const std::string AESWrapper::decryptInflated(const uint8_t* cipher, size_t length) {
+	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE] = { 0 };
+
+	CryptoPP::AES::Decryption aesDecryption(m_key, SYM_KEY_SIZE);
+	CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv);
+
+	std::string decrypted;
+	CryptoPP::StreamTransformationFilter stfDecryptor(cbcDecryption, new CryptoPP::Inflator(new CryptoPP::StringSink(decrypted)));
+	for (size_t offset = 0; offset < length; offset += COMPRESSION_CHUNK_SIZE) {
+		stfDecryptor.Put(cipher + offset, std::min(COMPRESSION_CHUNK_SIZE, length - offset));
+	}
+	stfDecryptor.MessageEnd();
+
+	return decrypted;
+}
+
+
+
 void AESWrapper::getKey(uint8_t *buffer, const size_t size) {
 	if (size != SYM_KEY_SIZE) {
 		throw std::length_error("key must be 16 bytes");
@@ -1,3 +1,4 @@
+#pragma once
 #include <modes.h>
 #include <string>
 #include <aes.h>
@@ -5,6 +6,7 @@
 #include <stdexcept>
 #include <immintrin.h>	
 #include "protocol.h"
+#include "Compression.h"
 
 
 
@@ -23,6 +25,8 @@ public:
 	const std::string encrypt(const std::string&);
 	const std::string encrypt(const uint8_t*, size_t);
 	const std::string decrypt(const uint8_t*, size_t);
+	const std::string encryptDeflated(const uint8_t*, size_t);
+	const std::string decryptInflated(const uint8_t*, size_t);
 	void getKey(uint8_t* buffer, const size_t size);
 private:
 	uint8_t m_key[SYM_KEY_SIZE];
@@ -0,0 +1,204 @@
+#include "AsyncFileIO.h"
+
+#if defined(MESSAGEU_IO_URING) && defined(__linux__)
+#include <liburing.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#define USE_IO_URING 1
+#endif
+
+
+
+#ifdef USE_IO_URING
+namespace {
+	constexpr unsigned URING_QUEUE_DEPTH = 8;
+	constexpr size_t URING_CHUNK_SIZE = 1 << 20;
+
+	// One ring per worker thread, rings are not thread safe.
+	struct Ring {
+		io_uring ring;
+		bool ready;
+
+		Ring() : ready(io_uring_queue_init(URING_QUEUE_DEPTH, &ring, 0) == 0) {}
+		~Ring() { if (ready) io_uring_queue_exit(&ring); }
+	};
+
+	thread_local Ring t_ring;
+
+
+	/**
+	 * Transfer the whole range in chunks, keeping up to URING_QUEUE_DEPTH requests in flight.
+	 * A short transfer is reported as failure and the caller falls back to the blocking path.
+	 */
+	bool uringTransfer(int fd, uint8_t* buffer, const size_t size, const bool isWrite) {
+		if (!t_ring.ready) return false;
+
+		size_t submitted = 0;
+		size_t completed = 0;
+		unsigned inFlight = 0;
+		bool success = true;
+
+		while (success && completed < size) {
+			while (inFlight < URING_QUEUE_DEPTH && submitted < size) {
+				io_uring_sqe* sqe = io_uring_get_sqe(&t_ring.ring);
+				if (sqe == nullptr) break;
+
+				const size_t length = std::min(URING_CHUNK_SIZE, size - submitted);
+				if (isWrite) {
+					io_uring_prep_write(sqe, fd, buffer + submitted, static_cast<unsigned>(length), submitted);
+				} else {
+					io_uring_prep_read(sqe, fd, buffer + submitted, static_cast<unsigned>(length), submitted);
+				}
+				io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(length));
+				submitted += length;
+				++inFlight;
+			}
+
+			if (io_uring_submit(&t_ring.ring) < 0) {
+				success = false;
+				break;
+			}
+
+			io_uring_cqe* cqe = nullptr;
+			if (io_uring_wait_cqe(&t_ring.ring, &cqe) < 0) {
+				success = false;
+				break;
+			}
+			const size_t expected = reinterpret_cast<size_t>(io_uring_cqe_get_data(cqe));
+			if (cqe->res < 0 || static_cast<size_t>(cqe->res) != expected) {
+				success = false;
+			} else {
+				completed += expected;
+			}
+			io_uring_cqe_seen(&t_ring.ring, cqe);
+			--inFlight;
+		}
+
+		// never leave completions of this transfer behind in the ring
+		while (inFlight > 0) {
+			io_uring_cqe* cqe = nullptr;
+			if (io_uring_wait_cqe(&t_ring.ring, &cqe) < 0) break;
+			io_uring_cqe_seen(&t_ring.ring, cqe);
+			--inFlight;
+		}
+		return success && completed == size;
+	}
+
+
+	bool uringRead(const std::string& filePath, std::string& out) {
+		const int fd = ::open(filePath.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat st;
+		bool success = (fstat(fd, &st) == 0);
+		if (success) {
+			out.resize(static_cast<size_t>(st.st_size));
+			success = out.empty() || uringTransfer(fd, reinterpret_cast<uint8_t*>(&out[0]), out.size(), false);
+		}
+		::close(fd);
+		return success;
+	}
+
+
+	bool uringWrite(const std::string& filePath, const std::string& data) {
+		const int fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) return false;
+
+		uint8_t* buffer = reinterpret_cast<uint8_t*>(const_cast<char*>(data.data()));
+		const bool success = data.empty() || uringTransfer(fd, buffer, data.size(), true);
+		::close(fd);
+		return success;
+	}
+}
+#endif
+
+
+
+AsyncFileIO::AsyncFileIO(const size_t workers) : m_stop(false) {
+	const size_t count = std::max<size_t>(workers, 1);
+	for (size_t i = 0; i < count; ++i)
+		m_workers.emplace_back(&AsyncFileIO::run, this);
+}
+
+
+AsyncFileIO::~AsyncFileIO() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_jobReady.notify_all();
+
+	// pending jobs are still completed, callers may be waiting on them
+	for (auto& worker : m_workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+
+
+std::future<std::shared_ptr<std::string>> AsyncFileIO::read(const std::string& filePath) {
+	auto promise = std::make_shared<std::promise<std::shared_ptr<std::string>>>();
+	auto result = promise->get_future();
+
+	post([promise, filePath]() {
+		auto data = std::make_shared<std::string>();
+		promise->set_value(readFile(filePath, *data) ? data : nullptr);
+	});
+	return result;
+}
+
+
+std::future<bool> AsyncFileIO::write(const std::string& filePath, std::shared_ptr<const std::string> data) {
+	auto promise = std::make_shared<std::promise<bool>>();
+	auto result = promise->get_future();
+
+	post([promise, filePath, data]() {
+		promise->set_value(data != nullptr && writeFile(filePath, *data));
+	});
+	return result;
+}
+
+
+
+void AsyncFileIO::post(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_jobReady.notify_one();
+}
+
+
+void AsyncFileIO::run() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobReady.wait(lock, [this] { return !m_jobs.empty() || m_stop; });
+			if (m_jobs.empty()) return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
+
+
+
+bool AsyncFileIO::readFile(const std::string& filePath, std::string& out) {
+#ifdef USE_IO_URING
+	if (uringRead(filePath, out)) return true;
+#endif
+	FileHandler fileHandler;
+	return fileHandler.readFile(filePath, out);
+}
+
+
+bool AsyncFileIO::writeFile(const std::string& filePath, const std::string& data) {
+#ifdef USE_IO_URING
+	if (uringWrite(filePath, data)) return true;
+#endif
+	FileHandler fileHandler;
+	return fileHandler.writeFile(filePath, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
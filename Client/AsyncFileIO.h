@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "FileHandler.h"
+
+
+
+/**
+ * Runs whole-file reads and writes off the calling thread, so attachment I/O overlaps network I/O.
+ * Workers use the mapped/buffered FileHandler paths, on Linux builds with MESSAGEU_IO_URING defined
+ * (and liburing linked) transfers are submitted through io_uring instead.
+ */
+class AsyncFileIO {
+public:
+	explicit AsyncFileIO(const size_t workers = 1);
+	virtual ~AsyncFileIO();
+	AsyncFileIO(const AsyncFileIO& other) = delete;
+	AsyncFileIO(AsyncFileIO&& other) noexcept = delete;
+	AsyncFileIO& operator=(const AsyncFileIO& other) = delete;
+	AsyncFileIO& operator=(AsyncFileIO&& other) noexcept = delete;
+
+	// the result is nullptr if the file could not be read
+	std::future<std::shared_ptr<std::string>> read(const std::string&);
+	std::future<bool> write(const std::string&, std::shared_ptr<const std::string>);
+
+private:
+	void run();
+	void post(std::function<void()>);
+	static bool readFile(const std::string&, std::string&);
+	static bool writeFile(const std::string&, const std::string&);
+
+	std::deque<std::function<void()>> m_jobs;
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_jobReady;
+	bool m_stop;
+};
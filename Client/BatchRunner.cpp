@@ -0,0 +1,255 @@
+#include "BatchRunner.h"
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <boost/algorithm/string.hpp>
+#include "FileHandler.h"
+#include "Utils.h"
+
+
+
+BatchRunner::BatchRunner(ClientCore& core, std::ostream& out, const size_t jobs) : m_core(core), m_out(out), m_commands(0), m_failed(0) {
+	const size_t count = std::max<size_t>(jobs, 1);
+	for (size_t i = 0; i < count; ++i) m_lanes.push_back(new WorkerPool(1));
+}
+
+
+BatchRunner::~BatchRunner() {
+	wait();
+	for (auto lane : m_lanes) delete lane;
+}
+
+
+
+/**
+ * Runs every command of the stream and a summary line, false if any command failed.
+ */
+bool BatchRunner::run(std::istream& in) {
+	const auto start = std::chrono::steady_clock::now();
+	std::string line;
+	size_t lineNumber = 0;
+
+	while (std::getline(in, line)) {
+		++lineNumber;
+		boost::algorithm::trim(line);
+		if (line.empty() || line[0] == '#') continue;
+
+		BatchCommand command;
+		command.line = lineNumber;
+		++m_commands;
+		if (!parse(line, command)) {
+			++m_failed;
+			std::lock_guard<std::mutex> lock(m_outMutex);
+			m_out << "{\"line\":" << lineNumber << ",\"ok\":false,\"error\":\"invalid command\"}\n";
+			continue;
+		}
+		dispatch(command);
+	}
+	wait();
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	m_out << "{\"summary\":{\"commands\":" << m_commands << ",\"failed\":" << m_failed
+		<< ",\"seconds\":" << std::fixed << std::setprecision(3) << seconds
+		<< ",\"per_second\":" << std::setprecision(1) << (seconds > 0 ? m_commands / seconds : 0.0) << "}}" << std::endl;
+	m_out.unsetf(std::ios::floatfield);
+	return m_failed == 0;
+}
+
+
+
+bool BatchRunner::parse(const std::string& line, BatchCommand& command) {
+	std::istringstream fields(line);
+	fields >> command.verb;
+
+	if (command.verb == "wait") return true;
+	if (command.verb == "load") {
+		fields >> command.argument;
+		return !command.argument.empty();
+	}
+
+	fields >> command.identity;
+	if (command.identity.empty()) return false;
+	if (command.verb == "list" || command.verb == "poll") return true;
+	if (command.verb == "register" || command.verb == "save") {
+		fields >> command.argument;
+		return command.verb == "register" || !command.argument.empty();
+	}
+
+	fields >> command.peer;
+	if (command.peer.empty()) return false;
+	if (command.verb == "key" || command.verb == "request-key" || command.verb == "send-key") return true;
+	if (command.verb == "send" || command.verb == "file") {
+		std::getline(fields, command.argument);
+		boost::algorithm::trim(command.argument);
+		return !command.argument.empty();
+	}
+	return false;
+}
+
+
+
+/**
+ * Loads run right away, their identity is only known once the file is read.
+ */
+void BatchRunner::dispatch(const BatchCommand& command) {
+	if (command.verb == "wait") {
+		wait();
+		return;
+	}
+	if (command.verb == "load") {
+		execute(command);
+		return;
+	}
+
+	WorkerPool* lane = m_lanes[std::hash<std::string>()(command.identity) % m_lanes.size()];
+	m_pending.push_back(lane->submit([this, command]() { execute(command); }));
+}
+
+
+void BatchRunner::wait() {
+	for (auto& pending : m_pending) pending.get();
+	m_pending.clear();
+}
+
+
+
+void BatchRunner::execute(const BatchCommand& command) {
+	std::string fields;
+	const auto start = std::chrono::steady_clock::now();
+	bool success = false;
+	try {
+		success = perform(command, fields);
+	} catch (...) {
+		success = false;
+	}
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if (!success) ++m_failed;
+	emit(command, success, ms, fields);
+}
+
+
+/**
+ * Runs one command, adding its results to 'fields' as JSON members with a leading comma.
+ */
+bool BatchRunner::perform(const BatchCommand& command, std::string& fields) {
+	ClientCore::Handle identity;
+
+	if (command.verb == "register") {
+		const KeyType keyType = (command.argument == "x25519") ? X25519_KEY : RSA_KEY;
+		if (!command.argument.empty() && command.argument != "x25519" && command.argument != "rsa") return false;
+		if (!m_core.registerIdentity(command.identity, keyType, identity)) return false;
+		std::lock_guard<std::mutex> lock(m_handlesMutex);
+		m_handles[command.identity] = identity;
+		return true;
+	}
+	if (command.verb == "load") {
+		if (!m_core.loadIdentity(command.argument, identity)) return false;
+		const std::string name = m_core.name(identity);
+		fields = ",\"name\":\"" + escape(name) + "\"";
+		std::lock_guard<std::mutex> lock(m_handlesMutex);
+		m_handles[name] = identity;
+		return true;
+	}
+
+	if (!handle(command.identity, identity)) return false;
+
+	if (command.verb == "save") return m_core.saveIdentity(identity, command.argument);
+	if (command.verb == "list") return m_core.refreshDirectory(identity);
+	if (command.verb == "request-key") return m_core.requestSymKey(identity, command.peer);
+	if (command.verb == "send-key") return m_core.sendSymKey(identity, command.peer);
+
+	if (command.verb == "key") {
+		DirectoryEntry peer;
+		if (!m_core.getPublicKey(identity, command.peer, peer)) return false;
+		fields = ",\"client_id\":\"" + Utils::bytesToHex(peer.clientId.id, CLIENT_ID_SIZE)
+			+ "\",\"key_type\":\"" + ((peer.keyType == X25519_KEY) ? "x25519" : "rsa") + "\"";
+		return true;
+	}
+
+	if (command.verb == "send" || command.verb == "file") {
+		uint32_t messageID = 0;
+		bool sent = false;
+		if (command.verb == "send") {
+			sent = m_core.sendText(identity, command.peer, command.argument, &messageID);
+		} else {
+			FileHandler fileHandler;
+			std::string content;
+			if (!fileHandler.readFile(command.argument, content)) {
+				std::cout << "Failed to read '" << command.argument << "'" << std::endl;
+				return false;
+			}
+			sent = m_core.sendFile(identity, command.peer, content, &messageID);
+		}
+		if (sent) fields = ",\"message_id\":" + std::to_string(messageID);
+		return sent;
+	}
+
+	if (command.verb == "poll") {
+		std::vector<ReceivedMessage> messages;
+		if (!m_core.fetchMessages(identity, messages)) return false;
+		fields = ",\"messages\":[";
+		for (size_t i = 0; i < messages.size(); ++i) {
+			const ReceivedMessage& message = messages[i];
+			fields += (i == 0) ? "{" : ",{";
+			fields += "\"from\":\"" + escape(message.fromName) + "\",\"id\":" + std::to_string(message.messageID)
+				+ ",\"type\":" + std::to_string(message.msgType) + ",\"decrypted\":" + (message.decrypted ? "true" : "false");
+			if (message.msgType == FILE_MSG) fields += ",\"size\":" + std::to_string(message.content.size());
+			else if (message.msgType != SEND_SYM_KEY) fields += ",\"text\":\"" + escape(message.content) + "\"";
+			fields += "}";
+		}
+		fields += "]";
+		return true;
+	}
+	return false;
+}
+
+
+
+bool BatchRunner::handle(const std::string& name, ClientCore::Handle& identity) {
+	std::lock_guard<std::mutex> lock(m_handlesMutex);
+	const auto found = m_handles.find(name);
+	if (found == m_handles.end()) {
+		std::cout << "No registered or loaded identity '" << name << "'" << std::endl;
+		return false;
+	}
+	identity = found->second;
+	return true;
+}
+
+
+void BatchRunner::emit(const BatchCommand& command, bool success, double ms, const std::string& fields) {
+	std::ostringstream line;
+	line << "{\"line\":" << command.line << ",\"cmd\":\"" << command.verb << "\"";
+	if (!command.identity.empty()) line << ",\"identity\":\"" << escape(command.identity) << "\"";
+	if (!command.peer.empty()) line << ",\"peer\":\"" << escape(command.peer) << "\"";
+	line << ",\"ok\":" << (success ? "true" : "false") << ",\"ms\":" << std::fixed << std::setprecision(3) << ms << fields << "}\n";
+
+	std::lock_guard<std::mutex> lock(m_outMutex);
+	m_out << line.str();
+}
+
+
+
+std::string BatchRunner::escape(const std::string& text) {
+	std::string escaped;
+	escaped.reserve(text.size());
+	for (const char c : text) {
+		switch (c) {
+		case '"': escaped += "\\\""; break;
+		case '\\': escaped += "\\\\"; break;
+		case '\n': escaped += "\\n"; break;
+		case '\r': escaped += "\\r"; break;
+		case '\t': escaped += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped += code;
+			} else {
+				escaped += c;
+			}
+		}
+	}
+	return escaped;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <istream>
+#include <ostream>
+#include "ClientCore.h"
+#include "WorkerPool.h"
+
+
+
+struct BatchCommand {
+	size_t line;
+	std::string verb;
+	std::string identity;
+	std::string peer;
+	std::string argument;	// message text, file path or key type
+
+	BatchCommand() : line(0) {}
+};
+
+
+/**
+ * Runs client commands read from a stream, one per line, and writes one JSON object per command.
+ * Commands of one identity run in order; with several jobs, different identities run in parallel.
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ *	register <name> [rsa|x25519]		load <path>				save <name> <path>
+ *	list <name>							key <name> <peer>		poll <name>
+ *	request-key <name> <peer>			send-key <name> <peer>
+ *	send <name> <peer> <text>			file <name> <peer> <path>
+ *	wait								waits for all earlier commands
+ */
+class BatchRunner {
+public:
+	BatchRunner(ClientCore& core, std::ostream& out, const size_t jobs = 1);
+	virtual ~BatchRunner();
+	BatchRunner(const BatchRunner& other) = delete;
+	BatchRunner(BatchRunner&& other) noexcept = delete;
+	BatchRunner& operator=(const BatchRunner& other) = delete;
+	BatchRunner& operator=(BatchRunner&& other) noexcept = delete;
+
+	bool run(std::istream&);
+
+private:
+	bool parse(const std::string&, BatchCommand&);
+	void dispatch(const BatchCommand&);
+	void wait();
+	void execute(const BatchCommand&);
+	bool perform(const BatchCommand&, std::string&);
+	bool handle(const std::string&, ClientCore::Handle&);
+	void emit(const BatchCommand&, bool, double, const std::string&);
+	static std::string escape(const std::string&);
+
+	ClientCore& m_core;
+	std::ostream& m_out;
+	std::vector<WorkerPool*> m_lanes;		// one thread each, an identity always runs on the same lane
+	std::vector<std::future<void>> m_pending;
+	std::unordered_map<std::string, ClientCore::Handle> m_handles;
+	std::mutex m_handlesMutex;
+	std::mutex m_outMutex;
+	size_t m_commands;
+	std::atomic<size_t> m_failed;
+};
@@ -0,0 +1,77 @@
+#include "Capture.h"
+
+
+
+CaptureWriter::~CaptureWriter() {
+	close();
+}
+
+
+
+bool CaptureWriter::open(const std::string& path) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_writer.open(path)) return false;
+
+	CaptureFileHeader header;
+	header.startTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	m_start = std::chrono::steady_clock::now();
+	m_nextConnection = 0;
+
+	m_isOpen = m_writer.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+	return m_isOpen;
+}
+
+
+bool CaptureWriter::close() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_isOpen) return true;
+	m_isOpen = false;
+	return m_writer.close();
+}
+
+
+
+uint32_t CaptureWriter::newConnection() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_nextConnection++;
+}
+
+
+bool CaptureWriter::record(CaptureDirection direction, uint32_t connection, const uint8_t* data, size_t size) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_isOpen) return false;
+
+	CaptureRecord record;
+	record.direction = direction;
+	record.connection = connection;
+	record.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count();
+	record.size = static_cast<uint32_t>(size);
+
+	return m_writer.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record)) && m_writer.write(data, size);
+}
+
+
+
+bool CaptureReader::open(const std::string& path) {
+	if (!m_file.open(path) || m_file.size() < sizeof(m_header)) return false;
+
+	memcpy(&m_header, m_file.data(), sizeof(m_header));
+	if (m_header.magic != CAPTURE_MAGIC || m_header.version != CAPTURE_VERSION) return false;
+
+	rewind();
+	return true;
+}
+
+
+/**
+ * The next complete record, 'data' points into the mapping. A torn record at the end ends the capture.
+ */
+bool CaptureReader::next(CaptureRecord& record, const uint8_t*& data) {
+	if (m_offset + sizeof(record) > m_file.size()) return false;
+	memcpy(&record, m_file.data() + m_offset, sizeof(record));
+	if (record.size > m_file.size() - m_offset - sizeof(record)) return false;
+
+	data = m_file.data() + m_offset + sizeof(record);
+	m_offset += sizeof(record) + record.size;
+	return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include "FileHandler.h"
+
+
+
+constexpr uint32_t CAPTURE_MAGIC = 0x5043554D;	// "MUCP"
+constexpr uint16_t CAPTURE_VERSION = 1;
+constexpr size_t CAPTURE_BUFFER_SIZE = 64 * 1024;
+
+
+enum CaptureDirection {
+	CAPTURE_REQUEST = 0,
+	CAPTURE_RESPONSE = 1
+};
+
+
+#pragma pack(push, 1)
+	struct CaptureFileHeader {
+		uint32_t magic;
+		uint16_t version;
+		uint64_t startTime;		// milliseconds since epoch
+
+		CaptureFileHeader() : magic(CAPTURE_MAGIC), version(CAPTURE_VERSION), startTime(0) {}
+	};
+
+
+	// Followed by 'size' bytes as they went over the wire, requests without the packet padding.
+	struct CaptureRecord {
+		uint8_t direction;
+		uint32_t connection;	// records of one request and its response share it
+		uint64_t timestamp;		// microseconds since the capture started
+		uint32_t size;
+
+		CaptureRecord() : direction(CAPTURE_REQUEST), connection(0), timestamp(0), size(0) {}
+	};
+#pragma pack(pop)
+
+
+/**
+ * Appends framed requests and responses to a binary capture file.
+ */
+class CaptureWriter {
+public:
+	CaptureWriter() : m_writer(CAPTURE_BUFFER_SIZE), m_isOpen(false), m_nextConnection(0) {}
+	virtual ~CaptureWriter();
+	CaptureWriter(const CaptureWriter& other) = delete;
+	CaptureWriter(CaptureWriter&& other) noexcept = delete;
+	CaptureWriter& operator=(const CaptureWriter& other) = delete;
+	CaptureWriter& operator=(CaptureWriter&& other) noexcept = delete;
+
+	bool open(const std::string&);
+	bool close();
+	uint32_t newConnection();
+	bool record(CaptureDirection, uint32_t, const uint8_t*, size_t);
+
+private:
+	BufferedWriter m_writer;
+	bool m_isOpen;
+	std::mutex m_mutex;
+	std::chrono::steady_clock::time_point m_start;
+	uint32_t m_nextConnection;
+};
+
+
+/**
+ * Walks the records of a capture file through a read only mapping.
+ */
+class CaptureReader {
+public:
+	CaptureReader() : m_offset(0) {}
+	virtual ~CaptureReader() = default;
+	CaptureReader(const CaptureReader& other) = delete;
+	CaptureReader(CaptureReader&& other) noexcept = delete;
+	CaptureReader& operator=(const CaptureReader& other) = delete;
+	CaptureReader& operator=(CaptureReader&& other) noexcept = delete;
+
+	bool open(const std::string&);
+	bool next(CaptureRecord&, const uint8_t*&);
+	void rewind() { m_offset = sizeof(CaptureFileHeader); }
+	const CaptureFileHeader& header() const { return m_header; }
+
+private:
+	MappedFile m_file;
+	CaptureFileHeader m_header;
+	size_t m_offset;
+};
@@ -1,25 +1,62 @@
 #include "Client.h"
 
 
-ClientHandler::ClientHandler() : m_ui(nullptr), m_fileHandler(nullptr), m_rsaDecryptor(nullptr), m_socketHandler(nullptr) {
+ClientHandler::ClientHandler(KeyType keyType) : m_ui(nullptr), m_fileHandler(nullptr), m_messageStore(nullptr), m_searchIndex(nullptr), m_asyncIO(nullptr), m_rsaDecryptor(nullptr), m_keyPool(nullptr), m_ecdh(nullptr), m_socketHandler(nullptr), m_stats(nullptr), m_tracer(nullptr), m_capture(nullptr), m_compress(false) {
 	m_ui = new ClientUI;
 	m_fileHandler = new FileHandler;
+	m_asyncIO = new AsyncFileIO;
+	m_messageStore = new MessageStore;
+	m_searchIndex = new SearchIndex(*m_messageStore);
+	if (!m_messageStore->open()) std::cout << "Can not open '" << MESSAGE_LOG_PATH << "', message history is disabled" << std::endl;
+	else if (!m_searchIndex->open()) std::cout << "Can not open '" << SEARCH_INDEX_PATH << "', message search is disabled" << std::endl;
+	m_stats = new Stats;
 	m_socketHandler = new SocketHandler;
+	m_socketHandler->setStats(m_stats);
+	m_tracer = new Tracer;
+	m_socketHandler->setTracer(m_tracer);
 	m_rsaDecryptor = new RSAPrivateWrapper;
+	m_ecdh = new ECDHWrapper;
+	m_this.keyType = keyType;
 
-	// if the user is registers, load all of his info
-	if (m_fileHandler->fileExists(CLIENT_FILE_PATH)) {
+	// if the user is registers, load all of his info, the text file is only imported once
+	if (m_fileHandler->fileExists(CLIENT_SNAPSHOT_PATH)) {
+		if (!loadSnapshot()) exit(1);
+		m_this.m_isRegistered = true;
+	} else if (m_fileHandler->fileExists(CLIENT_FILE_PATH)) {
 		if (!getClientInfo()) exit(1);
 		m_this.m_isRegistered = true;
+		saveSnapshot();
+	} else if (m_this.keyType == RSA_KEY) {
+		// start generating the key pair now, so registration only waits for the server.
+		// One key is enough, a refill would leave a generation running when the pool is deleted after registration.
+		m_keyPool = new KeyPool(DEFAULT_KEY_POOL_SIZE, 1, false);
 	}
 }
 
 
 ClientHandler::~ClientHandler() {
+	// keep the peers and keys we learned for the next start
+	if (m_this.m_isRegistered) saveSnapshot();
+
+	if (m_tracer->enabled()) {
+		const std::string trace = m_tracer->json();
+		if (!m_fileHandler->writeFile(TRACE_PATH, reinterpret_cast<const uint8_t*>(trace.data()), trace.size())) {
+			std::cout << "Can not write '" << TRACE_PATH << "'" << std::endl;
+		}
+	}
+
 	delete m_ui;
+	delete m_asyncIO;
+	delete m_searchIndex;
+	delete m_messageStore;
 	delete m_fileHandler;
 	delete m_socketHandler;
 	delete m_rsaDecryptor;
+	delete m_keyPool;
+	delete m_ecdh;
+	delete m_stats;
+	delete m_tracer;
+	delete m_capture;
 }
 
 
@@ -30,7 +67,7 @@ bool ClientHandler::clientMain() {
 	while (success) {
 		ClientUI::MenuOption opt = m_ui->display();
 
-		if (opt != ClientUI::MenuOption::REGISTER && opt != ClientUI::MenuOption::NONE_OPTION && opt != ClientUI::MenuOption::EXIT && !isRegistered()) {
+		if (opt != ClientUI::MenuOption::REGISTER && opt != ClientUI::MenuOption::SHOW_STATS && opt != ClientUI::MenuOption::NONE_OPTION && opt != ClientUI::MenuOption::EXIT && !isRegistered()) {
 			std::cout << "You must register to preform this action, please choose 'REGISTER' or press '0' to exit." << std::endl;
 			continue;
 		}
@@ -60,6 +97,15 @@ bool ClientHandler::clientMain() {
 		case ClientUI::MenuOption::SEND_FILE:
 			success = handleSendMsgRequest(MessageType::FILE_MSG);
 			break;
+		case ClientUI::MenuOption::MESSAGE_HISTORY:
+			success = handleMessageHistory();
+			break;
+		case ClientUI::MenuOption::SEARCH_MESSAGES:
+			success = handleSearchMessages();
+			break;
+		case ClientUI::MenuOption::SHOW_STATS:
+			success = handleShowStats();
+			break;
 		case ClientUI::MenuOption::EXIT:
 			std::cout << "Thank you, hope to see you soon!" << std::endl;
 			return success;
@@ -89,8 +135,28 @@ bool ClientHandler::handleRegistrationRequest() {
 
 	memcpy(req.name, userName.c_str(), NAME_SIZE);
 
-	m_rsaDecryptor->randomizePrivateKey();
-	const std::string publicKey = m_rsaDecryptor->getPublicKey();
+	std::string publicKey;
+	{
+		ScopedTimer timer(m_stats, REGISTER_CLIENT, PHASE_CRYPTO);
+		if (m_this.keyType == X25519_KEY) {
+			m_ecdh->generateKeyPair();
+			publicKey = m_ecdh->getPublicKey();
+			publicKey.resize(PUBLIC_KEY_SIZE, '\0');
+		} else {
+			const std::string privateKey = (m_keyPool != nullptr) ? m_keyPool->acquire() : "";
+			try {
+				if (privateKey.empty()) {
+					m_rsaDecryptor->randomizePrivateKey();
+				} else {
+					m_rsaDecryptor->loadPrivateKey(privateKey);
+				}
+			} catch (...) {
+				std::cout << "Failed to generate a private key" << std::endl;
+				return false;
+			}
+			publicKey = m_rsaDecryptor->getPublicKey();
+		}
+	}
 
 	if (publicKey.size() != PUBLIC_KEY_SIZE) {
 		std::cout << "Invalid public key length!" << std::endl;
@@ -98,6 +164,7 @@ bool ClientHandler::handleRegistrationRequest() {
 	}
 
 	memcpy(req.publicKey, publicKey.c_str(), PUBLIC_KEY_SIZE);
+	req.keyType = m_this.keyType;
 
 	if (!m_socketHandler->socketWrapper(reinterpret_cast<const uint8_t*>(&req), sizeof(req), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))) {
 		std::cout << "Failed to process REGISTRATION REQUEST" << std::endl;
@@ -113,12 +180,16 @@ bool ClientHandler::handleRegistrationRequest() {
 	m_this.clientId = resp.clientId;
 	memcpy(m_this.publicKey, publicKey.c_str(), PUBLIC_KEY_SIZE);
 	
-	if (!setClientInfo()) {
+	if (!setClientInfo() || !saveSnapshot()) {
 		std::cout << "Error while trying to save your details" << std::endl;
 		return false;
 	}
 
 	m_this.m_isRegistered = true;
+
+	// no more keys are needed for this client
+	delete m_keyPool;
+	m_keyPool = nullptr;
 	return true;
 }
 
@@ -130,22 +201,30 @@ bool ClientHandler::handleClientsListRequest(bool show) {
 		return false;
 	}
 
-	const size_t payloadSize = resp.header.payloadtSize;
-	const size_t clientBlockSize = CLIENT_ID_SIZE + NAME_SIZE;	// 271 bytes
-	size_t bytesRead = 0;
-
-	UnpackClient temp;
-	Client newClient;
+	std::vector<UnpackClient> parsed;
+	bool valid = false;
+	{
+		ScopedTimer timer(m_stats, GET_CLIENTS_LIST, PHASE_PARSE);
+		TraceSpan span(m_tracer, "parse", GET_CLIENTS_LIST);
+		valid = PayloadParser::parseClients(resp.payload, resp.header.payloadtSize, parsed);
+	}
+	delete[] resp.payload;
+	if (!valid) {
+		std::cout << "Invalid clients list payload" << std::endl;
+		return false;
+	}
 
-	m_clients.clear();
-	while (bytesRead < payloadSize) {
-		memcpy(&temp, &resp.payload[bytesRead], clientBlockSize);
+	std::vector<Client> clients;
+	clients.reserve(parsed.size());
+	for (const auto& temp : parsed) {
+		// keep the keys we already know about this client
+		Client newClient;
+		getClient("", &temp.clientId, newClient, 2);
 		newClient.clientId = temp.clientId;
-		temp.name[sizeof(temp.name) - 1] = '\0';
-		newClient.name = reinterpret_cast<char*>(temp.name);
-		m_clients.push_back(newClient);
-		bytesRead += clientBlockSize;
+		newClient.name = reinterpret_cast<const char*>(temp.name);
+		clients.push_back(newClient);
 	}
+	m_clients.swap(clients);
 	
 	if (show) {
 		std::cout << "Clients:" << std::endl;
@@ -155,7 +234,6 @@ bool ClientHandler::handleClientsListRequest(bool show) {
 		}
 	}
 
-	delete[] resp.payload;
 	return true;
 }
 
@@ -173,54 +251,68 @@ bool ClientHandler::handleGetUnreadMessages() {
 		return true;
 	}
 
-	const size_t payloadSize = resp.header.payloadtSize;
-	const size_t msgHeaderSize = sizeof(UnpackMessage);
-	size_t msgSize = 0;
-
-
-	if (payloadSize < msgHeaderSize) return false;
+	std::vector<ParsedMessage> messages;
+	bool valid = false;
+	{
+		ScopedTimer timer(m_stats, GET_UNREAD_MESSAGES, PHASE_PARSE);
+		TraceSpan span(m_tracer, "parse", GET_UNREAD_MESSAGES);
+		valid = PayloadParser::parseMessages(resp.payload, resp.header.payloadtSize, messages);
+	}
+	if (!valid) {
+		std::cout << "Invalid messages payload" << std::endl;
+		delete[] resp.payload;
+		return false;
+	}
 
-	UnpackMessage msgHeader;
-	uint32_t bytesRead = 0;
-	uint8_t* p = resp.payload;
-	uint8_t* msg;
 	AESWrapper aes;
-	Client from;
-	while (bytesRead < payloadSize) {
-		memcpy(&msgHeader, p, msgHeaderSize);
-		p += msgHeaderSize;
-		msgSize = msgHeader.msgSize;
-	
-		if (msgSize == 0) {
-			bytesRead = bytesRead + msgHeaderSize;
-			continue;
-		} else if (bytesRead + msgSize > payloadSize) {
-			return false;
-		}
+	std::vector<std::pair<std::string, std::future<bool>>> savedFiles;
+	for (const auto& message : messages) {
+		const UnpackMessage& msgHeader = message.header;
+		const uint8_t* p = message.content;
+		const size_t msgSize = msgHeader.msgSize;
+		const uint8_t msgType = msgHeader.msgType & MESSAGE_TYPE_MASK;
+		const bool compressed = (msgHeader.msgType & COMPRESSED_MESSAGE) != 0;
+		if (msgSize == 0) continue;
 
+		Client from;
 
 		if (!getClient("", &msgHeader.clientId, from, 2)) {
 			std::cout << "FROM: Unknown {ID: " << msgHeader.clientId.id << "}" << std::endl;
 		} else {
 			std::cout << "FROM: " << from.name << std::endl;
+			if (!from.hasSymKey()) deriveSymKey(from);
 		}
 		
 
-		if (strlen(reinterpret_cast<char*>(from.symKey)) > 0) {
+		if (from.hasSymKey()) {
 			aes.loadKey(from.symKey, sizeof(from.symKey));
 			std::string data;
 			try {
-				data = aes.decrypt(p, msgSize);
-				std::cout << "\t" << data << std::endl;
+				{
+					ScopedTimer timer(m_stats, GET_UNREAD_MESSAGES, PHASE_CRYPTO);
+					TraceSpan span(m_tracer, "decrypt", GET_UNREAD_MESSAGES, msgHeader.messageID);
+					data = compressed ? aes.decryptInflated(p, msgSize) : aes.decrypt(p, msgSize);
+				}
+				if (msgType == FILE_MSG) {
+					// written in the background while the next messages are decrypted
+					const std::string path = (std::filesystem::temp_directory_path() / ("MessageU_" + std::to_string(msgHeader.messageID))).string();
+					std::cout << "\tFile saved to: " << path << std::endl;
+					storeMessage(msgHeader.clientId, INCOMING_MESSAGE, msgHeader.messageID, msgType, path);
+					savedFiles.emplace_back(path, m_asyncIO->write(path, std::make_shared<const std::string>(std::move(data))));
+				} else {
+					std::cout << "\t" << data << std::endl;
+					if (msgType == TEXT_MESSAGE) storeMessage(msgHeader.clientId, INCOMING_MESSAGE, msgHeader.messageID, msgType, data);
+				}
 			} catch (...) {
 				std::cout << "\tCan not decrypt message content... " << std::endl;
 			}
 		} else {
 			std::cout << "\tCan not get client symmetric key" << std::endl;
 		}
+	}
 
-		p += msgSize;
-		bytesRead = bytesRead + msgHeaderSize + msgSize;
+	for (auto& saved : savedFiles) {
+		if (!saved.second.get()) std::cout << "Failed to save file " << saved.first << std::endl;
 	}
 
 	delete[] resp.payload;
@@ -230,8 +322,10 @@ bool ClientHandler::handleGetUnreadMessages() {
 
 bool ClientHandler::handleGetPublicKeyRequest(Client* client, bool display) {
 	std::string userName;
+	Client requested;
 
 	if (client == nullptr) {
+		client = &requested;
 		do {
 			userName = m_ui->getCleanInput("Please enter the name of the user you want to get the key for: ");
 		} while (!isValidUsername(userName));
@@ -257,6 +351,11 @@ bool ClientHandler::handleGetPublicKeyRequest(Client* client, bool display) {
 
 	// store the public key
 	memcpy_s(client->publicKey, sizeof(client->publicKey), resp.publicKey, sizeof(resp.publicKey));
+	client->keyType = resp.keyType;
+	client->clientId = resp.clientID;
+	client->name = userName;
+	updateClient(*client);
+
 	if(display) std::cout << "User info:\n\tname: " << req.name << "\n\tid: " << resp.clientID.id << "\n\tpublic key: " << resp.publicKey << std::endl;
 	return true;
 }
@@ -266,6 +365,14 @@ bool ClientHandler::handleGetPublicKeyRequest(Client* client, bool display) {
 bool ClientHandler::handleSendMsgRequest(MessageType msgType) {
 	std::string userName = m_ui->getCleanInput("Please enter the recipient's user name: ");
 
+	// start reading the attachment now, the disk read overlaps the requests below
+	std::string filePath;
+	std::future<std::shared_ptr<std::string>> fileContent;
+	if (msgType == FILE_MSG) {
+		filePath = m_ui->getCleanInput("Please enter the file path: ");
+		fileContent = m_asyncIO->read(filePath);
+	}
+
 	handleClientsListRequest();
 
 	Client recipient;
@@ -281,30 +388,28 @@ bool ClientHandler::handleSendMsgRequest(MessageType msgType) {
 	req.header.clientId = m_this.clientId;
 	req.clientId = recipient.clientId;
 
-	// encode message
-	if (!recipient.symKey) {
-		std::cout << "Couldn't find " << recipient.name << "'s symmetric key.";
-		return false;
+	// with X25519 on both sides the symmetric key comes from key agreement
+	if (!recipient.hasSymKey() && deriveSymKey(recipient) && msgType != TEXT_MESSAGE && msgType != FILE_MSG) {
+		std::cout << "Symmetric key with " << recipient.name << " was derived from your X25519 keys, no key exchange needed." << std::endl;
+		return true;
 	}
 
 	std::string msg;
-	std::string encrypted;
+	std::string content;
+	std::shared_ptr<std::string> file;
 	AESWrapper aes;
 	RSAPublicWrapper rsa;
 
 	switch (msgType) {
 		case REQUEST_SYM_KEY:
 			req.msgType = MessageType::REQUEST_SYM_KEY;
-			msg = "Request for symmetric key";
-
-			req.contentSize = msg.length();
-			req.msgContent = new uint8_t[req.contentSize];
-			memcpy(req.msgContent, msg.c_str(), req.contentSize);
+			content = "Request for symmetric key";
 			break;
 		case SEND_SYM_KEY:
 			req.msgType = MessageType::SEND_SYM_KEY;
 			aes.generateKey();	// generate symmetric key
 			aes.getKey(recipient.symKey, sizeof(recipient.symKey));
+			updateClient(recipient);
 
 			if (recipient.publicKey[0] == '\0') {
 				if (!handleGetPublicKeyRequest(&recipient)) {
@@ -315,47 +420,177 @@ bool ClientHandler::handleSendMsgRequest(MessageType msgType) {
 
 			break;
 		case TEXT_MESSAGE:
-		case FILE_MSG:
 			msg = m_ui->getCleanInput("Please enter the message: ");
 			if (msg.empty()) {
 				std::cout << "You must type a message" << std::endl;
 				return true;
 			}
 
-			req.msgType = (msgType == MessageType::TEXT_MESSAGE) ? MessageType::TEXT_MESSAGE : MessageType::FILE_MSG;
+			req.msgType = MessageType::TEXT_MESSAGE;
 			aes.loadKey(recipient.symKey, sizeof(recipient.symKey));
-			encrypted = aes.encrypt(msg);
-			req.contentSize = encrypted.size();
-			req.header.payloadSize = req.payloadSizeWithoutMsg() + req.contentSize;
+			{
+				ScopedTimer timer(m_stats, SEND_MESSAGE, PHASE_CRYPTO);
+				TraceSpan span(m_tracer, "encrypt", SEND_MESSAGE);
+				const uint8_t* text = reinterpret_cast<const uint8_t*>(msg.data());
+				if (m_compress && Compression::worthwhile(text, msg.size())) {
+					content = aes.encryptDeflated(text, msg.size());
+					req.msgType |= COMPRESSED_MESSAGE;
+				} else {
+					content = aes.encrypt(msg);
+				}
+			}
+			break;
+		case FILE_MSG:
+			file = fileContent.get();
+			if (file == nullptr || file->empty()) {
+				std::cout << "Can not read file '" << filePath << "'" << std::endl;
+				return true;
+			}
 
-			// copy the encoded message into the payload
-			req.msgContent = new uint8_t[req.contentSize];
-			memcpy(req.msgContent, encrypted.c_str(), req.contentSize);
+			req.msgType = MessageType::FILE_MSG;
+			aes.loadKey(recipient.symKey, sizeof(recipient.symKey));
+			{
+				ScopedTimer timer(m_stats, SEND_MESSAGE, PHASE_CRYPTO);
+				TraceSpan span(m_tracer, "encrypt", SEND_MESSAGE);
+				const uint8_t* data = reinterpret_cast<const uint8_t*>(file->data());
+				if (m_compress && Compression::worthwhile(data, file->size())) {
+					content = aes.encryptDeflated(data, file->size());
+					req.msgType |= COMPRESSED_MESSAGE;
+				} else {
+					content = aes.encrypt(data, file->size());
+				}
+			}
+			file.reset();
 			break;
 		default:
 			std::cout << "Invalid message type, can not send message" << std::endl;
 			return true;
 	}
 
+	// the content is sent right after the fixed request fields
+	req.contentSize = static_cast<uint32_t>(content.size());
+	req.msgContent = content.empty() ? nullptr : reinterpret_cast<uint8_t*>(&content[0]);
+	const std::vector<uint8_t> packet = req.pack();
 
 	MessageSentResponse resp;
 
-	if (!m_socketHandler->socketWrapper(reinterpret_cast<const uint8_t *>(&req), sizeof(req), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))) {
+	if (!m_socketHandler->socketWrapper(packet.data(), packet.size(), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))) {
 		std::cout << "Error while trying to connect with server." << std::endl;
-		delete[] req.msgContent;
 		return false;
 	}
 
 	if (!isValidResponse(resp.header, ResponseCode::MESSAGE_SENT_SUCCESS)) {
 		std::cout << "Invalid response, can not complete action" << std::endl;
-		delete[] req.msgContent;
 		return false;
 	}
 
 	std::cout << resp.clientId.id << std::endl;
 	std::cout << resp.msgID << std::endl;
 
-	delete[] req.msgContent;
+	if (msgType == TEXT_MESSAGE || msgType == FILE_MSG) {
+		storeMessage(recipient.clientId, OUTGOING_MESSAGE, resp.msgID, msgType, (msgType == FILE_MSG) ? filePath : msg);
+	}
+	return true;
+}
+
+
+
+bool ClientHandler::handleSearchMessages() {
+	const std::string query = m_ui->getCleanInput("Please enter the words to search for: ");
+	const std::string userName = m_ui->getCleanInput("Only messages with user (name, or '*' for everyone): ");
+
+	Client peer;
+	if (userName != "*" && !getClient(userName, NULL, peer, 1)) {
+		std::cout << "Invalid user name, no user by this name." << std::endl;
+		return true;
+	}
+
+	const auto results = m_searchIndex->search(query, (userName == "*") ? nullptr : &peer.clientId);
+	if (results.empty()) {
+		std::cout << "No matching messages..." << std::endl;
+		return true;
+	}
+
+	for (const auto& message : results) printStoredMessage(message);
+	return true;
+}
+
+
+
+/**
+ * Page through the locally stored conversation with one user, newest messages first.
+ */
+bool ClientHandler::handleMessageHistory() {
+	constexpr size_t pageSize = 10;
+	const std::string userName = m_ui->getCleanInput("Please enter the user name: ");
+
+	Client peer;
+	if (!getClient(userName, NULL, peer, 1)) {
+		handleClientsListRequest();
+		if (!getClient(userName, NULL, peer, 1)) {
+			std::cout << "Invalid user name, no user by this name." << std::endl;
+			return true;
+		}
+	}
+
+	const size_t total = m_messageStore->count(peer.clientId);
+	if (total == 0) {
+		std::cout << "No messages with " << peer.name << "..." << std::endl;
+		return true;
+	}
+
+	for (size_t skip = 0; skip < total; skip += pageSize) {
+		for (const auto& message : m_messageStore->history(peer.clientId, skip, pageSize)) {
+			printStoredMessage(message);
+		}
+
+		if (skip + pageSize >= total) break;
+		if (m_ui->getCleanInput("Show older messages? (y/n): ") != "y") break;
+	}
+	return true;
+}
+
+
+
+
+/**
+ * Record all traffic with the server to a capture file, the Replay tool plays it back.
+ */
+bool ClientHandler::enableCapture(const std::string& path) {
+	if (m_capture == nullptr) m_capture = new CaptureWriter;
+	if (!m_capture->open(path)) {
+		std::cout << "Can not open capture file '" << path << "'" << std::endl;
+		m_socketHandler->setCapture(nullptr);
+		return false;
+	}
+	m_socketHandler->setCapture(m_capture);
+	return true;
+}
+
+
+
+/**
+ * Show where the request time went, per request code, and optionally dump it to a CSV file.
+ */
+bool ClientHandler::handleShowStats() {
+	if (!m_stats->enabled()) {
+		std::cout << "Statistics are disabled, start the client with --stats to collect them." << std::endl;
+		return true;
+	}
+
+	const std::string report = m_stats->report();
+	if (report.empty()) {
+		std::cout << "No requests were made yet..." << std::endl;
+		return true;
+	}
+	std::cout << report;
+
+	if (m_ui->getCleanInput("Dump the statistics to '" + std::string(STATS_DUMP_PATH) + "'? (y/n): ") == "y") {
+		const std::string csv = m_stats->csv();
+		if (!m_fileHandler->writeFile(STATS_DUMP_PATH, reinterpret_cast<const uint8_t*>(csv.data()), csv.size())) {
+			std::cout << "Can not write '" << STATS_DUMP_PATH << "'" << std::endl;
+		}
+	}
 	return true;
 }
 
@@ -451,14 +686,72 @@ bool ClientHandler::isValidUsername(const std::string& userName) {
 
 
 bool ClientHandler::setClientInfo() {
-	if (!m_fileHandler->write(CLIENT_FILE_PATH, m_this.name)) return false;
-
 	const std::string hexID = Utils::bytesToHex(m_this.clientId.id, sizeof(m_this.clientId.id));
-	if (hexID == "" || !m_fileHandler->write(CLIENT_FILE_PATH, hexID)) return false;
+	if (hexID == "") return false;
+
+	const std::string privateKey = (m_this.keyType == X25519_KEY) ? m_ecdh->getPrivateKey() : m_rsaDecryptor->getPrivateKey();
+	const std::string encodedPrivateKey = Utils::encodeBase64(privateKey);
+	if (encodedPrivateKey == "") return false;
+
+	// one write for all three lines
+	return m_fileHandler->write(CLIENT_FILE_PATH, m_this.name + "\n" + hexID + "\n" + encodedPrivateKey);
+}
+
+
+bool ClientHandler::saveSnapshot() {
+	IdentitySnapshot snapshot;
+	snapshot.name = m_this.name;
+	snapshot.clientId = m_this.clientId;
+	snapshot.keyType = m_this.keyType;
+	snapshot.privateKey = (m_this.keyType == X25519_KEY) ? m_ecdh->getPrivateKey() : m_rsaDecryptor->getPrivateKey();
+
+	snapshot.peers.reserve(m_clients.size());
+	for (const auto& client : m_clients) {
+		PeerRecord peer;
+		peer.clientId = client.clientId;
+		peer.name = client.name;
+		peer.keyType = client.keyType;
+		memcpy(peer.publicKey, client.publicKey, PUBLIC_KEY_SIZE);
+		memcpy(peer.symKey, client.symKey, SYM_KEY_SIZE);
+		snapshot.peers.push_back(std::move(peer));
+	}
+
+	return IdentityStore::save(*m_fileHandler, CLIENT_SNAPSHOT_PATH, snapshot);
+}
 
-	const std::string encodedPrivateKey = Utils::encodeBase64(m_rsaDecryptor->getPrivateKey());
-	if (encodedPrivateKey == "" || !m_fileHandler->write(CLIENT_FILE_PATH, encodedPrivateKey)) return false;
 
+bool ClientHandler::loadSnapshot() {
+	IdentitySnapshot snapshot;
+	if (!IdentityStore::load(CLIENT_SNAPSHOT_PATH, snapshot)) {
+		std::cout << "Error while trying to read '" << CLIENT_SNAPSHOT_PATH << "'" << std::endl;
+		return false;
+	}
+
+	try {
+		if (snapshot.keyType == X25519_KEY) {
+			m_ecdh->loadPrivateKey(snapshot.privateKey);
+		} else {
+			m_rsaDecryptor->loadPrivateKey(snapshot.privateKey);
+		}
+	} catch (...) {
+		return false;
+	}
+
+	m_this.name = snapshot.name;
+	m_this.clientId = snapshot.clientId;
+	m_this.keyType = snapshot.keyType;
+
+	m_clients.clear();
+	m_clients.reserve(snapshot.peers.size());
+	for (const auto& peer : snapshot.peers) {
+		Client client;
+		client.clientId = peer.clientId;
+		client.name = peer.name;
+		client.keyType = peer.keyType;
+		memcpy(client.publicKey, peer.publicKey, PUBLIC_KEY_SIZE);
+		memcpy(client.symKey, peer.symKey, SYM_KEY_SIZE);
+		m_clients.push_back(client);
+	}
 	return true;
 }
 
@@ -494,8 +787,15 @@ bool ClientHandler::getClientInfo() {
 		return false;
 	}
 
+	// a raw 32 byte key is an X25519 identity, anything else is a DER encoded RSA key
 	try {
-		m_rsaDecryptor->loadPrivateKey(key);
+		if (key.size() == X25519_KEY_SIZE) {
+			m_ecdh->loadPrivateKey(key);
+			m_this.keyType = X25519_KEY;
+		} else {
+			m_rsaDecryptor->loadPrivateKey(key);
+			m_this.keyType = RSA_KEY;
+		}
 	} catch (...) {
 		return false;
 	}
@@ -503,7 +803,7 @@ bool ClientHandler::getClientInfo() {
 	return true;
 }
 
-bool ClientHandler::getClient(const std::string& name, ClientID* id, Client& outClient, int selector) {
+bool ClientHandler::getClient(const std::string& name, const ClientID* id, Client& outClient, int selector) {
 	if (m_clients.empty()) return false;
 
 	for (const auto& client : m_clients) {
@@ -524,3 +824,61 @@ bool ClientHandler::getClient(const std::string& name, ClientID* id, Client& out
 	}
 	return false;
 }
+
+
+void ClientHandler::updateClient(const Client& updated) {
+	for (auto& client : m_clients) {
+		if (client.clientId == updated.clientId) {
+			client = updated;
+			return;
+		}
+	}
+	m_clients.push_back(updated);
+}
+
+
+
+/**
+ * Derive the symmetric key shared with an X25519 peer, fetching the peer's public key if needed.
+ * Return false if either side uses a legacy RSA identity.
+ */
+bool ClientHandler::deriveSymKey(Client& peer) {
+	if (m_this.keyType != X25519_KEY) return false;
+
+	if (!peer.hasPublicKey() && !handleGetPublicKeyRequest(&peer)) return false;
+	if (peer.keyType != X25519_KEY) return false;
+
+	// key agreement replaces the key exchange, so it is counted with the public key requests
+	{
+		ScopedTimer timer(m_stats, GET_PUBLIC_KEY, PHASE_CRYPTO);
+		if (!m_ecdh->deriveSymKey(peer.publicKey, X25519_KEY_SIZE, peer.symKey, sizeof(peer.symKey))) return false;
+	}
+
+	updateClient(peer);
+	return true;
+}
+
+
+void ClientHandler::storeMessage(const ClientID& peer, MessageDirection direction, uint32_t messageID, uint8_t msgType, const std::string& content) {
+	const uint32_t sequence = m_messageStore->append(peer, direction, messageID, msgType, content);
+	if (sequence != MessageStore::INVALID_SEQUENCE) m_searchIndex->add(sequence, content);
+}
+
+
+void ClientHandler::printStoredMessage(const StoredMessage& message) {
+	Client peer;
+	const std::string peerName = getClient("", &message.peer, peer, 2) ? peer.name : "Unknown";
+
+	const std::time_t time = static_cast<std::time_t>(message.timestamp / 1000);
+	std::tm localTime = {};
+#ifdef _WIN32
+	localtime_s(&localTime, &time);
+#else
+	localtime_r(&time, &localTime);
+#endif
+	char timeString[32] = { 0 };
+	std::strftime(timeString, sizeof(timeString), "%d/%m/%Y %H:%M:%S", &localTime);
+
+	std::cout << "[" << timeString << "] " << ((message.direction == OUTGOING_MESSAGE) ? m_this.name : peerName) << ":" << std::endl;
+	std::cout << "\t" << ((message.msgType == FILE_MSG) ? "File: " : "") << message.content << std::endl;
+}
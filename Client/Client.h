@@ -1,12 +1,23 @@
 #pragma once
 #include <iostream>
 #include <format>
+#include <ctime>
 #include "SocketHandler.h"
 #include "FileHandler.h"
+#include "AsyncFileIO.h"
 #include "Protocol.h"
+#include "PayloadParser.h"
 #include "ClientUI.h"
 #include "RSAHandler.h"
 #include "AESHandler.h"
+#include "KeyPool.h"
+#include "ECDHHandler.h"
+#include "IdentityStore.h"
+#include "MessageStore.h"
+#include "SearchIndex.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Capture.h"
 #include "Utils.h"
 
 
@@ -21,12 +32,15 @@ public:
 		std::string name;
 		uint8_t publicKey[PUBLIC_KEY_SIZE];
 		uint8_t symKey[SYM_KEY_SIZE];
+		uint8_t keyType;
 		bool m_isRegistered;
 
-		Client() : publicKey { 0 }, symKey{ 0 }, m_isRegistered(false) {}
+		Client() : publicKey { 0 }, symKey{ 0 }, keyType(RSA_KEY), m_isRegistered(false) {}
+		bool hasSymKey() const { return std::any_of(symKey, symKey + SYM_KEY_SIZE, [](uint8_t b) { return b != 0; }); }
+		bool hasPublicKey() const { return std::any_of(publicKey, publicKey + PUBLIC_KEY_SIZE, [](uint8_t b) { return b != 0; }); }
 	};
 
-	ClientHandler();
+	explicit ClientHandler(KeyType keyType = RSA_KEY);
 	virtual ~ClientHandler();
 	ClientHandler(const ClientHandler& other) = delete;
 	ClientHandler(ClientHandler&& other) noexcept = delete;
@@ -35,6 +49,12 @@ public:
 
 	bool clientMain();
 	bool isRegistered() { return m_this.m_isRegistered; };
+	bool useServer(const std::string& address, const std::string& port) { return m_socketHandler->setServer(address, port); }
+	void setRequestPolicy(const RequestPolicy& policy) { m_socketHandler->setPolicy(policy); }
+	void enableStats(bool enabled) { m_stats->setEnabled(enabled); }
+	void enableTrace(bool enabled) { m_tracer->setEnabled(enabled); }
+	void enableCompression(bool enabled) { m_compress = enabled; }
+	bool enableCapture(const std::string&);
 
 private:
 	bool handleRegistrationRequest();
@@ -42,10 +62,19 @@ private:
 	bool handleClientsListRequest(bool=false);
 	bool handleGetUnreadMessages();
 	bool handleSendMsgRequest(MessageType);
+	bool handleMessageHistory();
+	bool handleSearchMessages();
+	bool handleShowStats();
+	void storeMessage(const ClientID&, MessageDirection, uint32_t, uint8_t, const std::string&);
+	void printStoredMessage(const StoredMessage&);
 	bool handelUnkownPayloadRequest(RequestCode, ResponseCode, uint8_t*&, uint32_t&);
 	bool setClientInfo();
 	bool getClientInfo();
-	bool getClient(const std::string&, ClientID*, Client&, int);
+	bool saveSnapshot();
+	bool loadSnapshot();
+	bool getClient(const std::string&, const ClientID*, Client&, int);
+	void updateClient(const Client&);
+	bool deriveSymKey(Client&);
 	bool isValidResponse(const ResponseHeader&, ResponseCode);
 	bool isValidUsername(const std::string&);
 
@@ -53,6 +82,15 @@ private:
 	std::vector<Client> m_clients;
 	ClientUI* m_ui;
 	RSAPrivateWrapper* m_rsaDecryptor;
+	KeyPool* m_keyPool;
+	ECDHWrapper* m_ecdh;
 	SocketHandler* m_socketHandler;
 	FileHandler* m_fileHandler;
+	MessageStore* m_messageStore;
+	SearchIndex* m_searchIndex;
+	AsyncFileIO* m_asyncIO;
+	Stats* m_stats;
+	Tracer* m_tracer;
+	CaptureWriter* m_capture;
+	bool m_compress;		// deflate text and files before encryption when it pays off
 };
\ No newline at end of file
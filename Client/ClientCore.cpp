@@ -0,0 +1,640 @@
+#include "ClientCore.h"
+#include <iostream>
+
+
+
+ClientCore::ClientCore(const ClientCoreConfig& config) : m_stats(nullptr), m_sockets(nullptr), m_mux(nullptr), m_workers(nullptr), m_keyPool(nullptr), m_directory(nullptr), m_compress(config.compress), m_refreshes(0) {
+	m_stats = new Stats;
+	m_sockets = new SocketPool(config.connections, config.address, config.port);
+	m_sockets->forEach([this](SocketHandler& socket) {
+		socket.setStats(m_stats);
+		return true;
+	});
+	m_workers = new WorkerPool(config.cryptoWorkers);
+	if (config.rsaKeys > 0) m_keyPool = new KeyPool(config.rsaKeys, config.cryptoWorkers);
+	m_directory = new Directory(config.directoryTtl);
+
+	if (config.multiplex) {
+		if (!config.address.empty()) {
+			openMultiplexer(config.address, config.port);
+		} else {
+			auto socket = m_sockets->acquire();
+			const EndpointSelector& endpoints = socket->endpoints();
+			if (endpoints.size() == 1 && !endpoints.sharded()) openMultiplexer(endpoints[0].address, endpoints[0].port);
+			else std::cout << "Multiplexing needs a single server, using one connection per request" << std::endl;
+		}
+	}
+}
+
+
+ClientCore::~ClientCore() {
+	for (auto identity : m_identities) delete identity;
+	delete m_directory;
+	delete m_keyPool;
+	delete m_workers;
+	delete m_mux;
+	delete m_sockets;
+	delete m_stats;
+}
+
+
+
+// Not to be called while requests are in flight.
+bool ClientCore::useServer(const std::string& address, const std::string& port) {
+	if (m_mux != nullptr) {
+		delete m_mux;
+		m_mux = nullptr;
+		openMultiplexer(address, port);
+	}
+	return m_sockets->forEach([&](SocketHandler& socket) { return socket.setServer(address, port); });
+}
+
+
+bool ClientCore::setRequestPolicy(const RequestPolicy& policy) {
+	m_policy = policy;
+	return m_sockets->forEach([&](SocketHandler& socket) {
+		socket.setPolicy(policy);
+		return true;
+	});
+}
+
+
+
+bool ClientCore::registerIdentity(const std::string& name, KeyType keyType, Handle& handle) {
+	if (name.empty() || name.size() >= NAME_SIZE) {
+		std::cout << "Invalid user name '" << name << "'" << std::endl;
+		return false;
+	}
+
+	Identity* identity = new Identity;
+	identity->name = name;
+	identity->keyType = keyType;
+
+	std::string publicKey;
+	{
+		ScopedTimer timer(m_stats, REGISTER_CLIENT, PHASE_CRYPTO);
+		try {
+			if (keyType == X25519_KEY) {
+				identity->ecdh.generateKeyPair();
+				publicKey = identity->ecdh.getPublicKey();
+				publicKey.resize(PUBLIC_KEY_SIZE, '\0');
+			} else {
+				const std::string privateKey = (m_keyPool != nullptr) ? m_keyPool->acquire() : "";
+				if (privateKey.empty()) identity->rsa.randomizePrivateKey();
+				else identity->rsa.loadPrivateKey(privateKey);
+				publicKey = identity->rsa.getPublicKey();
+			}
+		} catch (...) {
+			publicKey.clear();
+		}
+	}
+	if (publicKey.size() != PUBLIC_KEY_SIZE) {
+		std::cout << "Failed to generate a key pair for '" << name << "'" << std::endl;
+		delete identity;
+		return false;
+	}
+
+	RegistrationRequest req;
+	RegistrationResponse resp;
+	memcpy(req.name, name.c_str(), name.size());
+	memcpy(req.publicKey, publicKey.c_str(), PUBLIC_KEY_SIZE);
+	req.keyType = keyType;
+
+	if (!transact(reinterpret_cast<const uint8_t*>(&req), sizeof(req), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))
+		|| !isValidResponse(resp.header, ResponseCode::REGISTER_SUCCESS)) {
+		std::cout << "Failed to register '" << name << "'" << std::endl;
+		delete identity;
+		return false;
+	}
+
+	identity->clientId = resp.clientId;
+	handle = addIdentity(identity);
+	return true;
+}
+
+
+
+/**
+ * Identities are stored in the client's snapshot format, with the symmetric keys of their peers.
+ */
+bool ClientCore::loadIdentity(const std::string& path, Handle& handle) {
+	IdentitySnapshot snapshot;
+	if (!IdentityStore::load(path, snapshot)) {
+		std::cout << "Error while trying to read '" << path << "'" << std::endl;
+		return false;
+	}
+
+	Identity* identity = new Identity;
+	try {
+		if (snapshot.keyType == X25519_KEY) identity->ecdh.loadPrivateKey(snapshot.privateKey);
+		else identity->rsa.loadPrivateKey(snapshot.privateKey);
+	} catch (...) {
+		std::cout << "Invalid private key in '" << path << "'" << std::endl;
+		delete identity;
+		return false;
+	}
+
+	identity->name = snapshot.name;
+	identity->clientId = snapshot.clientId;
+	identity->keyType = snapshot.keyType;
+	for (const auto& peer : snapshot.peers) {
+		if (std::any_of(peer.publicKey, peer.publicKey + PUBLIC_KEY_SIZE, [](uint8_t b) { return b != 0; })) {
+			m_directory->setPublicKey(peer.clientId, peer.name, peer.publicKey, peer.keyType);
+		}
+		if (std::any_of(peer.symKey, peer.symKey + SYM_KEY_SIZE, [](uint8_t b) { return b != 0; })) {
+			std::copy(peer.symKey, peer.symKey + SYM_KEY_SIZE, identity->symKeys[peer.clientId].begin());
+		}
+	}
+
+	handle = addIdentity(identity);
+	return true;
+}
+
+
+bool ClientCore::saveIdentity(Handle handle, const std::string& path) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+
+	IdentitySnapshot snapshot;
+	snapshot.name = identity->name;
+	snapshot.clientId = identity->clientId;
+	snapshot.keyType = identity->keyType;
+	snapshot.privateKey = (identity->keyType == X25519_KEY) ? identity->ecdh.getPrivateKey() : identity->rsa.getPrivateKey();
+
+	snapshot.peers.reserve(identity->symKeys.size());
+	for (const auto& [clientId, symKey] : identity->symKeys) {
+		PeerRecord peer;
+		peer.clientId = clientId;
+		DirectoryEntry entry;
+		if (m_directory->find(clientId, entry)) {
+			peer.name = entry.name;
+			peer.keyType = entry.keyType;
+			memcpy(peer.publicKey, entry.publicKey, PUBLIC_KEY_SIZE);
+		}
+		memcpy(peer.symKey, symKey.data(), SYM_KEY_SIZE);
+		snapshot.peers.push_back(std::move(peer));
+	}
+
+	FileHandler fileHandler;
+	return IdentityStore::save(fileHandler, path, snapshot);
+}
+
+
+
+size_t ClientCore::identities() const {
+	std::shared_lock<std::shared_mutex> lock(m_identitiesMutex);
+	return m_identities.size();
+}
+
+
+std::string ClientCore::name(Handle handle) const {
+	Identity* identity = this->identity(handle);
+	return (identity != nullptr) ? identity->name : "";
+}
+
+
+
+bool ClientCore::refreshDirectory(Handle handle) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+	return refresh(*identity, m_refreshes);
+}
+
+
+bool ClientCore::lookup(Handle handle, const std::string& name, DirectoryEntry& entry) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+	return findPeer(*identity, name, entry);
+}
+
+
+
+bool ClientCore::getPublicKey(Handle handle, const std::string& name, DirectoryEntry& entry) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+	if (!findPeer(*identity, name, entry)) return false;
+	return entry.hasPublicKey || fetchPublicKey(*identity, entry);
+}
+
+
+
+bool ClientCore::requestSymKey(Handle handle, const std::string& to) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+
+	DirectoryEntry peer;
+	if (!findPeer(*identity, to, peer)) return false;
+	return sendMessage(*identity, peer.clientId, REQUEST_SYM_KEY, SYM_KEY_REQUEST_TEXT, nullptr);
+}
+
+
+/**
+ * A new symmetric key, sent encrypted with the peer's RSA public key.
+ * Between two X25519 identities the key is derived instead and nothing is sent.
+ */
+bool ClientCore::sendSymKey(Handle handle, const std::string& to) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+
+	DirectoryEntry peer;
+	if (!findPeer(*identity, to, peer)) return false;
+	if (!peer.hasPublicKey && !fetchPublicKey(*identity, peer)) return false;
+
+	uint8_t symKey[SYM_KEY_SIZE];
+	if (identity->keyType == X25519_KEY && peer.keyType == X25519_KEY) return symKeyFor(*identity, peer, symKey);
+	if (peer.keyType != RSA_KEY) {
+		std::cout << "Can not send a symmetric key to '" << to << "', it has no RSA key" << std::endl;
+		return false;
+	}
+
+	std::string content;
+	try {
+		AESWrapper aes;
+		aes.generateKey();
+		aes.getKey(symKey, sizeof(symKey));
+		ScopedTimer timer(m_stats, SEND_MESSAGE, PHASE_CRYPTO);
+		RSAPublicWrapper rsa;
+		rsa.loadPublicKey(peer.publicKey);
+		content = rsa.encrypteRSA(symKey, sizeof(symKey));
+	} catch (...) {
+		std::cout << "Invalid public key of '" << to << "'" << std::endl;
+		return false;
+	}
+
+	if (!sendMessage(*identity, peer.clientId, SEND_SYM_KEY, content, nullptr)) return false;
+	std::copy(symKey, symKey + SYM_KEY_SIZE, identity->symKeys[peer.clientId].begin());
+	return true;
+}
+
+
+bool ClientCore::sendText(Handle handle, const std::string& to, const std::string& text, uint32_t* messageID) {
+	if (text.empty()) return false;
+	return sendEncrypted(handle, to, TEXT_MESSAGE, reinterpret_cast<const uint8_t*>(text.data()), text.size(), messageID);
+}
+
+
+bool ClientCore::sendFile(Handle handle, const std::string& to, const std::string& content, uint32_t* messageID) {
+	if (content.empty()) return false;
+	return sendEncrypted(handle, to, FILE_MSG, reinterpret_cast<const uint8_t*>(content.data()), content.size(), messageID);
+}
+
+
+
+/**
+ * Messages are decrypted on the crypto workers in parallel, in the order the symmetric keys
+ * arrived: a key sent in the same batch applies to the messages after it.
+ */
+bool ClientCore::fetchMessages(Handle handle, std::vector<ReceivedMessage>& messages) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+	messages.clear();
+
+	std::vector<uint8_t> payload;
+	if (!fetchPayload(GET_UNREAD_MESSAGES, GET_UNREAD_MESSAGES_SUCCESS, identity->clientId, payload)) return false;
+
+	std::vector<ParsedMessage> parsed;
+	{
+		ScopedTimer timer(m_stats, GET_UNREAD_MESSAGES, PHASE_PARSE);
+		if (!PayloadParser::parseMessages(payload.data(), payload.size(), parsed)) {
+			std::cout << "Invalid messages payload" << std::endl;
+			return false;
+		}
+	}
+
+	ScopedTimer timer(m_stats, GET_UNREAD_MESSAGES, PHASE_CRYPTO);
+	messages.resize(parsed.size());
+	std::vector<std::future<bool>> decrypted(parsed.size());
+
+	for (size_t i = 0; i < parsed.size(); ++i) {
+		const UnpackMessage& header = parsed[i].header;
+		ReceivedMessage& message = messages[i];
+		message.from = header.clientId;
+		message.messageID = header.messageID;
+		message.msgType = header.msgType & MESSAGE_TYPE_MASK;
+		const bool compressed = (header.msgType & COMPRESSED_MESSAGE) != 0;
+
+		DirectoryEntry peer;
+		const bool known = findPeer(*identity, header.clientId, peer);
+		if (known) message.fromName = peer.name;
+
+		if (message.msgType == REQUEST_SYM_KEY) {
+			message.content.assign(reinterpret_cast<const char*>(parsed[i].content), header.msgSize);
+			message.decrypted = true;
+		} else if (message.msgType == SEND_SYM_KEY) {
+			try {
+				const std::string symKey = identity->rsa.decrypteRSA(parsed[i].content, header.msgSize);
+				if (symKey.size() == SYM_KEY_SIZE) {
+					std::copy(symKey.begin(), symKey.end(), identity->symKeys[header.clientId].begin());
+					message.decrypted = true;
+				}
+			} catch (...) {
+				/**/
+			}
+		} else if (message.msgType == TEXT_MESSAGE || message.msgType == FILE_MSG) {
+			std::array<uint8_t, SYM_KEY_SIZE> symKey;
+			const auto found = identity->symKeys.find(header.clientId);
+			if (found != identity->symKeys.end()) symKey = found->second;
+			else if (!known || !symKeyFor(*identity, peer, symKey.data())) continue;
+
+			const uint8_t* content = parsed[i].content;
+			const size_t size = header.msgSize;
+			decrypted[i] = m_workers->submit([symKey, content, size, compressed, &message]() {
+				try {
+					AESWrapper aes;
+					aes.loadKey(symKey.data(), symKey.size());
+					message.content = compressed ? aes.decryptInflated(content, size) : aes.decrypt(content, size);
+					return true;
+				} catch (...) {
+					return false;
+				}
+			});
+		}
+	}
+
+	for (size_t i = 0; i < decrypted.size(); ++i) {
+		if (decrypted[i].valid()) messages[i].decrypted = decrypted[i].get();
+	}
+	return true;
+}
+
+
+
+ClientCore::Identity* ClientCore::identity(Handle handle) const {
+	std::shared_lock<std::shared_mutex> lock(m_identitiesMutex);
+	return (handle < m_identities.size()) ? m_identities[handle] : nullptr;
+}
+
+
+/**
+ * The server leaves the requester out of its clients list, so local identities are added to the directory here.
+ */
+ClientCore::Handle ClientCore::addIdentity(Identity* identity) {
+	std::string publicKey = (identity->keyType == X25519_KEY) ? identity->ecdh.getPublicKey() : identity->rsa.getPublicKey();
+	publicKey.resize(PUBLIC_KEY_SIZE, '\0');
+	m_directory->setPublicKey(identity->clientId, identity->name, reinterpret_cast<const uint8_t*>(publicKey.data()), identity->keyType);
+
+	std::unique_lock<std::shared_mutex> lock(m_identitiesMutex);
+	m_identities.push_back(identity);
+	return m_identities.size() - 1;
+}
+
+
+
+/**
+ * Requests the clients list unless another identity did since the caller saw 'seen' refreshes,
+ * so a burst of lookups for a new user costs one request.
+ */
+bool ClientCore::refresh(Identity& identity, uint64_t seen) {
+	std::lock_guard<std::mutex> lock(m_refreshMutex);
+	if (m_refreshes != seen) return true;
+
+	std::vector<uint8_t> payload;
+	if (!fetchPayload(GET_CLIENTS_LIST, GET_CLIENTS_LIST_SUCCESS, identity.clientId, payload)) return false;
+
+	std::vector<UnpackClient> clients;
+	{
+		ScopedTimer timer(m_stats, GET_CLIENTS_LIST, PHASE_PARSE);
+		if (!PayloadParser::parseClients(payload.data(), payload.size(), clients)) {
+			std::cout << "Invalid clients list payload" << std::endl;
+			return false;
+		}
+	}
+	m_directory->update(clients);
+	++m_refreshes;
+	return true;
+}
+
+
+bool ClientCore::findPeer(Identity& identity, const std::string& name, DirectoryEntry& entry) {
+	const uint64_t seen = m_refreshes;
+	if (!m_directory->stale() && m_directory->find(name, entry)) return true;
+	if (refresh(identity, seen) && m_directory->find(name, entry)) return true;
+	if (m_directory->find(name, entry)) return true;	// a stale entry beats none when the server is down
+
+	std::cout << "No user by the name '" << name << "'" << std::endl;
+	return false;
+}
+
+
+bool ClientCore::findPeer(Identity& identity, const ClientID& clientId, DirectoryEntry& entry) {
+	const uint64_t seen = m_refreshes;
+	if (m_directory->find(clientId, entry)) return true;
+	return refresh(identity, seen) && m_directory->find(clientId, entry);
+}
+
+
+bool ClientCore::fetchPublicKey(Identity& identity, DirectoryEntry& peer) {
+	PublicKeyRequest req;
+	PublicKeyResponse resp;
+	req.header.clientId = identity.clientId;
+	memcpy(req.name, peer.name.c_str(), std::min(peer.name.size(), NAME_SIZE - 1));
+
+	if (!transact(reinterpret_cast<const uint8_t*>(&req), sizeof(req), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))
+		|| !isValidResponse(resp.header, ResponseCode::GET_PUBLIC_KEY_SUCCESS)) {
+		std::cout << "Failed to get the public key of '" << peer.name << "'" << std::endl;
+		return false;
+	}
+
+	m_directory->setPublicKey(resp.clientID, peer.name, resp.publicKey, resp.keyType);
+	return m_directory->find(resp.clientID, peer);
+}
+
+
+
+/**
+ * The symmetric key shared with 'peer': one that was exchanged, or one derived when both sides use X25519.
+ */
+bool ClientCore::symKeyFor(Identity& identity, DirectoryEntry& peer, uint8_t* symKey) {
+	const auto found = identity.symKeys.find(peer.clientId);
+	if (found != identity.symKeys.end()) {
+		std::copy(found->second.begin(), found->second.end(), symKey);
+		return true;
+	}
+
+	if (identity.keyType != X25519_KEY) return false;
+	if (!peer.hasPublicKey && !fetchPublicKey(identity, peer)) return false;
+	if (peer.keyType != X25519_KEY) return false;
+
+	ScopedTimer timer(m_stats, GET_PUBLIC_KEY, PHASE_CRYPTO);
+	if (!identity.ecdh.deriveSymKey(peer.publicKey, X25519_KEY_SIZE, symKey, SYM_KEY_SIZE)) return false;
+	std::copy(symKey, symKey + SYM_KEY_SIZE, identity.symKeys[peer.clientId].begin());
+	return true;
+}
+
+
+
+bool ClientCore::sendEncrypted(Handle handle, const std::string& to, MessageType msgType, const uint8_t* data, size_t size, uint32_t* messageID) {
+	Identity* identity = this->identity(handle);
+	if (identity == nullptr) return false;
+	std::lock_guard<std::mutex> lock(identity->mutex);
+
+	DirectoryEntry peer;
+	if (!findPeer(*identity, to, peer)) return false;
+	if (peer.clientId == identity->clientId) {
+		std::cout << "You can not send messages to yourself" << std::endl;
+		return false;
+	}
+
+	uint8_t symKey[SYM_KEY_SIZE];
+	if (!symKeyFor(*identity, peer, symKey)) {
+		std::cout << "No symmetric key with '" << to << "'" << std::endl;
+		return false;
+	}
+
+	std::string content;
+	uint8_t type = msgType;
+	{
+		ScopedTimer timer(m_stats, SEND_MESSAGE, PHASE_CRYPTO);
+		AESWrapper aes;
+		aes.loadKey(symKey, sizeof(symKey));
+		if (m_compress && Compression::worthwhile(data, size)) {
+			content = aes.encryptDeflated(data, size);
+			type |= COMPRESSED_MESSAGE;
+		} else {
+			content = aes.encrypt(data, size);
+		}
+	}
+	return sendMessage(*identity, peer.clientId, type, content, messageID);
+}
+
+
+bool ClientCore::sendMessage(Identity& identity, const ClientID& to, uint8_t msgType, const std::string& content, uint32_t* messageID) {
+	SendMessageRequest req;
+	req.header.clientId = identity.clientId;
+	req.clientId = to;
+	req.msgType = msgType;
+	req.contentSize = static_cast<uint32_t>(content.size());
+	req.msgContent = content.empty() ? nullptr : reinterpret_cast<uint8_t*>(const_cast<char*>(content.data()));
+	const std::vector<uint8_t> packet = req.pack();
+
+	MessageSentResponse resp;
+	if (!transact(packet.data(), packet.size(), reinterpret_cast<uint8_t*>(&resp), sizeof(resp))
+		|| !isValidResponse(resp.header, ResponseCode::MESSAGE_SENT_SUCCESS)) {
+		std::cout << "Failed to send a message from '" << identity.name << "'" << std::endl;
+		return false;
+	}
+
+	if (messageID != nullptr) *messageID = resp.msgID;
+	return true;
+}
+
+
+
+bool ClientCore::transact(const uint8_t* request, const size_t size, uint8_t* response, const size_t responseSize) {
+	if (m_mux != nullptr && m_mux->connect(m_policy.connectTimeout)) {
+		std::vector<uint8_t> buffer;
+		if (!multiplexed(request, size, buffer)) return false;
+		memset(response, 0, responseSize);
+		memcpy(response, buffer.data(), std::min(responseSize, buffer.size()));
+		return true;
+	}
+
+	auto socket = m_sockets->acquire();
+	return socket->socketWrapper(request, size, response, responseSize);
+}
+
+
+/**
+ * A request answered with a payload of any size, read on the same pooled handler.
+ */
+bool ClientCore::fetchPayload(RequestCode reqCode, ResponseCode respCode, const ClientID& clientId, std::vector<uint8_t>& payload) {
+	RequestHeader req(reqCode);
+	req.clientId = clientId;
+
+	if (m_mux != nullptr && m_mux->connect(m_policy.connectTimeout)) {
+		std::vector<uint8_t> response;
+		if (!multiplexed(reinterpret_cast<const uint8_t*>(&req), sizeof(req), response) || response.size() < sizeof(ResponseHeader)) {
+			std::cout << "Failed to send request " << reqCode << std::endl;
+			return false;
+		}
+		ResponseHeader header;
+		memcpy(&header, response.data(), sizeof(header));
+		if (!isValidResponse(header, respCode) || response.size() - sizeof(header) < header.payloadtSize) return false;
+		payload.assign(response.begin() + sizeof(header), response.begin() + sizeof(header) + header.payloadtSize);
+		return true;
+	}
+
+	uint8_t buffer[PACKET_SIZE];
+
+	auto socket = m_sockets->acquire();
+	if (!socket->socketWrapper(reinterpret_cast<const uint8_t*>(&req), sizeof(req), buffer, PACKET_SIZE, false)) {
+		std::cout << "Failed to send request " << reqCode << std::endl;
+		return false;
+	}
+
+	ResponseHeader header;
+	memcpy(&header, buffer, sizeof(header));
+	if (!isValidResponse(header, respCode)) {
+		socket->closeSocket();
+		return false;
+	}
+
+	payload.resize(header.payloadtSize);
+	size_t total = std::min<size_t>(PACKET_SIZE - sizeof(header), payload.size());
+	memcpy(payload.data(), buffer + sizeof(header), total);
+
+	while (total < payload.size()) {
+		const size_t toRead = std::min<size_t>(PACKET_SIZE, payload.size() - total);
+		if (!socket->read(buffer, toRead)) {
+			std::cout << "Failed to read the payload of request " << reqCode << std::endl;
+			socket->closeSocket();
+			return false;
+		}
+		memcpy(payload.data() + total, buffer, toRead);
+		total += toRead;
+	}
+
+	socket->closeSocket();
+	return true;
+}
+
+
+/**
+ * Sends a request on the shared connection. Large requests yield to control requests, and the
+ * deadline grows by the I/O timeout per frame, as the pool bounds every block of a transfer.
+ */
+bool ClientCore::multiplexed(const uint8_t* request, const size_t size, std::vector<uint8_t>& response) {
+	RequestHeader header(0);
+	memcpy(&header, request, std::min(size, sizeof(header)));
+	const Priority priority = Multiplexer::priorityOf(request, size);
+	const auto timeout = m_policy.deadline + m_policy.ioTimeout * (size / MAX_FRAME_SIZE);
+
+	ScopedTimer timer(m_stats, header.code, PHASE_TOTAL);
+	if (!m_mux->exchange(request, size, response, priority, timeout)) return false;
+	if (m_stats != nullptr) m_stats->addBytes(header.code, size, response.size());
+	return true;
+}
+
+
+void ClientCore::openMultiplexer(const std::string& address, const std::string& port) {
+	m_mux = new Multiplexer(address, port);
+	if (m_mux->connect(m_policy.connectTimeout)) return;
+
+	std::cout << "The server does not multiplex, using one connection per request" << std::endl;
+	delete m_mux;
+	m_mux = nullptr;
+}
+
+
+
+bool ClientCore::isValidResponse(const ResponseHeader& header, ResponseCode expectedCode) {
+	if (header.code != expectedCode) return false;
+
+	switch (expectedCode) {
+	case ResponseCode::REGISTER_SUCCESS:
+		return header.payloadtSize == sizeof(RegistrationResponse) - sizeof(header);
+	case ResponseCode::GET_PUBLIC_KEY_SUCCESS:
+		return header.payloadtSize == sizeof(PublicKeyResponse) - sizeof(header);
+	case ResponseCode::MESSAGE_SENT_SUCCESS:
+		return header.payloadtSize == sizeof(MessageSentResponse) - sizeof(header);
+	default:
+		return true;
+	}
+}
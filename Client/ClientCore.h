@@ -0,0 +1,129 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "Protocol.h"
+#include "SocketPool.h"
+#include "Multiplexer.h"
+#include "WorkerPool.h"
+#include "Directory.h"
+#include "KeyPool.h"
+#include "RSAHandler.h"
+#include "ECDHHandler.h"
+#include "AESHandler.h"
+#include "PayloadParser.h"
+#include "IdentityStore.h"
+#include "MessageStore.h"
+#include "Stats.h"
+
+
+
+constexpr auto SYM_KEY_REQUEST_TEXT = "Request for symmetric key";
+
+
+struct ClientCoreConfig {
+	size_t connections = 8;			// requests in flight at once, over all identities
+	size_t cryptoWorkers = std::max(1u, std::thread::hardware_concurrency());
+	size_t rsaKeys = 4;				// RSA keys generated ahead for registrations, 0 generates them on demand
+	std::chrono::seconds directoryTtl{ 30 };
+	std::string address;			// empty reads server.info
+	std::string port;
+	bool multiplex = false;			// one framed connection for all requests, if the server supports it
+	bool compress = false;			// deflate texts and files before encryption when it pays off
+};
+
+
+struct ReceivedMessage {
+	ClientID from;
+	std::string fromName;		// empty if the sender is not in the directory
+	uint32_t messageID;
+	uint8_t msgType;			// without the COMPRESSED_MESSAGE flag
+	std::string content;		// decrypted text or file content, the request text of REQUEST_SYM_KEY
+	bool decrypted;				// for SEND_SYM_KEY: the key was installed
+
+	ReceivedMessage() : messageID(0), msgType(NONE_MESSAGE), decrypted(false) {}
+};
+
+
+/**
+ * Client library hosting many identities in one process, without any prompts.
+ * The identities share a pool of socket handlers, a crypto worker pool, the RSA key pool and one
+ * directory of users and public keys. Calls on different identities run in parallel, calls on the
+ * same identity are serialized. Failures return false and print the reason, like ClientHandler.
+ */
+class ClientCore {
+public:
+	using Handle = size_t;
+
+	explicit ClientCore(const ClientCoreConfig& config = ClientCoreConfig());
+	virtual ~ClientCore();
+	ClientCore(const ClientCore& other) = delete;
+	ClientCore(ClientCore&& other) noexcept = delete;
+	ClientCore& operator=(const ClientCore& other) = delete;
+	ClientCore& operator=(ClientCore&& other) noexcept = delete;
+
+	bool useServer(const std::string&, const std::string&);
+	bool setRequestPolicy(const RequestPolicy&);
+	bool multiplexing() const { return m_mux != nullptr; }
+	Stats& stats() { return *m_stats; }
+
+	bool registerIdentity(const std::string&, KeyType, Handle&);
+	bool loadIdentity(const std::string&, Handle&);
+	bool saveIdentity(Handle, const std::string&);
+	size_t identities() const;
+	std::string name(Handle) const;
+
+	bool refreshDirectory(Handle);
+	bool lookup(Handle, const std::string&, DirectoryEntry&);
+	bool getPublicKey(Handle, const std::string&, DirectoryEntry&);
+	bool requestSymKey(Handle, const std::string&);
+	bool sendSymKey(Handle, const std::string&);
+	bool sendText(Handle, const std::string&, const std::string&, uint32_t* = nullptr);
+	bool sendFile(Handle, const std::string&, const std::string&, uint32_t* = nullptr);
+	bool fetchMessages(Handle, std::vector<ReceivedMessage>&);
+
+private:
+	struct Identity {
+		std::mutex mutex;
+		std::string name;
+		ClientID clientId;
+		uint8_t keyType = RSA_KEY;
+		RSAPrivateWrapper rsa;
+		ECDHWrapper ecdh;
+		std::unordered_map<ClientID, std::array<uint8_t, SYM_KEY_SIZE>, ClientIDHash> symKeys;
+	};
+
+	Identity* identity(Handle) const;
+	Handle addIdentity(Identity*);
+	bool refresh(Identity&, uint64_t);
+	bool findPeer(Identity&, const std::string&, DirectoryEntry&);
+	bool findPeer(Identity&, const ClientID&, DirectoryEntry&);
+	bool fetchPublicKey(Identity&, DirectoryEntry&);
+	bool symKeyFor(Identity&, DirectoryEntry&, uint8_t*);
+	bool sendEncrypted(Handle, const std::string&, MessageType, const uint8_t*, size_t, uint32_t*);
+	bool sendMessage(Identity&, const ClientID&, uint8_t, const std::string&, uint32_t*);
+	bool transact(const uint8_t*, const size_t, uint8_t*, const size_t);
+	bool multiplexed(const uint8_t*, const size_t, std::vector<uint8_t>&);
+	void openMultiplexer(const std::string&, const std::string&);
+	bool fetchPayload(RequestCode, ResponseCode, const ClientID&, std::vector<uint8_t>&);
+	static bool isValidResponse(const ResponseHeader&, ResponseCode);
+
+	Stats* m_stats;
+	SocketPool* m_sockets;
+	Multiplexer* m_mux;			// null when requests use the pool
+	RequestPolicy m_policy;
+	WorkerPool* m_workers;
+	KeyPool* m_keyPool;
+	Directory* m_directory;
+	const bool m_compress;
+	std::vector<Identity*> m_identities;
+	mutable std::shared_mutex m_identitiesMutex;
+	std::mutex m_refreshMutex;		// one clients list request at a time
+	std::atomic<uint64_t> m_refreshes;	// completed clients list requests
+};
@@ -12,6 +12,10 @@ void ClientUI::displayMainMenu() {
         "50) Send a text message\n\t"
         "51) Send a request for symmetric key\n\t"
         "52) Send your symmetric key\n\t"
+        "53) Send a file\n\t"
+        "60) Show message history\n\t"
+        "61) Search message history\n\t"
+        "70) Show request statistics\n\t"
         "0) Exit client\n"
         "Please select one of the options above: " 
     << std::endl;
@@ -26,9 +30,20 @@ ClientUI::MenuOption ClientUI::display(bool clear) {
 
     displayMainMenu();
 
+    // the whole line is read, a number left with its newline in std::cin would answer the next prompt
+    std::string line;
+    if (!std::getline(std::cin, line)) return ClientUI::MenuOption::EXIT;
+    boost::algorithm::trim(line);
+
     int choice;
     MenuOption option;
-    std::cin >> choice;
+    try {
+        size_t end = 0;
+        choice = std::stoi(line, &end);
+        if (end != line.size()) return ClientUI::MenuOption::NONE_OPTION;
+    } catch (...) {
+        return ClientUI::MenuOption::NONE_OPTION;
+    }
     bool validOption = isValidOption(choice, option);
     if (!validOption) return ClientUI::MenuOption::NONE_OPTION;
     return option;
@@ -53,7 +68,7 @@ const std::string ClientUI::getCleanInput(const std::string& prompt) {
     std::cout << prompt;
 
     do {
-        std::getline(std::cin, input);
+        if (!std::getline(std::cin, input)) break;	// end of input
         boost::algorithm::trim(input);
      
     } while (input.empty());
@@ -19,6 +19,9 @@ public:
 		REQ_SYM_KEY = 51,
 		SEND_SYM_KEY = 52,
 		SEND_FILE = 53,
+		MESSAGE_HISTORY = 60,
+		SEARCH_MESSAGES = 61,
+		SHOW_STATS = 70,
 		EXIT = 0,
 		NONE_OPTION = -1
 	};
@@ -43,6 +46,9 @@ private:
 		MenuOption::REQ_SYM_KEY,
 		MenuOption::SEND_SYM_KEY,
 		MenuOption::SEND_FILE,
+		MenuOption::MESSAGE_HISTORY,
+		MenuOption::SEARCH_MESSAGES,
+		MenuOption::SHOW_STATS,
 		MenuOption::EXIT
 	};
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "Compression.h"
+#include <algorithm>
+
+
+
+/**
+ * Deflates a sample from the start of the content, already compressed data such as archives
+ * and images is caught before the whole content goes through deflate.
+ */
+bool Compression::worthwhile(const uint8_t* data, size_t size) {
+	if (data == nullptr || size < MIN_COMPRESSION_SIZE) return false;
+
+	const size_t sampleSize = std::min(size, COMPRESSION_SAMPLE_SIZE);
+	try {
+		return deflate(data, sampleSize).size() <= sampleSize * MAX_COMPRESSION_RATIO;
+	} catch (...) {
+		return false;
+	}
+}
+
+
+
+std::string Compression::deflate(const uint8_t* data, size_t size) {
+	std::string compressed;
+	CryptoPP::Deflator deflator(new CryptoPP::StringSink(compressed), COMPRESSION_LEVEL);
+	deflator.Put(data, size);
+	deflator.MessageEnd();
+	return compressed;
+}
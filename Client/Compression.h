@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <zdeflate.h>
+#include <zinflate.h>
+#include <filters.h>
+
+
+
+constexpr unsigned int COMPRESSION_LEVEL = 1;		// deflate level, the fastest
+constexpr size_t MIN_COMPRESSION_SIZE = 128;		// smaller contents gain less than the deflate overhead
+constexpr size_t COMPRESSION_SAMPLE_SIZE = 8 * 1024;
+constexpr double MAX_COMPRESSION_RATIO = 0.9;		// contents whose sample shrinks less are sent as they are
+constexpr size_t COMPRESSION_CHUNK_SIZE = 64 * 1024;	// fed through the deflate and cipher pipeline at a time
+
+
+/**
+ * Deflate for message contents, applied before encryption: ciphertext does not compress.
+ */
+class Compression {
+public:
+	static bool worthwhile(const uint8_t*, size_t);
+	static std::string deflate(const uint8_t*, size_t);
+};
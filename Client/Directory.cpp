@@ -0,0 +1,68 @@
+#include "Directory.h"
+#include <mutex>
+
+
+
+void Directory::update(const std::vector<UnpackClient>& clients) {
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	for (const auto& client : clients) {
+		entry(client.clientId, std::string(reinterpret_cast<const char*>(client.name), strnlen(reinterpret_cast<const char*>(client.name), NAME_SIZE)));
+	}
+	m_updated = std::chrono::steady_clock::now();
+	m_hasUpdate = true;
+}
+
+
+void Directory::setPublicKey(const ClientID& clientId, const std::string& name, const uint8_t* publicKey, uint8_t keyType) {
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	DirectoryEntry& found = entry(clientId, name);
+	memcpy(found.publicKey, publicKey, PUBLIC_KEY_SIZE);
+	found.keyType = keyType;
+	found.hasPublicKey = true;
+}
+
+
+
+bool Directory::find(const std::string& name, DirectoryEntry& out) const {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	const auto id = m_byName.find(name);
+	if (id == m_byName.end()) return false;
+	out = m_byId.at(id->second);
+	return true;
+}
+
+
+bool Directory::find(const ClientID& clientId, DirectoryEntry& out) const {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	const auto found = m_byId.find(clientId);
+	if (found == m_byId.end()) return false;
+	out = found->second;
+	return true;
+}
+
+
+
+bool Directory::stale() const {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return !m_hasUpdate || std::chrono::steady_clock::now() - m_updated >= m_ttl;
+}
+
+
+size_t Directory::size() const {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return m_byId.size();
+}
+
+
+
+// The entry of a user, added if new. The caller holds the lock exclusively.
+DirectoryEntry& Directory::entry(const ClientID& clientId, const std::string& name) {
+	DirectoryEntry& found = m_byId[clientId];
+	found.clientId = clientId;
+	if (found.name != name) {
+		if (!found.name.empty()) m_byName.erase(found.name);
+		found.name = name;
+		m_byName[name] = clientId;
+	}
+	return found;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <chrono>
+#include "Protocol.h"
+#include "MessageStore.h"
+
+
+
+constexpr auto DIRECTORY_TTL = std::chrono::seconds(30);
+
+
+struct DirectoryEntry {
+	ClientID clientId;
+	std::string name;
+	uint8_t keyType;
+	uint8_t publicKey[PUBLIC_KEY_SIZE];
+	bool hasPublicKey;
+
+	DirectoryEntry() : keyType(RSA_KEY), publicKey{ 0 }, hasPublicKey(false) {}
+};
+
+
+/**
+ * The server's users and their public keys, shared by all identities of a process.
+ * Users are never removed from the server, so every clients list is merged in and the
+ * public keys fetched by one identity serve all the others.
+ */
+class Directory {
+public:
+	explicit Directory(std::chrono::steady_clock::duration ttl = DIRECTORY_TTL) : m_ttl(ttl), m_updated(), m_hasUpdate(false) {}
+	virtual ~Directory() = default;
+	Directory(const Directory& other) = delete;
+	Directory(Directory&& other) noexcept = delete;
+	Directory& operator=(const Directory& other) = delete;
+	Directory& operator=(Directory&& other) noexcept = delete;
+
+	void update(const std::vector<UnpackClient>&);
+	void setPublicKey(const ClientID&, const std::string&, const uint8_t*, uint8_t);
+	bool find(const std::string&, DirectoryEntry&) const;
+	bool find(const ClientID&, DirectoryEntry&) const;
+	bool stale() const;
+	size_t size() const;
+
+private:
+	DirectoryEntry& entry(const ClientID&, const std::string&);
+
+	const std::chrono::steady_clock::duration m_ttl;
+	mutable std::shared_mutex m_mutex;
+	std::unordered_map<ClientID, DirectoryEntry, ClientIDHash> m_byId;
+	std::unordered_map<std::string, ClientID> m_byName;
+	std::chrono::steady_clock::time_point m_updated;
+	bool m_hasUpdate;
+};
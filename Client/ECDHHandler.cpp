@@ -0,0 +1,48 @@
+#include "ECDHHandler.h"
+#include <stdexcept>
+
+
+
+void ECDHWrapper::generateKeyPair() {
+	m_ecdh.GenerateKeyPair(m_rng, m_privateKey, m_publicKey);
+}
+
+
+void ECDHWrapper::loadPrivateKey(const std::string& key) {
+	if (key.size() != X25519_KEY_SIZE) {
+		throw std::length_error("X25519 private key must be 32 bytes");
+	}
+
+	memcpy(m_privateKey, key.c_str(), X25519_KEY_SIZE);
+	m_ecdh.GeneratePublicKey(m_rng, m_privateKey, m_publicKey);
+}
+
+
+const std::string ECDHWrapper::getPrivateKey() {
+	return std::string(reinterpret_cast<const char*>(m_privateKey), sizeof(m_privateKey));
+}
+
+
+const std::string ECDHWrapper::getPublicKey() {
+	return std::string(reinterpret_cast<const char*>(m_publicKey), sizeof(m_publicKey));
+}
+
+
+
+/**
+ * Agree on a shared secret with the peer's public key and expand it into a symmetric key.
+ * Both sides derive the same key, so no key has to be sent over the wire.
+ */
+bool ECDHWrapper::deriveSymKey(const uint8_t* peerKey, const size_t peerKeySize, uint8_t* outKey, const size_t outSize) {
+	if (peerKey == nullptr || peerKeySize < X25519_KEY_SIZE || outKey == nullptr || outSize == 0) return false;
+
+	uint8_t shared[X25519_KEY_SIZE] = { 0 };
+	if (!m_ecdh.Agree(shared, m_privateKey, peerKey)) return false;
+
+	const std::string info = SYM_KEY_INFO;
+	CryptoPP::HKDF<CryptoPP::SHA256> hkdf;
+	hkdf.DeriveKey(outKey, outSize, shared, sizeof(shared), nullptr, 0, reinterpret_cast<const uint8_t*>(info.c_str()), info.size());
+
+	memset(shared, 0, sizeof(shared));
+	return true;
+}
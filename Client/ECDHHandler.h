@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include "xed25519.h"
+#include "hkdf.h"
+#include "sha.h"
+#include "osrng.h"
+#include "Protocol.h"
+
+
+
+// Binds derived keys to this protocol, both peers must use the same value.
+constexpr auto SYM_KEY_INFO = "MessageU X25519 symmetric key";
+
+
+class ECDHWrapper {
+public:
+	ECDHWrapper() : m_privateKey{ 0 }, m_publicKey{ 0 } {}
+	virtual ~ECDHWrapper() = default;
+	ECDHWrapper(const ECDHWrapper& other) = delete;
+	ECDHWrapper(ECDHWrapper&& other) noexcept = delete;
+	ECDHWrapper& operator=(const ECDHWrapper& other) = delete;
+	ECDHWrapper& operator=(ECDHWrapper&& other) noexcept = delete;
+
+	void generateKeyPair();
+	void loadPrivateKey(const std::string&);
+	const std::string getPrivateKey();
+	const std::string getPublicKey();
+	bool deriveSymKey(const uint8_t*, const size_t, uint8_t*, const size_t);
+
+private:
+	CryptoPP::AutoSeededRandomPool m_rng;
+	CryptoPP::x25519 m_ecdh;
+	uint8_t m_privateKey[X25519_KEY_SIZE];
+	uint8_t m_publicKey[X25519_KEY_SIZE];
+};
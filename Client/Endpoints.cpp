@@ -0,0 +1,118 @@
+#include "Endpoints.h"
+#include <algorithm>
+
+
+
+void EndpointSelector::clear() {
+	m_endpoints.clear();
+	m_lastProbe = std::chrono::steady_clock::time_point();
+}
+
+
+void EndpointSelector::add(const std::string& address, const std::string& port) {
+	Endpoint endpoint;
+	endpoint.address = address;
+	endpoint.port = port;
+	m_endpoints.push_back(endpoint);
+}
+
+
+
+/**
+ * The endpoint for a request of 'clientId', 'exclude' is avoided when there is another choice
+ * (the endpoint that just failed). Returns NONE only when there are no endpoints.
+ */
+size_t EndpointSelector::select(const ClientID& clientId, size_t exclude) {
+	if (m_endpoints.empty()) return NONE;
+	if (m_sharded && clientId != ClientID()) return shardOf(clientId, m_endpoints.size());
+
+	const auto now = std::chrono::steady_clock::now();
+	size_t best = NONE;
+	size_t soonest = NONE;	// when all are down, the one that comes back first
+	for (size_t n = 0; n < m_endpoints.size(); ++n) {
+		const size_t i = m_sharded ? (m_nextShard + n) % m_endpoints.size() : n;
+		const Endpoint& endpoint = m_endpoints[i];
+		if (i == exclude && m_endpoints.size() > 1) continue;
+		if (soonest == NONE || endpoint.downUntil < m_endpoints[soonest].downUntil) soonest = i;
+		if (!endpoint.healthy(now)) continue;
+		if (m_sharded) {
+			best = i;
+			break;
+		}
+		// an endpoint that just failed only wins over the others when they failed as often
+		if (best == NONE || endpoint.failures < m_endpoints[best].failures
+			|| (endpoint.failures == m_endpoints[best].failures && endpoint.rank() < m_endpoints[best].rank())) best = i;
+	}
+
+	const size_t selected = (best != NONE) ? best : soonest;
+	if (m_sharded) m_nextShard = selected + 1;
+	return selected;
+}
+
+
+
+// 'responseTime' of zero means the request didn't measure one.
+void EndpointSelector::success(size_t i, uint64_t responseTime) {
+	if (i >= m_endpoints.size()) return;
+	Endpoint& endpoint = m_endpoints[i];
+	endpoint.failures = 0;
+	endpoint.reachable = true;
+	endpoint.downUntil = std::chrono::steady_clock::time_point();
+	if (responseTime == 0) return;
+	endpoint.rtt = (endpoint.rtt == 0) ? responseTime : endpoint.rtt + ENDPOINT_RTT_WEIGHT * (static_cast<double>(responseTime) - endpoint.rtt);
+}
+
+
+void EndpointSelector::failure(size_t i) {
+	if (i >= m_endpoints.size()) return;
+	Endpoint& endpoint = m_endpoints[i];
+	endpoint.reachable = false;
+	if (++endpoint.failures < ENDPOINT_FAILURES_DOWN) return;
+
+	const size_t doublings = std::min<size_t>(endpoint.failures - ENDPOINT_FAILURES_DOWN, 5);
+	const auto cooldown = std::min<std::chrono::steady_clock::duration>(ENDPOINT_COOLDOWN * (1 << doublings), ENDPOINT_MAX_COOLDOWN);
+	endpoint.downUntil = std::chrono::steady_clock::now() + cooldown;
+}
+
+
+bool EndpointSelector::probeDue() const {
+	return m_endpoints.size() > 1 && std::chrono::steady_clock::now() - m_lastProbe >= ENDPOINT_PROBE_INTERVAL;
+}
+
+
+
+/**
+ * Which endpoints accepted a connection in a probe. A connect doesn't show that the server answers
+ * requests, so it neither ends a cooldown nor counts as a response time. It only makes a healthy
+ * endpoint that lost the traffic to a faster one forget its response time, the next request measures it again.
+ */
+void EndpointSelector::probed(const std::vector<bool>& reachable) {
+	if (reachable.size() != m_endpoints.size()) return;
+	const auto now = std::chrono::steady_clock::now();
+	double fastest = 0;
+	for (const Endpoint& endpoint : m_endpoints) {
+		if (endpoint.healthy(now) && endpoint.rtt > 0 && (fastest == 0 || endpoint.rtt < fastest)) fastest = endpoint.rtt;
+	}
+
+	for (size_t i = 0; i < m_endpoints.size(); ++i) {
+		if (!reachable[i]) {
+			failure(i);
+			continue;
+		}
+		Endpoint& endpoint = m_endpoints[i];
+		endpoint.reachable = true;
+		if (endpoint.healthy(now) && endpoint.rtt > fastest) endpoint.rtt = 0;
+	}
+}
+
+
+
+/**
+ * Must match the server: the first 4 bytes of the ID as a little endian number, modulo the shard count.
+ */
+size_t EndpointSelector::shardOf(const ClientID& clientId, size_t shards) {
+	if (shards == 0) return 0;
+	const uint32_t key = static_cast<uint32_t>(clientId.id[0]) | (static_cast<uint32_t>(clientId.id[1]) << 8)
+		| (static_cast<uint32_t>(clientId.id[2]) << 16) | (static_cast<uint32_t>(clientId.id[3]) << 24);
+	return key % shards;
+}
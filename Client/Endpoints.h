@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include "Protocol.h"
+
+
+
+constexpr auto SHARD_MODE_LINE = "mode=shard";
+constexpr size_t ENDPOINT_FAILURES_DOWN = 2;		// consecutive failures before an endpoint is taken out
+constexpr auto ENDPOINT_COOLDOWN = std::chrono::seconds(2);		// doubled by every further failure
+constexpr auto ENDPOINT_MAX_COOLDOWN = std::chrono::seconds(60);
+constexpr auto ENDPOINT_PROBE_INTERVAL = std::chrono::seconds(30);
+constexpr double ENDPOINT_RTT_WEIGHT = 0.2;		// of a new sample in the smoothed response time
+
+
+struct Endpoint {
+	std::string address;
+	std::string port;
+	double rtt = 0;			// smoothed time to the first response block in nanoseconds, 0 until measured (again)
+	bool reachable = false;	// answered a request or accepted a probe connection since its last failure
+	size_t failures = 0;	// in a row
+	std::chrono::steady_clock::time_point downUntil;
+
+	bool healthy(std::chrono::steady_clock::time_point now) const { return now >= downUntil; }
+	// lower is preferred: an unmeasured endpoint is tried first once it is known to be reachable, else last
+	double rank() const { return (rtt > 0) ? rtt : (reachable ? 0 : std::numeric_limits<double>::max()); }
+};
+
+
+/**
+ * The server instances listed in server.info.
+ * Normally a request goes to the healthy endpoint with the lowest smoothed response time. In shard
+ * mode every instance owns the clients whose ID hashes to its index, so a client's requests always
+ * go to its owner and registrations (no ID yet) take turns over the healthy instances.
+ */
+class EndpointSelector {
+public:
+	static constexpr size_t NONE = static_cast<size_t>(-1);
+
+	EndpointSelector() : m_sharded(false), m_nextShard(0) {}
+	virtual ~EndpointSelector() = default;
+	EndpointSelector(const EndpointSelector& other) = delete;
+	EndpointSelector(EndpointSelector&& other) noexcept = delete;
+	EndpointSelector& operator=(const EndpointSelector& other) = delete;
+	EndpointSelector& operator=(EndpointSelector&& other) noexcept = delete;
+
+	void clear();
+	void add(const std::string&, const std::string&);
+	void setSharded(bool sharded) { m_sharded = sharded; }
+	bool sharded() const { return m_sharded; }
+	size_t size() const { return m_endpoints.size(); }
+	const Endpoint& operator[](size_t i) const { return m_endpoints[i]; }
+
+	size_t select(const ClientID&, size_t = NONE);
+	void success(size_t, uint64_t);
+	void failure(size_t);
+	bool probeDue() const;
+	void probeStarted() { m_lastProbe = std::chrono::steady_clock::now(); }
+	void probed(const std::vector<bool>&);
+
+	static size_t shardOf(const ClientID&, size_t);
+
+private:
+	std::vector<Endpoint> m_endpoints;
+	bool m_sharded;
+	size_t m_nextShard;		// of the next registration
+	std::chrono::steady_clock::time_point m_lastProbe;
+};
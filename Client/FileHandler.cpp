@@ -20,20 +20,20 @@ bool FileHandler::openFile(const std::string& filePath, bool write) {
 
 bool FileHandler::write(const std::string& filePath, const std::string& data) {
 	if (data.empty()) return false;
-	if (!openFile(filePath, true)) return false;
 
-	std::string newline = data;
-	newline.append("\n");		// make sure to null terminate
 	bool success = true;
 
 	try {
-		m_fs->write(newline.c_str(), newline.size());
+		std::ofstream out(filePath, std::ios::binary | std::ios::app);
+		if (!out.is_open()) return false;
+		out.write(data.c_str(), data.size());
+		out.put('\n');
+		success = static_cast<bool>(out);
 	}
 	catch (...) {
 		success = false;
 	}
 
-	closeFS();
 	return success;
 }
 
@@ -57,6 +57,67 @@ bool FileHandler::readLine(const std::string& filePath, std::string& outBuffer,
 
 
 
+/**
+ * Read the whole file through a memory mapping, one copy and no read loop.
+ */
+bool FileHandler::readFile(const std::string& filePath, std::string& outBuffer) {
+	MappedFile file;
+	if (!file.open(filePath)) return false;
+
+	try {
+		outBuffer.assign(reinterpret_cast<const char*>(file.data()), file.size());
+	} catch (...) {
+		return false;
+	}
+	return true;
+}
+
+
+
+bool FileHandler::writeFile(const std::string& filePath, const uint8_t* data, const size_t size) {
+	BufferedWriter writer;
+	if (!writer.open(filePath)) return false;
+	if (!writer.write(data, size)) return false;
+	return writer.close();
+}
+
+
+
+// Push the file's written data through the OS cache to the disk.
+static bool syncFile(std::FILE* file) {
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;		// FlushFileBuffers
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+
+
+/**
+ * Write the data to a temporary file and rename it over the target,
+ * readers see either the old or the new content, never a partial file.
+ * The temporary file is on disk before the rename, so a crash can not leave the target empty or truncated.
+ */
+bool FileHandler::replaceFile(const std::string& filePath, const std::string& data) {
+	const std::string tempPath = filePath + ".tmp";
+	std::error_code ec;
+
+	std::FILE* file = std::fopen(tempPath.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size() && std::fflush(file) == 0 && syncFile(file);
+	written = std::fclose(file) == 0 && written;
+
+	if (written) std::filesystem::rename(tempPath, filePath, ec);
+	if (!written || ec) {
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
+
+
+
 bool FileHandler::fileExists(const std::string& filePath) {
 	return std::filesystem::exists(filePath);
 }
@@ -74,4 +135,110 @@ void FileHandler::closeFS() {
 	delete m_fs;
 	m_fs = nullptr;
 	m_isOpen = false;
-}
\ No newline at end of file
+}
+
+
+
+bool MappedFile::open(const std::string& filePath) {
+	close();
+
+	try {
+		const auto size = std::filesystem::file_size(filePath);
+		if (size == 0) return true;	// empty files can not be mapped
+
+		m_mapping = boost::interprocess::file_mapping(filePath.c_str(), boost::interprocess::read_only);
+		m_region = boost::interprocess::mapped_region(m_mapping, boost::interprocess::read_only);
+		m_data = static_cast<const uint8_t*>(m_region.get_address());
+		m_size = m_region.get_size();
+	} catch (...) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+
+void MappedFile::close() {
+	m_region = boost::interprocess::mapped_region();
+	m_mapping = boost::interprocess::file_mapping();
+	m_data = nullptr;
+	m_size = 0;
+}
+
+
+
+BufferedWriter::BufferedWriter(const size_t bufferSize) : m_buffer(nullptr), m_capacity(bufferSize), m_used(0) {
+	m_buffer = static_cast<uint8_t*>(::operator new(m_capacity, std::align_val_t(WRITE_BUFFER_ALIGNMENT)));
+}
+
+
+BufferedWriter::~BufferedWriter() {
+	close();
+	::operator delete(m_buffer, std::align_val_t(WRITE_BUFFER_ALIGNMENT));
+}
+
+
+bool BufferedWriter::open(const std::string& filePath, bool append) {
+	close();
+
+	try {
+		// our own buffer replaces the stream buffer
+		m_out.rdbuf()->pubsetbuf(nullptr, 0);
+		m_out.open(filePath, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+	} catch (...) {
+		return false;
+	}
+	return m_out.is_open();
+}
+
+
+
+bool BufferedWriter::write(const uint8_t* data, size_t size) {
+	if (!m_out.is_open() || (data == nullptr && size > 0)) return false;
+
+	while (size > 0) {
+		// large writes skip the copy once the buffer is empty
+		if (m_used == 0 && size >= m_capacity) {
+			const size_t blocks = size - (size % m_capacity);
+			m_out.write(reinterpret_cast<const char*>(data), blocks);
+			if (!m_out) return false;
+			data += blocks;
+			size -= blocks;
+			continue;
+		}
+
+		const size_t toCopy = std::min(size, m_capacity - m_used);
+		memcpy(m_buffer + m_used, data, toCopy);
+		m_used += toCopy;
+		data += toCopy;
+		size -= toCopy;
+
+		if (m_used == m_capacity && !flush()) return false;
+	}
+	return true;
+}
+
+
+bool BufferedWriter::flush() {
+	if (!m_out.is_open()) return false;
+
+	if (m_used > 0) {
+		m_out.write(reinterpret_cast<const char*>(m_buffer), m_used);
+		m_used = 0;
+	}
+	m_out.flush();
+	return static_cast<bool>(m_out);
+}
+
+
+bool BufferedWriter::close() {
+	if (!m_out.is_open()) return true;
+
+	const bool success = flush();
+	try {
+		m_out.close();
+	} catch (...) {
+		return false;
+	}
+	return success;
+}
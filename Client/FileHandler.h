@@ -3,6 +3,72 @@
 #include <fstream>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <cstdio>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+
+
+constexpr size_t WRITE_BUFFER_SIZE = 1 << 20;	// 1 MiB
+constexpr size_t WRITE_BUFFER_ALIGNMENT = 4096;
+
+
+/**
+ * Read only memory mapping of a whole file.
+ */
+class MappedFile {
+public:
+	MappedFile() : m_data(nullptr), m_size(0) {}
+	virtual ~MappedFile() = default;
+	MappedFile(const MappedFile& other) = delete;
+	MappedFile(MappedFile&& other) noexcept = delete;
+	MappedFile& operator=(const MappedFile& other) = delete;
+	MappedFile& operator=(MappedFile&& other) noexcept = delete;
+
+	bool open(const std::string&);
+	void close();
+	const uint8_t* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	boost::interprocess::file_mapping m_mapping;
+	boost::interprocess::mapped_region m_region;
+	const uint8_t* m_data;
+	size_t m_size;
+};
+
+
+/**
+ * Collects writes in a large aligned buffer and hands them to the OS in whole blocks.
+ */
+class BufferedWriter {
+public:
+	explicit BufferedWriter(const size_t bufferSize = WRITE_BUFFER_SIZE);
+	virtual ~BufferedWriter();
+	BufferedWriter(const BufferedWriter& other) = delete;
+	BufferedWriter(BufferedWriter&& other) noexcept = delete;
+	BufferedWriter& operator=(const BufferedWriter& other) = delete;
+	BufferedWriter& operator=(BufferedWriter&& other) noexcept = delete;
+
+	bool open(const std::string&, bool=false);
+	bool write(const uint8_t*, size_t);
+	bool flush();
+	bool close();
+
+private:
+	std::ofstream m_out;
+	uint8_t* m_buffer;
+	const size_t m_capacity;
+	size_t m_used;
+};
 
 
 
@@ -11,6 +77,9 @@ public:
 	FileHandler() : m_fs(nullptr), m_isOpen(false) {}
 	bool write(const std::string&, const std::string&);
 	bool readLine(const std::string&, std::string&, bool=false);
+	bool readFile(const std::string&, std::string&);
+	bool writeFile(const std::string&, const uint8_t*, const size_t);
+	bool replaceFile(const std::string&, const std::string&);
 	bool fileExists(const std::string&);
 	void closeFS();
 private:
@@ -18,5 +87,3 @@ private:
 	std::fstream* m_fs;
 	bool m_isOpen;
 };
-
-
@@ -0,0 +1,135 @@
+#include "IdentityStore.h"
+
+
+
+namespace {
+	template <typename T>
+	void append(std::string& out, const T& value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	void appendBytes(std::string& out, const void* data, const size_t size) {
+		out.append(reinterpret_cast<const char*>(data), size);
+	}
+
+	// Bounds checked cursor over the snapshot buffer.
+	struct Reader {
+		const uint8_t* ptr;
+		size_t left;
+
+		bool take(void* out, const size_t size) {
+			if (size > left) return false;
+			memcpy(out, ptr, size);
+			ptr += size;
+			left -= size;
+			return true;
+		}
+
+		template <typename T>
+		bool take(T& value) { return take(&value, sizeof(value)); }
+
+		bool takeString(std::string& out, const size_t size) {
+			if (size > left) return false;
+			out.assign(reinterpret_cast<const char*>(ptr), size);
+			ptr += size;
+			left -= size;
+			return true;
+		}
+	};
+}
+
+
+
+bool IdentityStore::save(FileHandler& fileHandler, const std::string& path, const IdentitySnapshot& snapshot) {
+	return fileHandler.replaceFile(path, serialize(snapshot));
+}
+
+
+bool IdentityStore::load(const std::string& path, IdentitySnapshot& snapshot) {
+	MappedFile file;
+	if (!file.open(path)) return false;
+	return deserialize(file.data(), file.size(), snapshot);
+}
+
+
+
+std::string IdentityStore::serialize(const IdentitySnapshot& snapshot) {
+	std::string out;
+	out.reserve(64 + snapshot.name.size() + snapshot.privateKey.size() + snapshot.peers.size() * sizeof(PeerRecord));
+
+	append(out, SNAPSHOT_MAGIC);
+	append(out, SNAPSHOT_VERSION);
+	append(out, snapshot.keyType);
+	append(out, static_cast<uint16_t>(snapshot.name.size()));
+	appendBytes(out, snapshot.name.data(), snapshot.name.size());
+	appendBytes(out, snapshot.clientId.id, CLIENT_ID_SIZE);
+	append(out, static_cast<uint32_t>(snapshot.privateKey.size()));
+	appendBytes(out, snapshot.privateKey.data(), snapshot.privateKey.size());
+
+	append(out, static_cast<uint32_t>(snapshot.peers.size()));
+	for (const auto& peer : snapshot.peers) {
+		appendBytes(out, peer.clientId.id, CLIENT_ID_SIZE);
+		append(out, peer.keyType);
+		append(out, static_cast<uint16_t>(peer.name.size()));
+		appendBytes(out, peer.name.data(), peer.name.size());
+		appendBytes(out, peer.publicKey, PUBLIC_KEY_SIZE);
+		appendBytes(out, peer.symKey, SYM_KEY_SIZE);
+	}
+
+	append(out, checksum(reinterpret_cast<const uint8_t*>(out.data()), out.size()));
+	return out;
+}
+
+
+
+bool IdentityStore::deserialize(const uint8_t* buffer, const size_t size, IdentitySnapshot& snapshot) {
+	if (buffer == nullptr || size < sizeof(uint32_t)) return false;
+
+	const size_t bodySize = size - sizeof(uint32_t);
+	uint32_t expected = 0;
+	memcpy(&expected, buffer + bodySize, sizeof(expected));
+	if (checksum(buffer, bodySize) != expected) return false;
+
+	Reader reader{ buffer, bodySize };
+	uint32_t magic = 0;
+	uint16_t version = 0;
+	uint16_t nameSize = 0;
+	uint32_t keySize = 0;
+	uint32_t peerCount = 0;
+
+	if (!reader.take(magic) || magic != SNAPSHOT_MAGIC) return false;
+	if (!reader.take(version) || version != SNAPSHOT_VERSION) return false;
+	if (!reader.take(snapshot.keyType)) return false;
+	if (!reader.take(nameSize) || !reader.takeString(snapshot.name, nameSize)) return false;
+	if (!reader.take(snapshot.clientId.id, CLIENT_ID_SIZE)) return false;
+	if (!reader.take(keySize) || !reader.takeString(snapshot.privateKey, keySize)) return false;
+	if (!reader.take(peerCount)) return false;
+
+	snapshot.peers.clear();
+	snapshot.peers.reserve(std::min<size_t>(peerCount, reader.left / (CLIENT_ID_SIZE + PUBLIC_KEY_SIZE)));
+	for (uint32_t i = 0; i < peerCount; ++i) {
+		PeerRecord peer;
+		if (!reader.take(peer.clientId.id, CLIENT_ID_SIZE)) return false;
+		if (!reader.take(peer.keyType)) return false;
+		if (!reader.take(nameSize) || !reader.takeString(peer.name, nameSize)) return false;
+		if (!reader.take(peer.publicKey, PUBLIC_KEY_SIZE)) return false;
+		if (!reader.take(peer.symKey, SYM_KEY_SIZE)) return false;
+		snapshot.peers.push_back(std::move(peer));
+	}
+
+	return reader.left == 0;
+}
+
+
+
+/**
+ * FNV-1a, only used to detect truncated or corrupted snapshots.
+ */
+uint32_t IdentityStore::checksum(const uint8_t* data, const size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
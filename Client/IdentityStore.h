@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "Protocol.h"
+#include "FileHandler.h"
+
+
+
+constexpr auto CLIENT_SNAPSHOT_PATH = "me.bin";
+constexpr uint32_t SNAPSHOT_MAGIC = 0x4449554D;	// "MUID"
+constexpr uint16_t SNAPSHOT_VERSION = 1;
+
+
+struct PeerRecord {
+	ClientID clientId;
+	std::string name;
+	uint8_t keyType;
+	uint8_t publicKey[PUBLIC_KEY_SIZE];
+	uint8_t symKey[SYM_KEY_SIZE];
+
+	PeerRecord() : keyType(RSA_KEY), publicKey{ 0 }, symKey{ 0 } {}
+};
+
+
+struct IdentitySnapshot {
+	std::string name;
+	ClientID clientId;
+	uint8_t keyType;
+	std::string privateKey;
+	std::vector<PeerRecord> peers;
+
+	IdentitySnapshot() : keyType(RSA_KEY) {}
+};
+
+
+/**
+ * Versioned binary snapshot of the client identity and its cached peers.
+ * Loaded straight from a memory mapping and replaced atomically on save.
+ */
+class IdentityStore {
+public:
+	static bool save(FileHandler&, const std::string&, const IdentitySnapshot&);
+	static bool load(const std::string&, IdentitySnapshot&);
+
+	static std::string serialize(const IdentitySnapshot&);
+	static bool deserialize(const uint8_t*, const size_t, IdentitySnapshot&);
+
+private:
+	static uint32_t checksum(const uint8_t*, const size_t);
+};
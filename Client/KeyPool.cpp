@@ -0,0 +1,84 @@
+#include "KeyPool.h"
+
+
+
+KeyPool::KeyPool(const size_t capacity, const size_t workers, const bool refill) : m_capacity(std::max<size_t>(capacity, 1)), m_refill(refill), m_inFlight(0), m_generated(0), m_stop(false) {
+	const size_t count = std::max<size_t>(std::min(workers, m_capacity), 1);
+	for (size_t i = 0; i < count; ++i)
+		m_workers.emplace_back(&KeyPool::generateKeys, this);
+}
+
+
+KeyPool::~KeyPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_slotFree.notify_all();
+	m_keyReady.notify_all();
+
+	for (auto& worker : m_workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+
+
+/**
+ * Take a ready private key out of the pool, waiting only if none was generated yet.
+ * The freed slot is refilled in the background, unless the pool has no refill. An empty string means no key is coming.
+ */
+const std::string KeyPool::acquire() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_keyReady.wait(lock, [this] { return !m_keys.empty() || m_stop || (!m_refill && m_generated >= m_capacity); });
+	if (m_keys.empty()) return "";
+
+	std::string key = std::move(m_keys.front());
+	m_keys.pop_front();
+	lock.unlock();
+
+	m_slotFree.notify_one();
+	return key;
+}
+
+
+size_t KeyPool::available() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_keys.size();
+}
+
+
+
+void KeyPool::generateKeys() {
+	CryptoPP::AutoSeededRandomPool rng;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_slotFree.wait(lock, [this] { return m_keys.size() + m_inFlight < m_capacity || m_stop; });
+			if (m_stop || (!m_refill && m_generated + m_inFlight >= m_capacity)) return;
+			++m_inFlight;
+		}
+
+		// generate outside of the lock, this is the expensive part
+		std::string key;
+		try {
+			CryptoPP::RSA::PrivateKey privateKey;
+			privateKey.Initialize(rng, BITS);
+			CryptoPP::StringSink ss(key);
+			privateKey.Save(ss);
+		} catch (...) {
+			key.clear();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			--m_inFlight;
+			if (m_stop) return;
+			if (key.empty()) continue;
+			m_keys.push_back(std::move(key));
+			++m_generated;
+		}
+		m_keyReady.notify_one();
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "RSAHandler.h"
+
+
+
+constexpr size_t DEFAULT_KEY_POOL_SIZE = 1;
+
+
+/**
+ * Keeps a small pool of ready RSA private keys (DER encoded).
+ * Keys are generated on background threads so that registration does not wait for key generation.
+ * A pool without refill generates capacity keys once, so taking the last one leaves no generation to wait for.
+ */
+class KeyPool {
+public:
+	explicit KeyPool(const size_t capacity = DEFAULT_KEY_POOL_SIZE, const size_t workers = 1, const bool refill = true);
+	virtual ~KeyPool();
+	KeyPool(const KeyPool& other) = delete;
+	KeyPool(KeyPool&& other) noexcept = delete;
+	KeyPool& operator=(const KeyPool& other) = delete;
+	KeyPool& operator=(KeyPool&& other) noexcept = delete;
+
+	const std::string acquire();
+	size_t available();
+	size_t capacity() const { return m_capacity; }
+
+private:
+	void generateKeys();
+
+	const size_t m_capacity;
+	const bool m_refill;
+	std::deque<std::string> m_keys;
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_keyReady;
+	std::condition_variable m_slotFree;
+	size_t m_inFlight;
+	size_t m_generated;
+	bool m_stop;
+};
@@ -1,16 +1,103 @@
 #include <iostream>
+#include <fstream>
 #include "Client.h"
+#include "ClientCore.h"
+#include "BatchRunner.h"
 #include "SocketHandler.h"
 #include "FileHandler.h"
+#include "MockServer.h"
 #include "Protocol.h"
 
 
 
 
-int main() {
-    ClientHandler c;
+int main(int argc, char* argv[]) {
+    // new identities use RSA unless X25519 key agreement is requested
+    KeyType keyType = RSA_KEY;
+    bool useMockServer = false;
+    bool collectStats = false;
+    bool collectTrace = false;
+    std::string capturePath;
+    std::string batchPath;
+    size_t batchJobs = 1;
+    bool multiplex = false;
+    bool compress = false;
+    MockServerConfig mockConfig;
+    RequestPolicy policy;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool hasValue = i + 1 < argc;
+            if (arg == "--x25519") keyType = X25519_KEY;
+            else if (arg == "--stats") collectStats = true;
+            else if (arg == "--trace") collectTrace = true;
+            else if (arg == "--capture" && hasValue) capturePath = argv[++i];
+            else if (arg == "--batch" && hasValue) batchPath = argv[++i];
+            else if (arg == "--jobs" && hasValue) batchJobs = std::stoul(argv[++i]);
+            else if (arg == "--multiplex") multiplex = true;
+            else if (arg == "--compress") compress = true;
+            else if (arg == "--mock-server") useMockServer = true;
+            else if (arg == "--mock-latency" && hasValue) mockConfig.latency = std::chrono::milliseconds(std::stoul(argv[++i]));
+            else if (arg == "--mock-jitter" && hasValue) mockConfig.jitter = std::chrono::milliseconds(std::stoul(argv[++i]));
+            else if (arg == "--mock-bandwidth" && hasValue) mockConfig.bandwidth = std::stoul(argv[++i]);
+            else if (arg == "--mock-error-rate" && hasValue) mockConfig.errorRate = std::stod(argv[++i]);
+            else if (arg == "--mock-drop-rate" && hasValue) mockConfig.dropRate = std::stod(argv[++i]);
+            else if (arg == "--connect-timeout" && hasValue) policy.connectTimeout = std::chrono::milliseconds(std::stoul(argv[++i]));
+            else if (arg == "--io-timeout" && hasValue) policy.ioTimeout = std::chrono::milliseconds(std::stoul(argv[++i]));
+            else if (arg == "--deadline" && hasValue) policy.deadline = std::chrono::milliseconds(std::stoul(argv[++i]));
+            else if (arg == "--retries" && hasValue) policy.maxRetries = std::stoul(argv[++i]);
+            else if (arg == "--hedge-delay" && hasValue) policy.hedgeDelay = std::chrono::milliseconds(std::stoul(argv[++i]));
+        }
+    } catch (...) {
+        std::cout << "Invalid command line arguments" << std::endl;
+        return 1;
+    }
+
+    // the mock server lives in this process and is stopped after the client
+    MockServer mockServer(mockConfig);
+    if (useMockServer && !mockServer.start()) return 1;
+
+    if (!batchPath.empty()) {
+        // results go to stdout, the messages printed along the way to stderr
+        std::ostream results(std::cout.rdbuf());
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+        ClientCoreConfig config;
+        config.connections = std::max<size_t>(batchJobs, config.connections);
+        config.multiplex = multiplex;
+        config.compress = compress;
+        if (useMockServer) {
+            config.address = mockServer.address();
+            config.port = mockServer.port();
+        }
+        ClientCore core(config);
+        core.stats().setEnabled(collectStats);
+        core.setRequestPolicy(policy);
+
+        bool success = false;
+        {
+            BatchRunner runner(core, results, batchJobs);
+            if (batchPath == "-") {
+                success = runner.run(std::cin);
+            } else {
+                std::ifstream commands(batchPath);
+                if (!commands.is_open()) std::cout << "Failed to open '" << batchPath << "'" << std::endl;
+                else success = runner.run(commands);
+            }
+        }
+        if (collectStats) std::cout << core.stats().report();
+        std::cout.rdbuf(results.rdbuf());
+        return success ? 0 : 2;
+    }
+
+    ClientHandler c(keyType);
+    c.enableStats(collectStats);
+    c.enableTrace(collectTrace);
+    c.enableCompression(compress);
+    c.setRequestPolicy(policy);
+    if (!capturePath.empty() && !c.enableCapture(capturePath)) return 1;
+    if (useMockServer && !c.useServer(mockServer.address(), mockServer.port())) return 1;
     c.clientMain();
 	return 0;
 }
-
-
@@ -0,0 +1,183 @@
+#include "MessageStore.h"
+#include <algorithm>
+
+
+
+MessageStore::MessageStore(const std::string& path) : m_path(path), m_size(0) {}
+
+
+MessageStore::~MessageStore() {
+	m_file.close();
+	if (m_log.is_open()) m_log.close();
+}
+
+
+
+/**
+ * Map the log and rebuild the in-memory indexes with one pass over the records.
+ * A torn record at the end (crash while appending) is cut off.
+ */
+bool MessageStore::open() {
+	m_offsets.clear();
+	m_timestamps.clear();
+	m_byPeer.clear();
+	m_size = 0;
+
+	uint64_t validSize = 0;
+	if (std::filesystem::exists(m_path)) {
+		if (!m_file.open(m_path)) return false;
+
+		const uint8_t* data = m_file.data();
+		const uint64_t fileSize = m_file.size();
+		StoredMessageHeader header;
+
+		while (validSize + sizeof(header) <= fileSize) {
+			memcpy(&header, data + validSize, sizeof(header));
+			if (header.recordSize != sizeof(header) + header.contentSize || validSize + header.recordSize > fileSize) break;
+
+			index(static_cast<uint32_t>(m_offsets.size()), header, validSize);
+			validSize += header.recordSize;
+		}
+
+		if (validSize != fileSize) {
+			m_file.close();
+			try {
+				std::filesystem::resize_file(m_path, validSize);
+			} catch (...) {
+				return false;
+			}
+		}
+	}
+
+	m_size = validSize;
+	m_log.open(m_path, std::ios::binary | std::ios::app);
+	return m_log.is_open() && remap();
+}
+
+
+
+uint32_t MessageStore::append(const ClientID& peer, MessageDirection direction, uint32_t messageID, uint8_t msgType, const std::string& content) {
+	if (!m_log.is_open()) return INVALID_SEQUENCE;
+
+	StoredMessageHeader header;
+	header.timestamp = std::max(now(), m_timestamps.empty() ? 0 : m_timestamps.back());
+	header.peer = peer;
+	header.direction = direction;
+	header.messageID = messageID;
+	header.msgType = msgType;
+	header.contentSize = static_cast<uint32_t>(content.size());
+	header.recordSize = sizeof(header) + header.contentSize;
+
+	try {
+		m_log.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		m_log.write(content.data(), content.size());
+		m_log.flush();
+	} catch (...) {
+		return INVALID_SEQUENCE;
+	}
+	if (!m_log) return INVALID_SEQUENCE;
+
+	const uint32_t sequence = static_cast<uint32_t>(m_offsets.size());
+	index(sequence, header, m_size);
+	m_size += header.recordSize;
+	return sequence;
+}
+
+
+
+bool MessageStore::get(uint32_t sequence, StoredMessage& out) {
+	if (sequence >= m_offsets.size()) return false;
+	if (!readAt(m_offsets[sequence], out)) return false;
+	out.sequence = sequence;
+	return true;
+}
+
+
+
+/**
+ * Messages exchanged with the peer, newest first.
+ * 'skip' messages are skipped, so pages are requested with skip = page * limit.
+ */
+std::vector<StoredMessage> MessageStore::history(const ClientID& peer, size_t skip, size_t limit) {
+	std::vector<StoredMessage> messages;
+	const auto it = m_byPeer.find(peer);
+	if (it == m_byPeer.end() || skip >= it->second.size()) return messages;
+
+	const auto& sequences = it->second;
+	const size_t end = sequences.size() - skip;
+	const size_t begin = (end > limit) ? end - limit : 0;
+	messages.reserve(end - begin);
+
+	StoredMessage message;
+	for (size_t i = end; i > begin; --i) {
+		if (get(sequences[i - 1], message)) messages.push_back(message);
+	}
+	return messages;
+}
+
+
+
+/**
+ * Messages with from <= timestamp < to, oldest first.
+ */
+std::vector<StoredMessage> MessageStore::range(uint64_t from, uint64_t to, size_t limit) {
+	std::vector<StoredMessage> messages;
+	const auto first = std::lower_bound(m_timestamps.begin(), m_timestamps.end(), from);
+	const auto last = std::lower_bound(first, m_timestamps.end(), to);
+
+	StoredMessage message;
+	for (auto it = first; it != last && messages.size() < limit; ++it) {
+		if (get(static_cast<uint32_t>(it - m_timestamps.begin()), message)) messages.push_back(message);
+	}
+	return messages;
+}
+
+
+size_t MessageStore::count(const ClientID& peer) const {
+	const auto it = m_byPeer.find(peer);
+	return (it == m_byPeer.end()) ? 0 : it->second.size();
+}
+
+
+uint64_t MessageStore::now() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+
+bool MessageStore::remap() {
+	if (m_size == 0) {
+		m_file.close();
+		return true;
+	}
+	return m_file.open(m_path);
+}
+
+
+bool MessageStore::readAt(uint64_t offset, StoredMessage& out) {
+	// records appended after the last mapping need a fresh one
+	if (offset + sizeof(StoredMessageHeader) > m_file.size()) {
+		m_log.flush();
+		if (!remap()) return false;
+	}
+
+	StoredMessageHeader header;
+	if (offset + sizeof(header) > m_file.size()) return false;
+	memcpy(&header, m_file.data() + offset, sizeof(header));
+	if (offset + header.recordSize > m_file.size()) return false;
+
+	out.timestamp = header.timestamp;
+	out.peer = header.peer;
+	out.direction = header.direction;
+	out.messageID = header.messageID;
+	out.msgType = header.msgType;
+	out.content.assign(reinterpret_cast<const char*>(m_file.data() + offset + sizeof(header)), header.contentSize);
+	return true;
+}
+
+
+void MessageStore::index(uint32_t sequence, const StoredMessageHeader& header, uint64_t offset) {
+	m_offsets.push_back(offset);
+	m_timestamps.push_back(std::max(header.timestamp, m_timestamps.empty() ? 0 : m_timestamps.back()));
+	m_byPeer[header.peer].push_back(sequence);
+}
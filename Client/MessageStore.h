@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <chrono>
+#include "Protocol.h"
+#include "FileHandler.h"
+
+
+
+constexpr auto MESSAGE_LOG_PATH = "messages.log";
+
+
+enum MessageDirection {
+	INCOMING_MESSAGE = 0,
+	OUTGOING_MESSAGE = 1
+};
+
+
+#pragma pack(push, 1)
+	struct StoredMessageHeader {
+		uint32_t recordSize;	// header + content
+		uint64_t timestamp;		// milliseconds since epoch
+		ClientID peer;
+		uint8_t direction;
+		uint32_t messageID;
+		uint8_t msgType;
+		uint32_t contentSize;
+
+		StoredMessageHeader() : recordSize(0), timestamp(0), direction(INCOMING_MESSAGE), messageID(0), msgType(NONE_MESSAGE), contentSize(0) {}
+	};
+#pragma pack(pop)
+
+
+struct StoredMessage {
+	uint32_t sequence;
+	uint64_t timestamp;
+	ClientID peer;
+	uint8_t direction;
+	uint32_t messageID;
+	uint8_t msgType;
+	std::string content;
+
+	StoredMessage() : sequence(0), timestamp(0), direction(INCOMING_MESSAGE), messageID(0), msgType(NONE_MESSAGE) {}
+};
+
+
+/**
+ * Append-only local message log, read through a memory mapping.
+ * Messages are indexed by peer and by time, so history is paged without touching the network.
+ */
+class MessageStore {
+public:
+	static constexpr uint32_t INVALID_SEQUENCE = UINT32_MAX;
+
+	explicit MessageStore(const std::string& = MESSAGE_LOG_PATH);
+	virtual ~MessageStore();
+	MessageStore(const MessageStore& other) = delete;
+	MessageStore(MessageStore&& other) noexcept = delete;
+	MessageStore& operator=(const MessageStore& other) = delete;
+	MessageStore& operator=(MessageStore&& other) noexcept = delete;
+
+	bool open();
+	uint32_t append(const ClientID&, MessageDirection, uint32_t, uint8_t, const std::string&);
+	bool get(uint32_t, StoredMessage&);
+	std::vector<StoredMessage> history(const ClientID&, size_t, size_t);
+	std::vector<StoredMessage> range(uint64_t, uint64_t, size_t);
+	size_t count() const { return m_offsets.size(); }
+	size_t count(const ClientID&) const;
+
+	static uint64_t now();
+
+private:
+	bool remap();
+	bool readAt(uint64_t, StoredMessage&);
+	void index(uint32_t, const StoredMessageHeader&, uint64_t);
+
+	const std::string m_path;
+	std::ofstream m_log;
+	MappedFile m_file;
+	uint64_t m_size;
+	std::vector<uint64_t> m_offsets;		// record offset by sequence
+	std::vector<uint64_t> m_timestamps;		// non decreasing, by sequence
+	std::unordered_map<ClientID, std::vector<uint32_t>, ClientIDHash> m_byPeer;
+};
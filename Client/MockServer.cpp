@@ -0,0 +1,286 @@
+#include "MockServer.h"
+#include <iostream>
+
+
+
+MockServer::MockServer(const MockServerConfig& config) : m_config(config), m_acceptor(m_ioContext), m_running(false), m_port(0), m_idRng(config.seed), m_faultRng(config.seed), m_requests(0), m_nextMessageID(1) {}
+
+
+MockServer::~MockServer() {
+	stop();
+}
+
+
+
+bool MockServer::start(uint16_t port) {
+	if (m_running) return true;
+
+	try {
+		const tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+		m_acceptor.open(endpoint.protocol());
+		m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+		m_acceptor.bind(endpoint);
+		m_acceptor.listen();
+		m_port = m_acceptor.local_endpoint().port();
+	} catch (const std::exception& e) {
+		std::cout << "Mock server can not listen: " << e.what() << std::endl;
+		return false;
+	}
+
+	m_running = true;
+	m_thread = std::thread(&MockServer::serve, this);
+	return true;
+}
+
+
+
+void MockServer::stop() {
+	if (!m_running.exchange(false)) return;
+
+	// wake up the blocking accept with a connection of our own
+	try {
+		boost::asio::io_context ioContext;
+		tcp::socket wake(ioContext);
+		wake.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), m_port));
+	} catch (...) {
+		/**/
+	}
+
+	if (m_thread.joinable()) m_thread.join();
+	boost::system::error_code ignored;
+	m_acceptor.close(ignored);
+}
+
+
+
+void MockServer::serve() {
+	while (m_running) {
+		tcp::socket socket(m_ioContext);
+		boost::system::error_code error;
+		m_acceptor.accept(socket, error);
+		if (error || !m_running) continue;
+
+		handleConnection(socket);
+		socket.close(error);
+	}
+}
+
+
+void MockServer::handleConnection(tcp::socket& socket) {
+	std::vector<uint8_t> request;
+	if (!readRequest(socket, request)) return;
+	++m_requests;
+
+	if (m_config.latency.count() > 0 || m_config.jitter.count() > 0) {
+		std::uniform_int_distribution<long long> jitter(0, m_config.jitter.count());
+		std::this_thread::sleep_for(m_config.latency + std::chrono::microseconds(jitter(m_faultRng)));
+	}
+
+	std::uniform_real_distribution<double> fault(0, 1);
+	if (m_config.dropRate > 0 && fault(m_faultRng) < m_config.dropRate) return;
+
+	std::vector<uint8_t> response;
+	if ((m_config.errorRate > 0 && fault(m_faultRng) < m_config.errorRate) || !handleRequest(request, response)) {
+		response.clear();
+		appendHeader(GENERIC_ERROR, 0, response);
+	}
+	writeResponse(socket, response);
+}
+
+
+
+/**
+ * The client pads every request to PACKET_SIZE blocks, the header tells how many blocks follow.
+ */
+bool MockServer::readRequest(tcp::socket& socket, std::vector<uint8_t>& request) {
+	request.resize(PACKET_SIZE);
+	boost::system::error_code error;
+	if (boost::asio::read(socket, boost::asio::buffer(request.data(), PACKET_SIZE), error) != PACKET_SIZE) return false;
+
+	RequestHeader header(0);
+	memcpy(&header, request.data(), sizeof(header));
+	const size_t size = sizeof(header) + header.payloadSize;
+	if (size <= PACKET_SIZE) return true;
+
+	const size_t padded = ((size + PACKET_SIZE - 1) / PACKET_SIZE) * PACKET_SIZE;
+	request.resize(padded);
+	if (boost::asio::read(socket, boost::asio::buffer(request.data() + PACKET_SIZE, padded - PACKET_SIZE), error) != padded - PACKET_SIZE) return false;
+	request.resize(size);
+	return true;
+}
+
+
+bool MockServer::writeResponse(tcp::socket& socket, std::vector<uint8_t>& response) {
+	const size_t padded = std::max<size_t>(PACKET_SIZE, ((response.size() + PACKET_SIZE - 1) / PACKET_SIZE) * PACKET_SIZE);
+	response.resize(padded, 0);
+
+	try {
+		for (size_t offset = 0; offset < response.size(); offset += PACKET_SIZE) {
+			const auto start = std::chrono::steady_clock::now();
+			boost::asio::write(socket, boost::asio::buffer(response.data() + offset, PACKET_SIZE));
+
+			// hold every packet until the configured bandwidth allows the next one
+			if (m_config.bandwidth > 0) {
+				const auto budget = std::chrono::microseconds(PACKET_SIZE * 1000000ull / m_config.bandwidth);
+				std::this_thread::sleep_until(start + budget);
+			}
+		}
+		return true;
+	} catch (const std::exception&) {
+		return false;
+	}
+}
+
+
+
+bool MockServer::handleRequest(const std::vector<uint8_t>& request, std::vector<uint8_t>& response) {
+	RequestHeader header(0);
+	memcpy(&header, request.data(), sizeof(header));
+
+	if (header.code == REGISTER_CLIENT) return handleRegister(request, response);
+	if (findClient(header.clientId) == nullptr) return false;
+
+	switch (header.code) {
+	case GET_CLIENTS_LIST:
+		return handleClientsList(header, response);
+	case GET_PUBLIC_KEY:
+		return handlePublicKey(request, response);
+	case SEND_MESSAGE:
+		return handleSendMessage(request, response);
+	case GET_UNREAD_MESSAGES:
+		return handleUnreadMessages(header, response);
+	default:
+		return false;
+	}
+}
+
+
+
+bool MockServer::handleRegister(const std::vector<uint8_t>& request, std::vector<uint8_t>& response) {
+	RegistrationRequest req;
+	const size_t fixedSize = sizeof(req) - sizeof(req.keyType);
+	if (request.size() < fixedSize) return false;
+	memcpy(&req, request.data(), std::min(request.size(), sizeof(req)));
+	if (req.header.version < KEY_TYPE_VERSION) req.keyType = RSA_KEY;
+
+	StoredClient client;
+	client.name.assign(reinterpret_cast<const char*>(req.name), strnlen(reinterpret_cast<const char*>(req.name), NAME_SIZE));
+	if (client.name.empty() || findClient(client.name) != nullptr) return false;
+
+	do {
+		for (auto& byte : client.clientId.id) byte = static_cast<uint8_t>(m_idRng());
+	} while (EndpointSelector::shardOf(client.clientId, m_config.shards) != m_config.shard);
+	memcpy(client.publicKey, req.publicKey, PUBLIC_KEY_SIZE);
+	client.keyType = req.keyType;
+	m_clients.push_back(client);
+
+	appendHeader(REGISTER_SUCCESS, CLIENT_ID_SIZE, response);
+	response.insert(response.end(), client.clientId.id, client.clientId.id + CLIENT_ID_SIZE);
+	return true;
+}
+
+
+bool MockServer::handleClientsList(const RequestHeader& header, std::vector<uint8_t>& response) {
+	std::vector<uint8_t> payload;
+	UnpackClient entry;
+	for (const auto& client : m_clients) {
+		if (client.clientId == header.clientId) continue;
+		entry.clientId = client.clientId;
+		memset(entry.name, 0, NAME_SIZE);
+		memcpy(entry.name, client.name.c_str(), std::min(client.name.size(), NAME_SIZE - 1));
+		PayloadParser::packClient(entry, payload);
+	}
+
+	appendHeader(GET_CLIENTS_LIST_SUCCESS, static_cast<uint32_t>(payload.size()), response);
+	response.insert(response.end(), payload.begin(), payload.end());
+	return true;
+}
+
+
+bool MockServer::handlePublicKey(const std::vector<uint8_t>& request, std::vector<uint8_t>& response) {
+	PublicKeyRequest req;
+	if (request.size() < sizeof(req)) return false;
+	memcpy(&req, request.data(), sizeof(req));
+
+	const std::string name(reinterpret_cast<const char*>(req.name), strnlen(reinterpret_cast<const char*>(req.name), NAME_SIZE));
+	const StoredClient* client = findClient(name);
+	if (client == nullptr) return false;
+
+	// legacy clients only understand RSA keys and don't expect the key type field
+	const bool withKeyType = req.header.version >= KEY_TYPE_VERSION;
+	if (!withKeyType && client->keyType != RSA_KEY) return false;
+
+	appendHeader(GET_PUBLIC_KEY_SUCCESS, static_cast<uint32_t>(CLIENT_ID_SIZE + PUBLIC_KEY_SIZE + (withKeyType ? 1 : 0)), response);
+	response.insert(response.end(), client->clientId.id, client->clientId.id + CLIENT_ID_SIZE);
+	response.insert(response.end(), client->publicKey, client->publicKey + PUBLIC_KEY_SIZE);
+	if (withKeyType) response.push_back(client->keyType);
+	return true;
+}
+
+
+bool MockServer::handleSendMessage(const std::vector<uint8_t>& request, std::vector<uint8_t>& response) {
+	SendMessageRequest req;
+	const size_t fixedSize = sizeof(req.header) + req.payloadSizeWithoutMsg();
+	if (request.size() < fixedSize) return false;
+	memcpy(&req, request.data(), fixedSize);
+	if (request.size() - fixedSize < req.contentSize) return false;
+	const uint8_t msgType = req.msgType & MESSAGE_TYPE_MASK;
+	if (msgType < REQUEST_SYM_KEY || msgType > FILE_MSG) return false;
+	if (findClient(req.clientId) == nullptr) return false;
+
+	PendingMessage message;
+	message.header.clientId = req.header.clientId;
+	message.header.messageID = m_nextMessageID++;
+	message.header.msgType = req.msgType;
+	message.header.msgSize = req.contentSize;
+	message.content.assign(request.begin() + fixedSize, request.begin() + fixedSize + req.contentSize);
+	m_pending[req.clientId].push_back(std::move(message));
+
+	appendHeader(MESSAGE_SENT_SUCCESS, static_cast<uint32_t>(CLIENT_ID_SIZE + MESSAGE_ID_SIZE), response);
+	response.insert(response.end(), req.clientId.id, req.clientId.id + CLIENT_ID_SIZE);
+	const uint32_t messageID = m_pending[req.clientId].back().header.messageID;
+	const uint8_t* idBytes = reinterpret_cast<const uint8_t*>(&messageID);
+	response.insert(response.end(), idBytes, idBytes + MESSAGE_ID_SIZE);
+	return true;
+}
+
+
+bool MockServer::handleUnreadMessages(const RequestHeader& header, std::vector<uint8_t>& response) {
+	std::vector<uint8_t> payload;
+	const auto it = m_pending.find(header.clientId);
+	if (it != m_pending.end()) {
+		for (const auto& message : it->second) PayloadParser::packMessage(message.header, message.content.data(), payload);
+		m_pending.erase(it);
+	}
+
+	appendHeader(GET_UNREAD_MESSAGES_SUCCESS, static_cast<uint32_t>(payload.size()), response);
+	response.insert(response.end(), payload.begin(), payload.end());
+	return true;
+}
+
+
+
+void MockServer::appendHeader(ResponseCode code, uint32_t payloadSize, std::vector<uint8_t>& response) {
+	ResponseHeader header;
+	header.version = MOCK_SERVER_VERSION;
+	header.code = static_cast<uint16_t>(code);
+	header.payloadtSize = payloadSize;
+	const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&header);
+	response.insert(response.end(), ptr, ptr + sizeof(header));
+}
+
+
+MockServer::StoredClient* MockServer::findClient(const ClientID& clientId) {
+	for (auto& client : m_clients) {
+		if (client.clientId == clientId) return &client;
+	}
+	return nullptr;
+}
+
+
+MockServer::StoredClient* MockServer::findClient(const std::string& name) {
+	for (auto& client : m_clients) {
+		if (client.name == name) return &client;
+	}
+	return nullptr;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include "Protocol.h"
+#include "PayloadParser.h"
+#include "SocketHandler.h"
+
+
+
+constexpr uint8_t MOCK_SERVER_VERSION = 2;
+
+
+struct MockServerConfig {
+	std::chrono::microseconds latency{ 0 };	// added before every response
+	std::chrono::microseconds jitter{ 0 };	// uniform extra latency in [0, jitter]
+	size_t bandwidth = 0;					// response bytes per second, 0 is unlimited
+	double errorRate = 0;					// chance of answering GENERIC_ERROR
+	double dropRate = 0;					// chance of closing the connection without an answer
+	uint32_t seed = 1;						// client IDs and injected faults repeat for the same seed
+	size_t shard = 0;						// only hands out client IDs of this shard
+	size_t shards = 1;
+};
+
+
+/**
+ * Stand-in for the Python server, listening on a loopback port inside the client process.
+ * Implements all request codes over an in-memory store and answers like server.py does,
+ * one request per connection. Connections are served one at a time, so runs are deterministic.
+ */
+class MockServer {
+public:
+	explicit MockServer(const MockServerConfig& = MockServerConfig());
+	virtual ~MockServer();
+	MockServer(const MockServer& other) = delete;
+	MockServer(MockServer&& other) noexcept = delete;
+	MockServer& operator=(const MockServer& other) = delete;
+	MockServer& operator=(MockServer&& other) noexcept = delete;
+
+	bool start(uint16_t = 0);
+	void stop();
+	std::string address() const { return "127.0.0.1"; }
+	std::string port() const { return std::to_string(m_port); }
+	size_t requests() const { return m_requests; }
+
+private:
+	struct StoredClient {
+		ClientID clientId;
+		std::string name;
+		uint8_t publicKey[PUBLIC_KEY_SIZE];
+		uint8_t keyType;
+
+		StoredClient() : publicKey{ 0 }, keyType(RSA_KEY) {}
+	};
+
+	struct PendingMessage {
+		UnpackMessage header;
+		std::vector<uint8_t> content;
+	};
+
+	void serve();
+	void handleConnection(tcp::socket&);
+	bool readRequest(tcp::socket&, std::vector<uint8_t>&);
+	bool writeResponse(tcp::socket&, std::vector<uint8_t>&);
+	bool handleRequest(const std::vector<uint8_t>&, std::vector<uint8_t>&);
+	bool handleRegister(const std::vector<uint8_t>&, std::vector<uint8_t>&);
+	bool handleClientsList(const RequestHeader&, std::vector<uint8_t>&);
+	bool handlePublicKey(const std::vector<uint8_t>&, std::vector<uint8_t>&);
+	bool handleSendMessage(const std::vector<uint8_t>&, std::vector<uint8_t>&);
+	bool handleUnreadMessages(const RequestHeader&, std::vector<uint8_t>&);
+	void appendHeader(ResponseCode, uint32_t, std::vector<uint8_t>&);
+	StoredClient* findClient(const ClientID&);
+	StoredClient* findClient(const std::string&);
+
+	const MockServerConfig m_config;
+	boost::asio::io_context m_ioContext;
+	tcp::acceptor m_acceptor;
+	std::thread m_thread;
+	std::atomic<bool> m_running;
+	uint16_t m_port;
+	std::mt19937 m_idRng;		// kept apart from the faults, so IDs only depend on the seed
+	std::mt19937 m_faultRng;
+	std::atomic<size_t> m_requests;
+	uint32_t m_nextMessageID;
+
+	std::vector<StoredClient> m_clients;
+	std::unordered_map<ClientID, std::vector<PendingMessage>, ClientIDHash> m_pending;
+};
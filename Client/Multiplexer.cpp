@@ -0,0 +1,248 @@
+#include "Multiplexer.h"
+#include <algorithm>
+
+
+
+Multiplexer::Multiplexer(const std::string& address, const std::string& port) : m_address(address), m_port(port), m_io_context(nullptr), m_sock(nullptr),
+	m_connected(false), m_nextStream(1), m_virtualTime(0), m_writing(false) {}
+
+
+Multiplexer::~Multiplexer() {
+	close();
+}
+
+
+
+/**
+ * Opens the connection and asks the server to switch it to frames.
+ * Servers without multiplexing close the connection and this returns false.
+ */
+bool Multiplexer::connect(std::chrono::milliseconds timeout) {
+	std::lock_guard<std::mutex> lock(m_connectMutex);
+	if (m_connected) return true;
+	shutdown();
+
+	m_io_context = new boost::asio::io_context;
+	m_sock = new tcp::socket(*m_io_context);
+	try {
+		tcp::resolver resolver(*m_io_context);
+		const auto endpoints = resolver.resolve(m_address, m_port);
+
+		bool done = false;
+		boost::system::error_code error;
+		boost::asio::async_connect(*m_sock, endpoints, [&](const boost::system::error_code& ec, const tcp::endpoint&) {
+			error = ec;
+			done = true;
+		});
+		if (!await(done, timeout) || error || !handshake(timeout)) {
+			shutdown();
+			return false;
+		}
+		m_sock->set_option(tcp::no_delay(true));
+	} catch (const std::exception&) {
+		shutdown();
+		return false;
+	}
+
+	m_connected = true;
+	m_virtualTime = 0;
+	m_writing = false;
+	m_io_context->restart();	// run out of work after the handshake
+	readHeader();
+	m_thread = std::thread([this]() {
+		auto work = boost::asio::make_work_guard(*m_io_context);
+		m_io_context->run();
+	});
+	return true;
+}
+
+
+void Multiplexer::close() {
+	std::lock_guard<std::mutex> lock(m_connectMutex);
+	shutdown();
+}
+
+
+
+/**
+ * Sends a request on a new stream and waits for the whole response.
+ * A request that times out is still sent to the end, its response is dropped.
+ */
+bool Multiplexer::exchange(const uint8_t* request, const size_t size, std::vector<uint8_t>& response, Priority priority, std::chrono::milliseconds timeout) {
+	auto stream = std::make_shared<Stream>();
+	stream->request.assign(request, request + size);
+	stream->weight = (priority == Priority::BULK) ? BULK_WEIGHT : CONTROL_WEIGHT;
+	std::future<bool> done = stream->done.get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(m_connectMutex);
+		if (!m_connected) return false;
+		stream->id = m_nextStream++;
+		boost::asio::post(*m_io_context, [this, stream]() { enqueue(stream); });
+	}
+
+	if (done.wait_for(timeout) != std::future_status::ready) return false;
+	try {
+		if (!done.get()) return false;
+	} catch (const std::future_error&) {
+		return false;	// the connection was closed before the stream was queued
+	}
+	response = std::move(stream->response);
+	return true;
+}
+
+
+Priority Multiplexer::priorityOf(const uint8_t*, const size_t size) {
+	return (size > BULK_REQUEST_SIZE) ? Priority::BULK : Priority::CONTROL;
+}
+
+
+
+bool Multiplexer::handshake(std::chrono::milliseconds timeout) {
+	std::vector<uint8_t> packet(PACKET_SIZE, 0);
+	const RequestHeader req(OPEN_MULTIPLEX);
+	memcpy(packet.data(), &req, sizeof(req));
+
+	bool done = false;
+	boost::system::error_code error;
+	boost::asio::async_write(*m_sock, boost::asio::buffer(packet), [&](const boost::system::error_code& ec, size_t) {
+		error = ec;
+		done = true;
+	});
+	if (!await(done, timeout) || error) return false;
+
+	done = false;
+	boost::asio::async_read(*m_sock, boost::asio::buffer(packet), [&](const boost::system::error_code& ec, size_t) {
+		error = ec;
+		done = true;
+	});
+	if (!await(done, timeout) || error) return false;
+
+	ResponseHeader header;
+	memcpy(&header, packet.data(), sizeof(header));
+	return header.code == MULTIPLEX_ACCEPTED;
+}
+
+
+bool Multiplexer::await(const bool& done, std::chrono::steady_clock::duration timeout) {
+	const auto until = std::chrono::steady_clock::now() + timeout;
+	m_io_context->restart();
+	while (!done && m_io_context->run_one_until(until) > 0) {}
+	if (done) return true;
+
+	boost::system::error_code ignored;
+	m_sock->close(ignored);
+	m_io_context->restart();
+	m_io_context->run();
+	return false;
+}
+
+
+
+void Multiplexer::enqueue(const std::shared_ptr<Stream>& stream) {
+	if (!m_connected) {
+		stream->done.set_value(false);
+		return;
+	}
+	m_streams[stream->id] = stream;
+	schedule(*stream);
+	writeNext();
+}
+
+
+/**
+ * Self-clocked fair queuing: a frame finishes at the later of the current virtual time and the end
+ * of the stream's previous frame, plus its size divided by the stream's weight.
+ * The frame with the earliest finish goes next.
+ */
+void Multiplexer::schedule(Stream& stream) {
+	const size_t length = std::min(MAX_FRAME_SIZE, stream.request.size() - stream.sent);
+	stream.finish = std::max(m_virtualTime, stream.finish) + length / stream.weight;
+	m_schedule.emplace(stream.finish, stream.id);
+}
+
+
+void Multiplexer::writeNext() {
+	if (m_writing || m_schedule.empty()) return;
+
+	const Scheduled next = m_schedule.top();
+	m_schedule.pop();
+	const auto found = m_streams.find(next.second);
+	if (found == m_streams.end()) return writeNext();
+	Stream& stream = *found->second;
+	m_virtualTime = next.first;
+
+	FrameHeader header;
+	header.streamId = stream.id;
+	header.length = static_cast<uint16_t>(std::min(MAX_FRAME_SIZE, stream.request.size() - stream.sent));
+	header.flags = (stream.sent + header.length == stream.request.size()) ? FRAME_END : 0;
+
+	m_outFrame.resize(sizeof(header) + header.length);
+	memcpy(m_outFrame.data(), &header, sizeof(header));
+	memcpy(m_outFrame.data() + sizeof(header), stream.request.data() + stream.sent, header.length);
+	stream.sent += header.length;
+	if (stream.sent < stream.request.size()) schedule(stream);
+
+	m_writing = true;
+	boost::asio::async_write(*m_sock, boost::asio::buffer(m_outFrame), [this](const boost::system::error_code& error, size_t) {
+		m_writing = false;
+		if (error) fail();
+		else writeNext();
+	});
+}
+
+
+
+void Multiplexer::readHeader() {
+	boost::asio::async_read(*m_sock, boost::asio::buffer(&m_inHeader, sizeof(m_inHeader)), [this](const boost::system::error_code& error, size_t) {
+		if (error) return fail();
+		m_inPayload.resize(m_inHeader.length);
+		readPayload();
+	});
+}
+
+
+// Frames of streams that are not waited for anymore are dropped.
+void Multiplexer::readPayload() {
+	boost::asio::async_read(*m_sock, boost::asio::buffer(m_inPayload), [this](const boost::system::error_code& error, size_t) {
+		if (error) return fail();
+
+		const auto found = m_streams.find(m_inHeader.streamId);
+		if (found != m_streams.end()) {
+			std::shared_ptr<Stream> stream = found->second;
+			stream->response.insert(stream->response.end(), m_inPayload.begin(), m_inPayload.end());
+			if (m_inHeader.flags & FRAME_END) {
+				m_streams.erase(found);
+				stream->done.set_value(true);
+			}
+		}
+		readHeader();
+	});
+}
+
+
+
+// Fails every stream in flight, the next connect() opens a new connection.
+void Multiplexer::fail() {
+	m_connected = false;
+	boost::system::error_code ignored;
+	if (m_sock != nullptr) m_sock->close(ignored);
+
+	for (auto& stream : m_streams) stream.second->done.set_value(false);
+	m_streams.clear();
+	m_schedule = decltype(m_schedule)();
+}
+
+
+// The caller holds m_connectMutex.
+void Multiplexer::shutdown() {
+	if (m_io_context != nullptr) m_io_context->stop();
+	if (m_thread.joinable()) m_thread.join();
+	fail();
+
+	// the socket must go before the io_context it was created with
+	delete m_sock;
+	m_sock = nullptr;
+	delete m_io_context;
+	m_io_context = nullptr;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "Protocol.h"
+#include "SocketHandler.h"
+
+
+
+enum class Priority {
+	CONTROL,	// registrations, lookups, key exchange and polls
+	BULK		// large messages, files
+};
+
+constexpr double CONTROL_WEIGHT = 16;				// bandwidth share of a control stream against one bulk stream
+constexpr double BULK_WEIGHT = 1;
+constexpr size_t BULK_REQUEST_SIZE = 4 * MAX_FRAME_SIZE;	// larger requests are sent as bulk
+
+
+/**
+ * One connection shared by every request of the process. Requests and responses are split into
+ * frames tagged with a stream ID, and the frames of all requests in flight are interleaved by
+ * weighted fair queuing, so a key request is not stuck behind a file transfer.
+ * The frames are written and read on one I/O thread, exchange() may be called from any thread.
+ */
+class Multiplexer {
+public:
+	Multiplexer(const std::string&, const std::string&);
+	virtual ~Multiplexer();
+	Multiplexer(const Multiplexer& other) = delete;
+	Multiplexer(Multiplexer&& other) noexcept = delete;
+	Multiplexer& operator=(const Multiplexer& other) = delete;
+	Multiplexer& operator=(Multiplexer&& other) noexcept = delete;
+
+	bool connect(std::chrono::milliseconds);
+	bool exchange(const uint8_t*, const size_t, std::vector<uint8_t>&, Priority, std::chrono::milliseconds);
+	bool isConnected() const { return m_connected; }
+	void close();
+	static Priority priorityOf(const uint8_t*, const size_t);
+
+private:
+	struct Stream {
+		uint32_t id;
+		std::vector<uint8_t> request;
+		size_t sent;
+		double weight;
+		double finish;		// virtual time at which the stream's last queued frame is done
+		std::vector<uint8_t> response;
+		std::promise<bool> done;
+
+		Stream() : id(0), sent(0), weight(CONTROL_WEIGHT), finish(0) {}
+	};
+	using Scheduled = std::pair<double, uint32_t>;	// finish time of the next frame, stream
+
+	bool handshake(std::chrono::milliseconds);
+	bool await(const bool&, std::chrono::steady_clock::duration);
+	void enqueue(const std::shared_ptr<Stream>&);
+	void schedule(Stream&);
+	void writeNext();
+	void readHeader();
+	void readPayload();
+	void fail();
+	void shutdown();
+
+	const std::string m_address;
+	const std::string m_port;
+	boost::asio::io_context* m_io_context;
+	tcp::socket* m_sock;
+	std::thread m_thread;
+	std::atomic<bool> m_connected;
+	std::mutex m_connectMutex;
+	std::atomic<uint32_t> m_nextStream;
+
+	// only used on the I/O thread
+	std::unordered_map<uint32_t, std::shared_ptr<Stream>> m_streams;
+	std::priority_queue<Scheduled, std::vector<Scheduled>, std::greater<Scheduled>> m_schedule;
+	double m_virtualTime;
+	bool m_writing;
+	std::vector<uint8_t> m_outFrame;
+	FrameHeader m_inHeader;
+	std::vector<uint8_t> m_inPayload;
+};
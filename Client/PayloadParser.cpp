@@ -0,0 +1,52 @@
+#include "PayloadParser.h"
+
+
+
+bool PayloadParser::parseClients(const uint8_t* payload, const size_t size, std::vector<UnpackClient>& outClients) {
+	const size_t clientBlockSize = sizeof(UnpackClient);	// 271 bytes
+	if (size % clientBlockSize != 0 || (payload == nullptr && size > 0)) return false;
+
+	outClients.resize(size / clientBlockSize);
+	for (size_t i = 0; i < outClients.size(); ++i) {
+		memcpy(&outClients[i], payload + i * clientBlockSize, clientBlockSize);
+		outClients[i].name[NAME_SIZE - 1] = '\0';
+	}
+	return true;
+}
+
+
+
+bool PayloadParser::parseMessages(const uint8_t* payload, const size_t size, std::vector<ParsedMessage>& outMessages) {
+	const size_t msgHeaderSize = sizeof(UnpackMessage);
+	if (payload == nullptr && size > 0) return false;
+
+	outMessages.clear();
+	size_t bytesRead = 0;
+	ParsedMessage message;
+
+	while (bytesRead < size) {
+		if (size - bytesRead < msgHeaderSize) return false;
+		memcpy(&message.header, payload + bytesRead, msgHeaderSize);
+		bytesRead += msgHeaderSize;
+
+		if (message.header.msgSize > size - bytesRead) return false;
+		message.content = payload + bytesRead;
+		bytesRead += message.header.msgSize;
+		outMessages.push_back(message);
+	}
+	return true;
+}
+
+
+
+void PayloadParser::packClient(const UnpackClient& client, std::vector<uint8_t>& out) {
+	const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&client);
+	out.insert(out.end(), ptr, ptr + sizeof(client));
+}
+
+
+void PayloadParser::packMessage(const UnpackMessage& header, const uint8_t* content, std::vector<uint8_t>& out) {
+	const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&header);
+	out.insert(out.end(), ptr, ptr + sizeof(header));
+	if (header.msgSize > 0 && content != nullptr) out.insert(out.end(), content, content + header.msgSize);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+#include "Protocol.h"
+
+
+
+// A message inside an unread messages payload, the content points into the payload buffer.
+struct ParsedMessage {
+	UnpackMessage header;
+	const uint8_t* content;
+
+	ParsedMessage() : content(nullptr) {}
+};
+
+
+/**
+ * Packs and parses the repeated blocks of the clients list and unread messages payloads.
+ */
+class PayloadParser {
+public:
+	static bool parseClients(const uint8_t*, const size_t, std::vector<UnpackClient>&);
+	static bool parseMessages(const uint8_t*, const size_t, std::vector<ParsedMessage>&);
+	static void packClient(const UnpackClient&, std::vector<uint8_t>&);
+	static void packMessage(const UnpackMessage&, const uint8_t*, std::vector<uint8_t>&);
+};
@@ -1,14 +1,20 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <vector>
 
 
-constexpr int CLIENT_VERSION = 1;
+constexpr int CLIENT_VERSION = 2;
+constexpr int KEY_TYPE_VERSION = 2;     // first version that sends the identity key type
 constexpr size_t CLIENT_ID_SIZE = 16;
 constexpr size_t NAME_SIZE = 255;
 constexpr size_t PUBLIC_KEY_SIZE = 160;
 constexpr size_t MESSAGE_ID_SIZE = 4;
 constexpr size_t SYM_KEY_SIZE = 16;  
+constexpr size_t X25519_KEY_SIZE = 32;
+constexpr size_t MAX_FRAME_SIZE = 16384;    // payload bytes of one frame on a multiplexed connection
+constexpr uint8_t FRAME_END = 0x01;         // last frame of a request or response
 
 
 enum  RequestCode {
@@ -16,7 +22,8 @@ enum  RequestCode {
     GET_CLIENTS_LIST = 1001,
     GET_PUBLIC_KEY = 1002,
     SEND_MESSAGE = 1003,
-    GET_UNREAD_MESSAGES = 1004
+    GET_UNREAD_MESSAGES = 1004,
+    OPEN_MULTIPLEX = 1100       // switches the connection to frames, servers that don't know it close the connection
 };
  
 
@@ -26,6 +33,7 @@ enum ResponseCode {
     GET_PUBLIC_KEY_SUCCESS = 2002,
     MESSAGE_SENT_SUCCESS = 2003,
     GET_UNREAD_MESSAGES_SUCCESS = 2004,
+    MULTIPLEX_ACCEPTED = 2100,
     GENERIC_ERROR = 9000
 }; 
 
@@ -38,6 +46,16 @@ enum MessageType {
     NONE_MESSAGE = 0
 };
 
+constexpr uint8_t COMPRESSED_MESSAGE = 0x80;    // msgType flag, the content was deflated before encryption
+constexpr uint8_t MESSAGE_TYPE_MASK = 0x7F;
+
+
+// Identity key carried in the public key field, X25519 keys are zero padded to PUBLIC_KEY_SIZE
+enum KeyType {
+    RSA_KEY = 0,
+    X25519_KEY = 1
+};
+
 
 
 #pragma pack(push, 1)
@@ -82,9 +100,10 @@ enum MessageType {
         RequestHeader header;
         uint8_t name[NAME_SIZE];
         uint8_t publicKey[PUBLIC_KEY_SIZE];
+        uint8_t keyType;
 
-        RegistrationRequest() : header(REGISTER_CLIENT, getPayloadSize()) , name{ 0 }, publicKey{ 0 } {}
-        uint32_t getPayloadSize() { return sizeof(name) + sizeof(publicKey); }
+        RegistrationRequest() : header(REGISTER_CLIENT, getPayloadSize()) , name{ 0 }, publicKey{ 0 }, keyType(RSA_KEY) {}
+        uint32_t getPayloadSize() { return sizeof(name) + sizeof(publicKey) + sizeof(keyType); }
     };
 
 
@@ -106,6 +125,16 @@ enum MessageType {
          
         SendMessageRequest() : header(SEND_MESSAGE), msgType(NONE_MESSAGE), contentSize(0), msgContent(nullptr) {}
         uint32_t payloadSizeWithoutMsg() {return sizeof(clientId) + sizeof(contentSize) + sizeof(msgType); }
+
+        // msgContent is a pointer, the content itself is copied right after the fixed fields
+        std::vector<uint8_t> pack() {
+            header.payloadSize = payloadSizeWithoutMsg() + contentSize;
+            const size_t fixedSize = sizeof(header) + payloadSizeWithoutMsg();
+            std::vector<uint8_t> buffer(fixedSize + contentSize);
+            memcpy(buffer.data(), this, fixedSize);
+            if (contentSize > 0 && msgContent != nullptr) memcpy(buffer.data() + fixedSize, msgContent, contentSize);
+            return buffer;
+        }
     };
 
 
@@ -136,8 +165,9 @@ enum MessageType {
         ResponseHeader header;
         ClientID clientID;
         uint8_t publicKey[PUBLIC_KEY_SIZE];
+        uint8_t keyType;
 
-        PublicKeyResponse() : publicKey{ 0 } {}
+        PublicKeyResponse() : publicKey{ 0 }, keyType(RSA_KEY) {}
     };
 
 
@@ -174,4 +204,24 @@ enum MessageType {
 
         UnpackMessage() : messageID(0), msgType(NONE_MESSAGE) , msgSize(0) {}
     };
-#pragma pack(pop)
\ No newline at end of file
+
+
+    // Precedes every frame of a multiplexed connection, frames of one stream carry one request or response
+    struct FrameHeader {
+        uint32_t streamId;
+        uint8_t flags;
+        uint16_t length;
+
+        FrameHeader() : streamId(0), flags(0), length(0) {}
+    };
+#pragma pack(pop)
+
+
+// For unordered containers keyed by client
+struct ClientIDHash {
+    size_t operator()(const ClientID& clientId) const {
+        size_t hash = 0;
+        memcpy(&hash, clientId.id, sizeof(hash));   // server IDs are random UUIDs
+        return hash;
+    }
+};
\ No newline at end of file
@@ -3,7 +3,7 @@
 
 
 void RSAPublicWrapper::loadPublicKey(const uint8_t* key) {
-	CryptoPP::StringSource ss((key), sizeof(key), true);
+	CryptoPP::StringSource ss(key, KEY_SIZE, true);
 	m_publicKey.Load(ss);
 }
 
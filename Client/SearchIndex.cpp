@@ -0,0 +1,354 @@
+#include "SearchIndex.h"
+#include <algorithm>
+#include <cctype>
+
+
+
+SearchIndex::SearchIndex(MessageStore& store, const std::string& path) : m_store(store), m_path(path), m_terms(nullptr), m_sequences(nullptr), m_recentPostings(0), m_nextSequence(0) {}
+
+
+SearchIndex::~SearchIndex() {
+	if (m_file.is_open()) m_file.close();
+	m_compacted.close();
+}
+
+
+
+/**
+ * Map the compacted index and load the recent postings, then index whatever the message store
+ * holds beyond the last indexed message. The message log is the reference: a compacted index
+ * ahead of it, or built from another log, is rebuilt, and recent postings ahead of it are cut off.
+ */
+bool SearchIndex::open() {
+	if (m_file.is_open()) m_file.close();
+	m_recent.clear();
+	m_recentPostings = 0;
+
+	if (!loadCompacted() || !matchesStore()) {
+		if (!clear()) return false;
+	}
+	m_nextSequence = m_header.sequences;
+	if (!loadRecent()) return false;
+
+	m_file.open(recentPath(), std::ios::binary | std::ios::app);
+	if (!m_file.is_open()) return false;
+
+	StoredMessage message;
+	for (uint32_t sequence = m_nextSequence; sequence < m_store.count(); ++sequence) {
+		if (m_store.get(sequence, message) && !add(sequence, message.content)) return false;
+	}
+	return true;
+}
+
+
+
+bool SearchIndex::add(uint32_t sequence, const std::string& text) {
+	if (!m_file.is_open() || sequence < m_nextSequence) return false;
+
+	std::vector<uint64_t> hashes;
+	for (const auto& term : tokenize(text)) hashes.push_back(hashTerm(term));
+	std::sort(hashes.begin(), hashes.end());
+	hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+	// the marker goes last, a message torn while logging is not taken as indexed
+	std::vector<Posting> postings;
+	postings.reserve(hashes.size() + 1);
+	for (const auto hash : hashes) postings.push_back({ hash, sequence });
+	postings.push_back({ INDEXED_MARKER, sequence });
+
+	try {
+		m_file.write(reinterpret_cast<const char*>(postings.data()), postings.size() * sizeof(Posting));
+		m_file.flush();
+	} catch (...) {
+		return false;
+	}
+	if (!m_file) return false;
+
+	for (const auto& posting : postings) insert(posting);
+
+	// a failed compaction keeps the postings in memory, the index stays complete
+	if (m_recentPostings >= SEARCH_INDEX_RECENT_POSTINGS) compact();
+	return true;
+}
+
+
+
+/**
+ * Messages containing every term of the query, newest first, optionally only with one peer.
+ */
+std::vector<StoredMessage> SearchIndex::search(const std::string& query, const ClientID* peer, size_t limit) {
+	std::vector<StoredMessage> results;
+	std::vector<std::string> terms = tokenize(query);
+	std::sort(terms.begin(), terms.end());
+	terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+	if (terms.empty()) return results;
+
+	std::vector<TermPostings> lists;
+	for (const auto& term : terms) {
+		const TermPostings list = find(hashTerm(term));
+		if (list.size() == 0) return results;
+		lists.push_back(list);
+	}
+
+	// walk the shortest list, newest first, and probe the others
+	std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) { return a.size() < b.size(); });
+
+	StoredMessage message;
+	const auto& shortest = lists.front();
+	for (size_t i = shortest.size(); i-- > 0 && results.size() < limit;) {
+		const uint32_t sequence = shortest.at(i);
+		const bool inAll = std::all_of(lists.begin() + 1, lists.end(), [sequence](const auto& list) {
+			return list.contains(sequence);
+		});
+		if (!inAll || !m_store.get(sequence, message)) continue;
+		if (peer != nullptr && message.peer != *peer) continue;
+		if (!matches(message, terms)) continue;		// hash collision
+
+		results.push_back(message);
+	}
+	return results;
+}
+
+
+
+/**
+ * Lower cased runs of letters and digits, bytes above ASCII are kept as part of a term.
+ */
+std::vector<std::string> SearchIndex::tokenize(const std::string& text) {
+	std::vector<std::string> terms;
+	std::string term;
+
+	for (const char ch : text) {
+		const unsigned char c = static_cast<unsigned char>(ch);
+		if (std::isalnum(c) || c >= 0x80) {
+			term.push_back(static_cast<char>(std::tolower(c)));
+		} else if (!term.empty()) {
+			terms.push_back(std::move(term));
+			term.clear();
+		}
+	}
+	if (!term.empty()) terms.push_back(std::move(term));
+	return terms;
+}
+
+
+
+uint64_t SearchIndex::hashTerm(const std::string& term) {
+	uint64_t hash = 14695981039346656037ull;	// FNV-1a
+	for (const char ch : term) {
+		hash ^= static_cast<unsigned char>(ch);
+		hash *= 1099511628211ull;
+	}
+	return (hash == INDEXED_MARKER) ? 1 : hash;
+}
+
+
+void SearchIndex::insert(const Posting& posting) {
+	if (posting.termHash == INDEXED_MARKER) {
+		m_nextSequence = std::max(m_nextSequence, posting.sequence + 1);
+		return;
+	}
+
+	auto& list = m_recent[posting.termHash];
+	if (list.empty() || list.back() < posting.sequence) {
+		list.push_back(posting.sequence);
+		++m_recentPostings;
+	}
+}
+
+
+bool SearchIndex::matches(const StoredMessage& message, const std::vector<std::string>& terms) {
+	const std::vector<std::string> messageTerms = tokenize(message.content);
+	return std::all_of(terms.begin(), terms.end(), [&messageTerms](const std::string& term) {
+		return std::find(messageTerms.begin(), messageTerms.end(), term) != messageTerms.end();
+	});
+}
+
+
+
+bool SearchIndex::TermPostings::contains(uint32_t sequence) const {
+	if (std::binary_search(compacted, compacted + compactedCount, sequence)) return true;
+	return recent != nullptr && std::binary_search(recent->begin(), recent->end(), sequence);
+}
+
+
+SearchIndex::TermPostings SearchIndex::find(uint64_t hash) const {
+	TermPostings list;
+	const TermEntry* end = m_terms + m_header.termCount;
+	const TermEntry* entry = std::lower_bound(m_terms, end, hash, [](const TermEntry& e, uint64_t h) { return e.termHash < h; });
+	if (entry != end && entry->termHash == hash) {
+		list.compacted = m_sequences + entry->first;
+		list.compactedCount = entry->count;
+	}
+
+	const auto it = m_recent.find(hash);
+	if (it != m_recent.end()) list.recent = &it->second;
+	return list;
+}
+
+
+
+/**
+ * Map the compacted index, false when it is damaged or from another format.
+ */
+bool SearchIndex::loadCompacted() {
+	m_compacted.close();
+	m_header = SearchIndexHeader();
+	m_terms = nullptr;
+	m_sequences = nullptr;
+	if (!std::filesystem::exists(m_path)) return true;
+	if (!m_compacted.open(m_path) || m_compacted.size() < sizeof(SearchIndexHeader)) return false;
+
+	SearchIndexHeader header;
+	memcpy(&header, m_compacted.data(), sizeof(header));
+	const uint64_t expected = sizeof(header) + uint64_t(header.termCount) * sizeof(TermEntry) + uint64_t(header.postingCount) * sizeof(uint32_t);
+	if (header.magic != INDEX_MAGIC || m_compacted.size() != expected) return false;
+
+	m_header = header;
+	m_terms = reinterpret_cast<const TermEntry*>(m_compacted.data() + sizeof(header));
+	m_sequences = reinterpret_cast<const uint32_t*>(m_terms + m_header.termCount);
+	return true;
+}
+
+
+bool SearchIndex::matchesStore() {
+	if (m_header.sequences > m_store.count()) return false;
+	if (m_header.sequences == 0) return true;
+
+	StoredMessage message;
+	return m_store.get(m_header.sequences - 1, message) && message.timestamp == m_header.lastTimestamp;
+}
+
+
+
+/**
+ * Load the logged postings of messages indexed since the last compaction. The log is cut after
+ * the last whole message the message store still has.
+ */
+bool SearchIndex::loadRecent() {
+	const std::string path = recentPath();
+	if (!std::filesystem::exists(path)) return true;
+
+	uint64_t validSize = 0;
+	uint64_t fileSize = 0;
+	{
+		MappedFile file;
+		if (!file.open(path)) return false;
+		fileSize = file.size();
+
+		std::vector<Posting> message;
+		Posting posting;
+		for (uint64_t offset = 0; offset + sizeof(Posting) <= fileSize; offset += sizeof(Posting)) {
+			memcpy(&posting, file.data() + offset, sizeof(Posting));
+			if (posting.sequence >= m_store.count()) break;
+			message.push_back(posting);
+			if (posting.termHash != INDEXED_MARKER) continue;
+
+			// logged before the last compaction finished, those are in the compacted index already
+			if (posting.sequence >= m_header.sequences) {
+				for (const auto& p : message) insert(p);
+			}
+			message.clear();
+			validSize = offset + sizeof(Posting);
+		}
+	}
+
+	if (validSize != fileSize) {
+		try {
+			std::filesystem::resize_file(path, validSize);
+		} catch (...) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Drop the index files, the caller indexes the message store again from the start.
+bool SearchIndex::clear() {
+	m_compacted.close();
+	m_header = SearchIndexHeader();
+	m_terms = nullptr;
+	m_sequences = nullptr;
+	m_recent.clear();
+	m_recentPostings = 0;
+	m_nextSequence = 0;
+
+	std::error_code ec;
+	std::filesystem::remove(m_path, ec);
+	if (ec) return false;
+	std::filesystem::remove(recentPath(), ec);
+	return !ec;
+}
+
+
+
+/**
+ * Merge the recent postings into a new compacted index, written next to the old one and renamed over it,
+ * then start an empty log. A crash leaves either index complete, the log covers what the old one lacks.
+ */
+bool SearchIndex::compact() {
+	std::vector<uint64_t> recentTerms;
+	recentTerms.reserve(m_recent.size());
+	for (const auto& term : m_recent) recentTerms.push_back(term.first);
+	std::sort(recentTerms.begin(), recentTerms.end());
+
+	// the term tables are both sorted, merge them
+	std::vector<TermEntry> table;
+	table.reserve(m_header.termCount + recentTerms.size());
+	uint32_t postingCount = 0;
+	size_t compacted = 0;
+	size_t recent = 0;
+	while (compacted < m_header.termCount || recent < recentTerms.size()) {
+		TermEntry entry = { 0, postingCount, 0 };
+		if (recent == recentTerms.size() || (compacted < m_header.termCount && m_terms[compacted].termHash <= recentTerms[recent])) {
+			entry.termHash = m_terms[compacted].termHash;
+			entry.count = m_terms[compacted++].count;
+		} else {
+			entry.termHash = recentTerms[recent];
+		}
+		if (recent < recentTerms.size() && recentTerms[recent] == entry.termHash) {
+			entry.count += static_cast<uint32_t>(m_recent[recentTerms[recent++]].size());
+		}
+		postingCount += entry.count;
+		table.push_back(entry);
+	}
+
+	SearchIndexHeader header;
+	header.magic = INDEX_MAGIC;
+	header.sequences = m_nextSequence;
+	header.termCount = static_cast<uint32_t>(table.size());
+	header.postingCount = postingCount;
+	StoredMessage last;
+	if (m_nextSequence > 0 && !m_store.get(m_nextSequence - 1, last)) return false;
+	header.lastTimestamp = last.timestamp;
+
+	std::string data;
+	try {
+		data.reserve(sizeof(header) + table.size() * sizeof(TermEntry) + static_cast<size_t>(postingCount) * sizeof(uint32_t));
+		data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+		data.append(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(TermEntry));
+		for (const auto& entry : table) {
+			const TermPostings list = find(entry.termHash);
+			if (list.compactedCount > 0) data.append(reinterpret_cast<const char*>(list.compacted), list.compactedCount * sizeof(uint32_t));
+			if (list.recent != nullptr) data.append(reinterpret_cast<const char*>(list.recent->data()), list.recent->size() * sizeof(uint32_t));
+		}
+	} catch (...) {
+		return false;
+	}
+
+	// the mapping has to go before the file can be replaced, the new index is on disk before the rename
+	m_compacted.close();
+	FileHandler fileHandler;
+	if (!fileHandler.replaceFile(m_path, data)) {
+		loadCompacted();
+		return false;
+	}
+	if (!loadCompacted()) return false;
+
+	m_recent.clear();
+	m_recentPostings = 0;
+	m_file.close();
+	m_file.open(recentPath(), std::ios::binary | std::ios::trunc);
+	return m_file.is_open();
+}
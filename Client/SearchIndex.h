@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include "MessageStore.h"
+
+
+
+constexpr auto SEARCH_INDEX_PATH = "messages.idx";
+constexpr size_t SEARCH_INDEX_RECENT_POSTINGS = 1 << 16;	// postings kept in memory before they are compacted into the index file
+
+
+#pragma pack(push, 1)
+	// One fixed size record per (term, message), the log of recent postings is a flat array of these.
+	struct Posting {
+		uint64_t termHash;
+		uint32_t sequence;
+	};
+
+
+	// Start of the compacted index file. A term table sorted by hash follows, then the sequences of every term, ascending.
+	struct SearchIndexHeader {
+		uint32_t magic;
+		uint32_t sequences;			// messages covered, the next sequence to index
+		uint64_t lastTimestamp;		// of message sequences - 1, tells a replaced message log apart
+		uint32_t termCount;
+		uint32_t postingCount;
+
+		SearchIndexHeader() : magic(0), sequences(0), lastTimestamp(0), termCount(0), postingCount(0) {}
+	};
+
+
+	struct TermEntry {
+		uint64_t termHash;
+		uint32_t first;		// index of the term's first sequence
+		uint32_t count;
+	};
+#pragma pack(pop)
+
+
+/**
+ * Inverted index over the local message history, built incrementally as messages are stored.
+ * Terms are kept as 64 bit hashes, matches are verified against the stored message text.
+ * Postings are compacted into a sorted file read in place through a mapping, only the postings
+ * of recent messages are held in memory, and logged, until the next compaction.
+ */
+class SearchIndex {
+public:
+	explicit SearchIndex(MessageStore&, const std::string& = SEARCH_INDEX_PATH);
+	virtual ~SearchIndex();
+	SearchIndex(const SearchIndex& other) = delete;
+	SearchIndex(SearchIndex&& other) noexcept = delete;
+	SearchIndex& operator=(const SearchIndex& other) = delete;
+	SearchIndex& operator=(SearchIndex&& other) noexcept = delete;
+
+	bool open();
+	bool add(uint32_t, const std::string&);
+	std::vector<StoredMessage> search(const std::string&, const ClientID* = nullptr, size_t = 20);
+
+	static std::vector<std::string> tokenize(const std::string&);
+
+private:
+	// The sequences of one term, the compacted ones in place in the mapping followed by the recent ones.
+	struct TermPostings {
+		const uint32_t* compacted;
+		size_t compactedCount;
+		const std::vector<uint32_t>* recent;
+
+		TermPostings() : compacted(nullptr), compactedCount(0), recent(nullptr) {}
+		size_t size() const { return compactedCount + (recent ? recent->size() : 0); }
+		uint32_t at(size_t i) const { return (i < compactedCount) ? compacted[i] : (*recent)[i - compactedCount]; }
+		bool contains(uint32_t) const;
+	};
+
+	static uint64_t hashTerm(const std::string&);
+	void insert(const Posting&);
+	bool matches(const StoredMessage&, const std::vector<std::string>&);
+	TermPostings find(uint64_t) const;
+	bool loadCompacted();
+	bool matchesStore();
+	bool loadRecent();
+	bool clear();
+	bool compact();
+	std::string recentPath() const { return m_path + ".log"; }
+
+	// marks a message as indexed even if it has no terms, written after its term postings
+	static constexpr uint64_t INDEXED_MARKER = 0;
+	static constexpr uint32_t INDEX_MAGIC = 0x31584449;	// "IDX1"
+
+	MessageStore& m_store;
+	const std::string m_path;
+	std::ofstream m_file;
+	MappedFile m_compacted;
+	SearchIndexHeader m_header;
+	const TermEntry* m_terms;
+	const uint32_t* m_sequences;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> m_recent;
+	size_t m_recentPostings;
+	uint32_t m_nextSequence;
+};
@@ -1,15 +1,27 @@
 #include "SocketHandler.h"
 #include <iostream>
 #include <boost/algorithm/string/trim.hpp>
+#include <thread>
+#include <sstream>
+#include <memory>
+#include <cctype>
 
 
 
-SocketHandler::SocketHandler() : m_io_context(nullptr), m_resolver(nullptr), m_sock(nullptr), m_isConnected(false), m_fileHandler(nullptr) {
+SocketHandler::SocketHandler() : m_io_context(nullptr), m_resolver(nullptr), m_sock(nullptr), m_isConnected(false), m_fileHandler(nullptr), m_stats(nullptr), m_tracer(nullptr), m_capture(nullptr), m_connection(0), m_requestCode(0), m_responseOpen(false), m_deadline(std::chrono::steady_clock::time_point::max()), m_rng(std::random_device{}()), m_endpoint(0), m_responseTime(0), m_probeDone(false), m_probeStop(false) {
     getServeInfo();
 }
 
 
+// Connects to the given endpoint instead of the one in server.info
+SocketHandler::SocketHandler(const std::string& address, const std::string& port) : m_io_context(nullptr), m_resolver(nullptr), m_sock(nullptr), m_isConnected(false), m_fileHandler(nullptr), m_stats(nullptr), m_tracer(nullptr), m_capture(nullptr), m_connection(0), m_requestCode(0), m_responseOpen(false), m_deadline(std::chrono::steady_clock::time_point::max()), m_rng(std::random_device{}()), m_endpoint(0), m_responseTime(0), m_probeDone(false), m_probeStop(false) {
+    setServer(address, port);
+}
+
+
 SocketHandler::~SocketHandler(){
+    m_probeStop = true;
+    if (m_prober.joinable()) m_prober.join();
     m_address.clear();
     m_port.clear();
     delete m_fileHandler;
@@ -19,15 +31,32 @@ SocketHandler::~SocketHandler(){
 
 bool SocketHandler::connect() {
     if (!isValidInfo(m_address, m_port)) return false;
+    TraceSpan span(m_tracer, "connect", m_requestCode);
 
     try {
         if (m_isConnected) closeSocket();
         m_io_context = new boost::asio::io_context;
         m_sock = new tcp::socket(*m_io_context);
         m_resolver = new tcp::resolver(*m_io_context);
-        boost::asio::connect(*m_sock, m_resolver->resolve(m_address, m_port));
-        m_sock->non_blocking(false);
+        tcp::resolver::results_type endpoints;
+        if (!resolve(endpoints)) {
+            closeSocket();
+            return false;
+        }
+
+        ScopedTimer timer(m_stats, m_requestCode, PHASE_CONNECT);
+        bool done = false;
+        boost::system::error_code error;
+        boost::asio::async_connect(*m_sock, endpoints, [&](const boost::system::error_code& ec, const tcp::endpoint&) {
+            error = ec;
+            done = true;
+        });
+        if (!await(done, remaining(m_policy.connectTimeout)) || error) {
+            closeSocket();
+            return false;
+        }
         m_isConnected = true;
+        if (m_capture != nullptr) m_connection = m_capture->newConnection();
     } catch(...) {
         closeSocket();
     }
@@ -38,24 +67,26 @@ bool SocketHandler::connect() {
 
 
 bool SocketHandler::write(const uint8_t* reqBuffer, const size_t size) {
-    if (reqBuffer == nullptr || size == 0) return false;
+    if (reqBuffer == nullptr || size == 0 || m_sock == nullptr) return false;
+    ScopedTimer timer(m_stats, m_requestCode, PHASE_WRITE);
 
     try {
-        boost::system::error_code error;
-        uint32_t bytesLeft = size;
-        uint32_t offset = 0;
-
-        while (bytesLeft > 0) {
-            uint8_t temp[PACKET_SIZE] = { 0 };
-            uint32_t toWrite = std::min(bytesLeft, PACKET_SIZE);
-            memcpy(temp, &reqBuffer[offset], toWrite);
-
-            if (checkBigEndian()) ReverseBytes(temp, PACKET_SIZE);
-
-            boost::asio::write(*m_sock, boost::asio::buffer(temp, PACKET_SIZE));
-            offset += PACKET_SIZE;
-            bytesLeft -= toWrite;
+        std::vector<uint8_t> packets;
+        packRequest(reqBuffer, size, packets);
+
+        for (size_t offset = 0; offset < packets.size(); offset += PACKET_SIZE) {
+            TraceSpan span(m_tracer, "write_chunk", m_requestCode);
+            bool done = false;
+            boost::system::error_code error;
+            boost::asio::async_write(*m_sock, boost::asio::buffer(&packets[offset], PACKET_SIZE), [&](const boost::system::error_code& ec, size_t) {
+                error = ec;
+                done = true;
+            });
+            if (!await(done, remaining(m_policy.ioTimeout)) || error) return false;
         }
+        // a request is captured once fully written, a failed write is left out like its missing response
+        if (m_capture != nullptr) m_capture->record(CAPTURE_REQUEST, m_connection, reqBuffer, size);
+        if (m_stats != nullptr) m_stats->addBytes(m_requestCode, packets.size(), 0);
         return true;
     } catch (const std::exception&) {
         return false;
@@ -66,28 +97,43 @@ bool SocketHandler::write(const uint8_t* reqBuffer, const size_t size) {
 
 
 bool SocketHandler::read(uint8_t* buffer, const size_t size) {
-    if (size == 0 || buffer == nullptr) return false;
+    ScopedTimer timer(m_stats, m_requestCode, PHASE_READ);
+    return receive(buffer, size);
+}
+
+
+
+bool SocketHandler::receive(uint8_t* buffer, const size_t size) {
+    if (size == 0 || buffer == nullptr || m_sock == nullptr) return false;
 
     size_t bytesLeft = size;
     uint8_t* ptr = buffer;
-    boost::system::error_code errorCode;
 
     try {
         while (bytesLeft > 0) {
+            TraceSpan span(m_tracer, "read_chunk", m_requestCode);
             uint8_t tempBuffer[PACKET_SIZE] = { 0 };
 
-            size_t bytesRead = boost::asio::read(*m_sock, boost::asio::buffer(tempBuffer, PACKET_SIZE), errorCode);
-            if (bytesRead == 0) {
-                std::cout << "1" << std::endl;
-                return false;
-            }
+            bool done = false;
+            size_t bytesRead = 0;
+            boost::system::error_code error;
+            boost::asio::async_read(*m_sock, boost::asio::buffer(tempBuffer, PACKET_SIZE), [&](const boost::system::error_code& ec, size_t n) {
+                error = ec;
+                bytesRead = n;
+                done = true;
+            });
+            if (!await(done, remaining(m_policy.ioTimeout)) || bytesRead == 0) return false;
+            // only the final block may come short, when the server closed right after it
+            if (error && error != boost::asio::error::eof) return false;
             // It's required to convert from little endian to big endian.
             if (checkBigEndian()) ReverseBytes(tempBuffer, bytesRead);
+            if (m_capture != nullptr) m_capture->record(CAPTURE_RESPONSE, m_connection, tempBuffer, bytesRead);
         
             const size_t bytesToCopy = (bytesLeft > bytesRead) ? bytesRead : bytesLeft;  // prevent buffer overflow.
             memcpy(ptr, tempBuffer, bytesToCopy);
             ptr += bytesToCopy;
             bytesLeft = (bytesLeft < bytesToCopy) ? 0 : (bytesLeft - bytesToCopy);   // unsigned protection.
+            if (m_stats != nullptr) m_stats->addBytes(m_requestCode, 0, bytesRead);
         }
         return true;
     }
@@ -98,6 +144,62 @@ bool SocketHandler::read(uint8_t* buffer, const size_t size) {
 
 
 
+bool SocketHandler::resolve(tcp::resolver::results_type& endpoints) {
+    ScopedTimer timer(m_stats, m_requestCode, PHASE_RESOLVE);
+    boost::system::error_code error;
+    endpoints = m_resolver->resolve(m_address, m_port, error);
+    return !error && !endpoints.empty();
+}
+
+
+
+/**
+ * Runs the io_context until the operation sets 'done' or the timeout expires.
+ * On a timeout the socket is closed, which aborts the operation, and its handler is drained
+ * so nothing refers to the caller's stack afterwards.
+ */
+bool SocketHandler::await(const bool& done, std::chrono::steady_clock::duration timeout) {
+    const auto until = std::chrono::steady_clock::now() + timeout;
+    m_io_context->restart();
+    while (!done && m_io_context->run_one_until(until) > 0) {}
+    if (done) return true;
+
+    if (m_stats != nullptr) m_stats->addEvent(m_requestCode, EVENT_TIMEOUT);
+    boost::system::error_code ignored;
+    m_sock->close(ignored);
+    m_io_context->restart();
+    m_io_context->run();
+    return false;
+}
+
+
+// The timeout of the next operation, cut short by the request deadline.
+std::chrono::steady_clock::duration SocketHandler::remaining(std::chrono::milliseconds timeout) const {
+    const auto now = std::chrono::steady_clock::now();
+    if (m_deadline == std::chrono::steady_clock::time_point::max()) return timeout;
+    return std::min<std::chrono::steady_clock::duration>(timeout, m_deadline > now ? m_deadline - now : std::chrono::steady_clock::duration::zero());
+}
+
+
+// Full jitter: a uniform pause up to the exponential backoff, so retrying clients don't synchronize.
+std::chrono::milliseconds SocketHandler::backoff(size_t attempt) {
+    const auto ceiling = std::min<std::chrono::milliseconds>(m_policy.backoffMax, m_policy.backoffBase * (1ll << std::min<size_t>(attempt, 16)));
+    std::uniform_int_distribution<long long> pause(0, ceiling.count());
+    return std::chrono::milliseconds(pause(m_rng));
+}
+
+
+// Pads the request to whole PACKET_SIZE blocks, in the server's byte order.
+void SocketHandler::packRequest(const uint8_t* reqBuffer, const size_t size, std::vector<uint8_t>& packets) {
+    packets.assign(((size + PACKET_SIZE - 1) / PACKET_SIZE) * PACKET_SIZE, 0);
+    memcpy(packets.data(), reqBuffer, size);
+    if (checkBigEndian()) {
+        for (size_t offset = 0; offset < packets.size(); offset += PACKET_SIZE) ReverseBytes(&packets[offset], PACKET_SIZE);
+    }
+}
+
+
+
 
 void SocketHandler::swapBytes(uint8_t* const buffer, size_t size) const
 {
@@ -119,91 +221,434 @@ void SocketHandler::swapBytes(uint8_t* const buffer, size_t size) const
 
 
 
+/**
+ * server.info lists one server per line as 'address:port' ('[address]:port' for IPv6),
+ * a 'mode=shard' line makes the servers shards that own the clients by ID.
+ */
 bool SocketHandler::getServeInfo() {
     if (!m_fileHandler) m_fileHandler = new FileHandler;
 
 
     std::string info;
-    if (!m_fileHandler->readLine(SERVER_INFO_PATH, info, true)) {
+    if (!m_fileHandler->readFile(SERVER_INFO_PATH, info)) {
         std::cout << "Error while trying to read '" << SERVER_INFO_PATH << std::endl;
         return false;
     }
 
-    boost::algorithm::trim(info);
+    m_endpoints.clear();
+    m_endpoints.setSharded(false);
+    std::istringstream lines(info);
+    std::string line;
+    while (std::getline(lines, line)) {
+        boost::algorithm::trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        if (line == SHARD_MODE_LINE) {
+            m_endpoints.setSharded(true);
+            continue;
+        }
 
-    const auto pos = info.find(':');
-    if (pos == std::string::npos) {
-        std::cout << "Error in file '" << SERVER_INFO_PATH << "' invalid format, missing separator ':'";
+        std::string address, port;
+        if (!parseEndpoint(line, address, port)) {
+            std::cout << "Error in file '" << SERVER_INFO_PATH << "' invalid format, missing separator ':'";
+            return false;
+        }
+        if (!isValidInfo(address, port)) {
+            std::cout << "Invalid IP address or port, can not connect to server!";
+            return false;
+        }
+        m_endpoints.add(address, port);
+    }
+
+    if (m_endpoints.size() == 0) {
+        std::cout << "Error in file '" << SERVER_INFO_PATH << "' no server listed";
         return false;
     }
-    const auto address = info.substr(0, pos);
-    const auto port = info.substr(pos + 1);
+    useEndpoint(0);
+    return true;
+}
+
 
+bool SocketHandler::setServer(const std::string& address, const std::string& port) {
     if (!isValidInfo(address, port)) {
         std::cout << "Invalid IP address or port, can not connect to server!";
         return false;
     }
 
-    m_address = address;
-    m_port = port;
+    if (m_isConnected) closeSocket();
+    m_endpoints.clear();
+    m_endpoints.setSharded(false);
+    m_endpoints.add(address, port);
+    useEndpoint(0);
+    return true;
+}
+
+
+void SocketHandler::useEndpoint(size_t i) {
+    m_endpoint = i;
+    m_address = m_endpoints[i].address;
+    m_port = m_endpoints[i].port;
+}
+
+
+bool SocketHandler::parseEndpoint(const std::string& line, std::string& address, std::string& port) {
+    const auto pos = line.rfind(':');
+    if (pos == std::string::npos) return false;
+    address = line.substr(0, pos);
+    port = line.substr(pos + 1);
+    if (address.size() >= 2 && address.front() == '[' && address.back() == ']') address = address.substr(1, address.size() - 2);
     return true;
 }
 
 
 bool SocketHandler::isValidInfo(const std::string& address, const std::string& port) {
 
-    // check valid address
-    if ((address != "localhost") && (address != "LOCALHOST")) {
-        try {
-            (void)boost::asio::ip::address_v4::from_string(address);
-        } catch (...) {
-            return false;
+    // check valid address, an IPv4 or IPv6 literal or a host name
+    boost::system::error_code error;
+    (void)boost::asio::ip::make_address(address, error);
+    if (error) {
+        if (address.empty() || address.size() > 253 || address.front() == '-' || address.front() == '.') return false;
+        for (const char c : address) {
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.') return false;
         }
     }
   
    // check valid port
     try {
         const int p = std::stoi(port);
-        return (p != 0);  // port 0 is invalid..
+        return (p > 0 && p <= 65535);  // port 0 is invalid..
     } catch (...) {
         return false;
     }
 }
 
 
-bool SocketHandler::socketWrapper(const uint8_t* reqBuffer, const size_t reqSize, uint8_t* const respBuffer, const size_t resSize, bool close) {
+/**
+ * Starts a probe round on its own thread, the request that found it due doesn't wait for it.
+ */
+void SocketHandler::startProbe() {
+    m_endpoints.probeStarted();
+    m_probeTargets.clear();
+    for (size_t i = 0; i < m_endpoints.size(); ++i) m_probeTargets.emplace_back(m_endpoints[i].address, m_endpoints[i].port);
+    m_probeReachable.assign(m_probeTargets.size(), false);
+    m_probeDone = false;
+    try {
+        m_prober = std::thread(&SocketHandler::probeEndpoints, this, m_policy.connectTimeout);
+    } catch (...) {
+        /**/
+    }
+}
+
+
+// Hands the results of a finished round to the selector, unless the endpoints were replaced meanwhile.
+void SocketHandler::collectProbe() {
+    if (!m_prober.joinable() || !m_probeDone.load(std::memory_order_acquire)) return;
+    m_prober.join();
+
+    if (m_probeTargets.size() != m_endpoints.size()) return;
+    for (size_t i = 0; i < m_probeTargets.size(); ++i) {
+        if (m_probeTargets[i].first != m_endpoints[i].address || m_probeTargets[i].second != m_endpoints[i].port) return;
+    }
+    m_endpoints.probed(m_probeReachable);
+}
+
+
+/**
+ * Opens a TCP connection to every endpoint at once, the servers see a connection without a request.
+ * Runs on the prober thread and only touches the probe members.
+ */
+void SocketHandler::probeEndpoints(std::chrono::milliseconds timeout) {
+    try {
+        boost::asio::io_context ioContext;
+        tcp::resolver resolver(ioContext);
+        std::vector<std::unique_ptr<tcp::socket>> sockets;
+        size_t pending = 0;
+
+        for (size_t i = 0; i < m_probeTargets.size(); ++i) {
+            sockets.push_back(std::make_unique<tcp::socket>(ioContext));
+            boost::system::error_code error;
+            const auto endpoints = resolver.resolve(m_probeTargets[i].first, m_probeTargets[i].second, error);
+            if (error) continue;
+            ++pending;
+            boost::asio::async_connect(*sockets[i], endpoints, [this, i, &pending](const boost::system::error_code& ec, const tcp::endpoint&) {
+                --pending;
+                m_probeReachable[i] = !ec;
+            });
+        }
+
+        // in slices, so closing the handler doesn't wait out the connect timeout
+        const auto until = std::chrono::steady_clock::now() + timeout;
+        while (pending > 0 && !m_probeStop && std::chrono::steady_clock::now() < until) ioContext.run_for(std::chrono::milliseconds(100));
+        for (auto& socket : sockets) {
+            boost::system::error_code ignored;
+            socket->close(ignored);
+        }
+        ioContext.restart();
+        ioContext.run();
+    } catch (...) {
+        /**/
+    }
+    m_probeDone.store(true, std::memory_order_release);
+}
+
+
+/**
+ * Requests that only read server state can be repeated after any failure. GET_UNREAD_MESSAGES
+ * deletes what it returns, but a repeat can't lose more than the failed attempt already did.
+ */
+bool SocketHandler::isIdempotent(uint16_t code) {
+    return code == GET_CLIENTS_LIST || code == GET_PUBLIC_KEY || code == GET_UNREAD_MESSAGES;
+}
+
+
+// Two racing GET_UNREAD_MESSAGES would split the pending messages, so it is never hedged.
+bool SocketHandler::canHedge(uint16_t code) {
+    return code == GET_CLIENTS_LIST || code == GET_PUBLIC_KEY;
+}
+
+
+/**
+ * One attempt of the request, 'sent' tells whether the server may have seen it.
+ */
+bool SocketHandler::exchange(const uint8_t* reqBuffer, const size_t reqSize, uint8_t* const respBuffer, const size_t resSize, bool& sent) {
+    const auto start = std::chrono::steady_clock::now();
     if (!connect()) {
         return false;
     }
+    sent = true;
     if (!write(reqBuffer, reqSize)){
         closeSocket();
         return false;
     }
-    if (!read(respBuffer, resSize)){
+
+    bool received = false;
+    {
+        ScopedTimer waitTimer(m_stats, m_requestCode, PHASE_WAIT);
+        received = receive(respBuffer, resSize);
+    }
+    if (!received){
         closeSocket();
         return false;
     }
+    m_responseTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+
+namespace {
+    // One of the racing connections of a hedged request.
+    struct HedgeLeg {
+        explicit HedgeLeg(boost::asio::io_context& ioContext) : socket(ioContext) {}
+        tcp::socket socket;
+        uint8_t block[PACKET_SIZE] = { 0 };
+        size_t bytesRead = 0;
+        bool started = false;
+        bool done = false;
+        std::chrono::steady_clock::time_point startedAt;
+        std::chrono::steady_clock::time_point doneAt;
+
+        void start(const tcp::resolver::results_type& endpoints, const std::vector<uint8_t>& request) {
+            started = true;
+            startedAt = std::chrono::steady_clock::now();
+            boost::asio::async_connect(socket, endpoints, [this, &request](const boost::system::error_code& error, const tcp::endpoint&) {
+                if (error) {
+                    done = true;
+                    return;
+                }
+                boost::asio::async_write(socket, boost::asio::buffer(request), [this](const boost::system::error_code& error, size_t) {
+                    if (error) {
+                        done = true;
+                        return;
+                    }
+                    boost::asio::async_read(socket, boost::asio::buffer(block, PACKET_SIZE), [this](const boost::system::error_code& error, size_t n) {
+                        bytesRead = (!error || error == boost::asio::error::eof) ? n : 0;
+                        doneAt = std::chrono::steady_clock::now();
+                        done = true;
+                    });
+                });
+            });
+        }
+
+        bool won() const { return done && bytesRead > 0; }
+    };
+}
+
+
+/**
+ * Like exchange(), but when the first response block is later than the hedge delay the same
+ * request is sent again on a second connection, to the 'alternate' endpoint. The first block to
+ * arrive wins, the other connection is dropped. Only the first block is raced, the rest is read
+ * from the winner.
+ */
+bool SocketHandler::hedgedExchange(const uint8_t* reqBuffer, const size_t reqSize, uint8_t* const respBuffer, const size_t resSize, size_t alternate, bool& sent) {
+    if (!isValidInfo(m_address, m_port) || reqBuffer == nullptr || reqSize == 0 || respBuffer == nullptr || resSize == 0) return false;
+    if (m_isConnected) closeSocket();
+
+    try {
+        m_io_context = new boost::asio::io_context;
+        m_resolver = new tcp::resolver(*m_io_context);
+        tcp::resolver::results_type endpoints, alternateEndpoints;
+        if (!resolve(endpoints)) {
+            closeSocket();
+            return false;
+        }
+        if (alternate == m_endpoint || alternate >= m_endpoints.size()) alternateEndpoints = endpoints;
+        else {
+            boost::system::error_code error;
+            alternateEndpoints = m_resolver->resolve(m_endpoints[alternate].address, m_endpoints[alternate].port, error);
+            if (error) alternateEndpoints = endpoints;
+        }
+
+        std::vector<uint8_t> request;
+        packRequest(reqBuffer, reqSize, request);
+        HedgeLeg primary(*m_io_context), hedge(*m_io_context);
+        HedgeLeg* winner = nullptr;
+
+        {
+            ScopedTimer waitTimer(m_stats, m_requestCode, PHASE_WAIT);
+            const auto now = std::chrono::steady_clock::now();
+            const auto until = now + remaining(m_policy.connectTimeout + m_policy.ioTimeout);
+            const auto hedgeAt = now + m_policy.hedgeDelay;
+            primary.start(endpoints, request);
+            sent = true;
+
+            while (winner == nullptr) {
+                if (primary.won()) winner = &primary;
+                else if (hedge.won()) winner = &hedge;
+                else if (primary.done && (!hedge.started || hedge.done)) break;
+                else if (!hedge.started && std::chrono::steady_clock::now() >= hedgeAt) {
+                    TraceSpan span(m_tracer, "hedge", m_requestCode);
+                    if (m_stats != nullptr) m_stats->addEvent(m_requestCode, EVENT_HEDGE);
+                    hedge.start(alternateEndpoints, request);
+                    m_io_context->restart();
+                }
+                else if (std::chrono::steady_clock::now() >= until) {
+                    if (m_stats != nullptr) m_stats->addEvent(m_requestCode, EVENT_TIMEOUT);
+                    break;
+                }
+                else m_io_context->run_one_until(hedge.started ? until : std::min(until, hedgeAt));
+            }
+        }
+
+        // drop the loser, its aborted handlers must run before the legs go out of scope
+        boost::system::error_code ignored;
+        if (winner != &primary) primary.socket.close(ignored);
+        if (winner != &hedge) hedge.socket.close(ignored);
+        m_io_context->restart();
+        m_io_context->run();
+        if (winner == nullptr) {
+            closeSocket();
+            return false;
+        }
 
-    if(close) closeSocket();
+        if (winner == &hedge) {
+            if (m_stats != nullptr) m_stats->addEvent(m_requestCode, EVENT_HEDGE_WIN);
+            if (alternate < m_endpoints.size()) useEndpoint(alternate);
+        }
+        m_responseTime = std::chrono::duration_cast<std::chrono::nanoseconds>(winner->doneAt - winner->startedAt).count();
+        m_sock = new tcp::socket(std::move(winner->socket));
+        m_isConnected = true;
+        if (m_stats != nullptr) m_stats->addBytes(m_requestCode, request.size(), winner->bytesRead);
+
+        if (checkBigEndian()) ReverseBytes(winner->block, winner->bytesRead);
+        if (m_capture != nullptr) {
+            m_connection = m_capture->newConnection();
+            m_capture->record(CAPTURE_REQUEST, m_connection, reqBuffer, reqSize);
+            m_capture->record(CAPTURE_RESPONSE, m_connection, winner->block, winner->bytesRead);
+        }
+
+        const size_t copied = std::min(resSize, winner->bytesRead);
+        memcpy(respBuffer, winner->block, copied);
+        if (copied < resSize && !receive(respBuffer + copied, resSize - copied)) {
+            closeSocket();
+            return false;
+        }
+        return true;
+    } catch (...) {
+        closeSocket();
+        return false;
+    }
+}
+
+
+bool SocketHandler::socketWrapper(const uint8_t* reqBuffer, const size_t reqSize, uint8_t* const respBuffer, const size_t resSize, bool close) {
+    RequestHeader header(0);
+    if (reqBuffer != nullptr && reqSize >= sizeof(header)) memcpy(&header, reqBuffer, sizeof(header));
+    m_requestCode = header.code;
+    m_requestStart = std::chrono::steady_clock::now();
+    m_responseOpen = false;     // a response its caller never closed is not counted
+    m_deadline = std::chrono::steady_clock::now() + m_policy.deadline;
+
+    if (m_endpoints.size() == 0) {
+        endRequest();
+        return false;
+    }
+    collectProbe();
+    if (!m_prober.joinable() && m_endpoints.probeDue()) startProbe();
+
+    bool success = false;
+    const bool hedged = canHedge(m_requestCode) && m_policy.hedgeDelay.count() > 0;
+    size_t failed = EndpointSelector::NONE;
+    for (size_t attempt = 0; ; ++attempt) {
+        bool sent = false;
+        useEndpoint(m_endpoints.select(header.clientId, failed));
+        if (hedged) success = hedgedExchange(reqBuffer, reqSize, respBuffer, resSize, m_endpoints.sharded() ? m_endpoint : m_endpoints.select(header.clientId, m_endpoint), sent);
+        else success = exchange(reqBuffer, reqSize, respBuffer, resSize, sent);
+
+        if (success) {
+            m_endpoints.success(m_endpoint, m_responseTime);
+            break;
+        }
+        m_endpoints.failure(m_endpoint);
+        failed = m_endpoint;
+        if (attempt >= m_policy.maxRetries) break;
+
+        // a request the server may have executed is only repeated when that is harmless
+        if (sent && !isIdempotent(m_requestCode)) break;
+        const auto pause = backoff(attempt);
+        if (std::chrono::steady_clock::now() + pause >= m_deadline) break;
+        if (m_stats != nullptr) m_stats->addEvent(m_requestCode, EVENT_RETRY);
+        std::this_thread::sleep_for(pause);
+    }
+
+    // reads of the rest of the payload are only bounded per block
+    m_deadline = std::chrono::steady_clock::time_point::max();
+    if (!success || close) {
+        if (close) closeSocket();
+        endRequest();
+        return success;
+    }
+    m_responseOpen = true;
     return true;
 }
 
 
 
+// Records the whole round trip, from the request to the last response block read.
+void SocketHandler::endRequest() {
+    m_responseOpen = false;
+    if (m_stats != nullptr && m_stats->enabled()) {
+        m_stats->record(m_requestCode, PHASE_TOTAL, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_requestStart).count());
+    }
+}
+
+
+
 
 void SocketHandler::closeSocket() {
+    if (m_responseOpen) endRequest();
     try {
         if (m_sock != nullptr) m_sock->close();
     } catch (...) {
        /**/
     }
 
-    delete m_io_context;
-    m_io_context = nullptr;
-    delete m_resolver;
-    m_resolver = nullptr;
+    // the socket and resolver must go before the io_context they were created with
     delete m_sock;
     m_sock = nullptr;
+    delete m_resolver;
+    m_resolver = nullptr;
+    delete m_io_context;
+    m_io_context = nullptr;
     m_isConnected = false;
 }
 
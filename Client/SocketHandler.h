@@ -1,7 +1,16 @@
 #pragma once
 #include <boost/asio.hpp>
 #include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
 #include "FileHandler.h"
+#include "Protocol.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "Capture.h"
+#include "Endpoints.h"
 
 
 using boost::asio::ip::tcp;
@@ -10,9 +19,26 @@ constexpr size_t PACKET_SIZE = 1024;
 constexpr auto SERVER_INFO_PATH = "server.info";
 
 
+/**
+ * Time limits of a request and how it recovers from a slow or failed server.
+ * The deadline covers connect, write and the first response block of all the attempts,
+ * the rest of a long payload is only bounded per block by ioTimeout.
+ */
+struct RequestPolicy {
+	std::chrono::milliseconds connectTimeout{ 3000 };
+	std::chrono::milliseconds ioTimeout{ 5000 };		// per PACKET_SIZE block written or read
+	std::chrono::milliseconds deadline{ 15000 };
+	size_t maxRetries = 2;
+	std::chrono::milliseconds backoffBase{ 50 };		// doubled every retry, the pause is uniform in [0, backoff]
+	std::chrono::milliseconds backoffMax{ 1000 };
+	std::chrono::milliseconds hedgeDelay{ 250 };		// zero disables hedged requests
+};
+
+
 class SocketHandler {
 public:
 	SocketHandler();
+	SocketHandler(const std::string&, const std::string&);
 	~SocketHandler();
 
 	bool socketWrapper(const uint8_t*, const size_t, uint8_t* const, const size_t, bool=true);
@@ -22,8 +48,31 @@ public:
 	void closeSocket();
 	bool isConnected() { return m_isConnected; }
 	bool getServeInfo();
+	bool setServer(const std::string&, const std::string&);
 	void swapBytes(uint8_t* const buffer, size_t size) const;
+	void setStats(Stats* stats) { m_stats = stats; }
+	void setTracer(Tracer* tracer) { m_tracer = tracer; }
+	void setCapture(CaptureWriter* capture) { m_capture = capture; }
+	void setPolicy(const RequestPolicy& policy) { m_policy = policy; }
+	const RequestPolicy& policy() const { return m_policy; }
+	const EndpointSelector& endpoints() const { return m_endpoints; }
 private:
+	bool exchange(const uint8_t*, const size_t, uint8_t* const, const size_t, bool&);
+	bool hedgedExchange(const uint8_t*, const size_t, uint8_t* const, const size_t, size_t, bool&);
+	void useEndpoint(size_t);
+	void startProbe();
+	void collectProbe();
+	void probeEndpoints(std::chrono::milliseconds);
+	void endRequest();
+	bool parseEndpoint(const std::string&, std::string&, std::string&);
+	bool receive(uint8_t*, const size_t);
+	bool resolve(tcp::resolver::results_type&);
+	bool await(const bool&, std::chrono::steady_clock::duration);
+	std::chrono::steady_clock::duration remaining(std::chrono::milliseconds) const;
+	std::chrono::milliseconds backoff(size_t);
+	void packRequest(const uint8_t*, const size_t, std::vector<uint8_t>&);
+	static bool isIdempotent(uint16_t);
+	static bool canHedge(uint16_t);
 	bool checkBigEndian();
 	void ReverseBytes(uint8_t*, size_t);
 	bool isValidInfo(const std::string&, const std::string&);
@@ -34,4 +83,22 @@ private:
 	tcp::socket* m_sock;
 	tcp::resolver* m_resolver;
 	bool m_isConnected;
+	Stats* m_stats;
+	Tracer* m_tracer;
+	CaptureWriter* m_capture;
+	uint32_t m_connection;		// capture connection number
+	uint16_t m_requestCode;	// of the request in flight, for the stats
+	std::chrono::steady_clock::time_point m_requestStart;
+	bool m_responseOpen;		// the caller still reads the response, its total ends with closeSocket
+	RequestPolicy m_policy;
+	std::chrono::steady_clock::time_point m_deadline;
+	std::minstd_rand m_rng;		// backoff jitter
+	EndpointSelector m_endpoints;
+	size_t m_endpoint;			// index of m_address:m_port in m_endpoints
+	uint64_t m_responseTime;	// of the last attempt until its first response block, in nanoseconds
+	std::thread m_prober;		// one probe round at a time, off the request path
+	std::vector<std::pair<std::string, std::string>> m_probeTargets;	// read only while the prober runs
+	std::vector<bool> m_probeReachable;		// written by the prober until it sets m_probeDone
+	std::atomic<bool> m_probeDone;
+	std::atomic<bool> m_probeStop;
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "SocketPool.h"
+#include <algorithm>
+
+
+
+// Without an address the handlers read server.info.
+SocketPool::SocketPool(const size_t size, const std::string& address, const std::string& port) {
+	const size_t count = std::max<size_t>(size, 1);
+	for (size_t i = 0; i < count; ++i) {
+		m_handlers.push_back(address.empty() ? new SocketHandler : new SocketHandler(address, port));
+	}
+	m_free = m_handlers;
+}
+
+
+SocketPool::~SocketPool() {
+	for (auto handler : m_handlers) delete handler;
+}
+
+
+
+/**
+ * Waits until a handler is free.
+ */
+SocketPool::Lease SocketPool::acquire() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_released.wait(lock, [this] { return !m_free.empty(); });
+	SocketHandler* handler = m_free.back();
+	m_free.pop_back();
+	return Lease(*this, handler);
+}
+
+
+void SocketPool::release(SocketHandler* handler) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.push_back(handler);
+	}
+	m_released.notify_one();
+}
+
+
+
+/**
+ * Applies a setting to every handler, waiting for each to be returned first.
+ */
+bool SocketPool::forEach(const std::function<bool(SocketHandler&)>& apply) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_released.wait(lock, [this] { return m_free.size() == m_handlers.size(); });
+
+	bool success = true;
+	for (auto handler : m_handlers) success = apply(*handler) && success;
+	return success;
+}
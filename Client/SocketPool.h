@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include "SocketHandler.h"
+
+
+
+/**
+ * SocketHandlers shared by many identities. The server closes the connection after every response,
+ * so the pool bounds the connections open at once and keeps each handler's io_context and endpoint
+ * health instead of rebuilding them per request.
+ */
+class SocketPool {
+public:
+	// A handler borrowed from the pool, given back when the lease goes out of scope.
+	class Lease {
+	public:
+		Lease(SocketPool& pool, SocketHandler* handler) : m_pool(pool), m_handler(handler) {}
+		~Lease() { m_pool.release(m_handler); }
+		Lease(const Lease& other) = delete;
+		Lease& operator=(const Lease& other) = delete;
+
+		SocketHandler* operator->() const { return m_handler; }
+		SocketHandler& operator*() const { return *m_handler; }
+
+	private:
+		SocketPool& m_pool;
+		SocketHandler* const m_handler;
+	};
+
+	explicit SocketPool(const size_t size, const std::string& address = "", const std::string& port = "");
+	virtual ~SocketPool();
+	SocketPool(const SocketPool& other) = delete;
+	SocketPool(SocketPool&& other) noexcept = delete;
+	SocketPool& operator=(const SocketPool& other) = delete;
+	SocketPool& operator=(SocketPool&& other) noexcept = delete;
+
+	Lease acquire();
+	bool forEach(const std::function<bool(SocketHandler&)>&);
+	size_t size() const { return m_handlers.size(); }
+
+private:
+	void release(SocketHandler*);
+
+	std::vector<SocketHandler*> m_handlers;
+	std::vector<SocketHandler*> m_free;
+	std::mutex m_mutex;
+	std::condition_variable m_released;
+};
@@ -0,0 +1,145 @@
+#include "Stats.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+
+
+void LatencyHistogram::add(uint64_t value) {
+	++m_buckets[bucketOf(value)];
+	++m_count;
+	m_sum += value;
+	if (value > m_max) m_max = value;
+}
+
+
+uint64_t LatencyHistogram::percentile(double p) const {
+	if (m_count == 0) return 0;
+
+	const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * m_count + 0.5));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+		seen += m_buckets[i];
+		if (seen >= rank) return std::min(bucketMiddle(i), m_max);
+	}
+	return m_max;
+}
+
+
+
+/**
+ * Values below 2^SUB_BUCKET_BITS get a bucket each, above that every power of two
+ * is split into 2^SUB_BUCKET_BITS linear buckets.
+ */
+size_t LatencyHistogram::bucketOf(uint64_t value) {
+	constexpr uint64_t subBuckets = 1ull << SUB_BUCKET_BITS;
+	if (value < subBuckets) return static_cast<size_t>(value);
+
+	size_t msb = 63;
+	while (!(value >> msb)) --msb;
+	const size_t shift = msb - SUB_BUCKET_BITS;
+	const size_t sub = static_cast<size_t>((value >> shift) & (subBuckets - 1));
+	return ((shift + 1) << SUB_BUCKET_BITS) + sub;
+}
+
+
+uint64_t LatencyHistogram::bucketMiddle(size_t bucket) {
+	constexpr uint64_t subBuckets = 1ull << SUB_BUCKET_BITS;
+	if (bucket < subBuckets) return bucket;
+
+	const size_t shift = (bucket >> SUB_BUCKET_BITS) - 1;
+	const uint64_t low = (subBuckets + (bucket & (subBuckets - 1))) << shift;
+	return low + ((1ull << shift) >> 1);
+}
+
+
+
+void Stats::record(uint16_t code, StatPhase phase, uint64_t ns) {
+	if (!m_enabled || phase >= PHASE_COUNT) return;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_requests[code].phases[phase].add(ns);
+}
+
+
+void Stats::addBytes(uint16_t code, uint64_t sent, uint64_t received) {
+	if (!m_enabled) return;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	RequestStats& stats = m_requests[code];
+	stats.bytesSent += sent;
+	stats.bytesReceived += received;
+}
+
+
+void Stats::addEvent(uint16_t code, StatEvent event) {
+	if (!m_enabled || event >= EVENT_COUNT) return;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_requests[code].events[event];
+}
+
+
+void Stats::reset() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_requests.clear();
+}
+
+
+
+std::string Stats::report() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(3);
+
+	for (const auto& [code, stats] : m_requests) {
+		out << "Request " << code << " (sent " << stats.bytesSent << " bytes, received " << stats.bytesReceived << " bytes)\n";
+		if (stats.events[EVENT_TIMEOUT] || stats.events[EVENT_RETRY] || stats.events[EVENT_HEDGE]) {
+			out << "\t" << stats.events[EVENT_TIMEOUT] << " timeouts, " << stats.events[EVENT_RETRY] << " retries, "
+				<< stats.events[EVENT_HEDGE] << " hedged (" << stats.events[EVENT_HEDGE_WIN] << " won)\n";
+		}
+		out << "\t" << std::left << std::setw(10) << "phase" << std::right << std::setw(8) << "count"
+			<< std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << std::setw(12) << "max ms" << "\n";
+
+		for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+			const LatencyHistogram& histogram = stats.phases[phase];
+			if (histogram.count() == 0) continue;
+			out << "\t" << std::left << std::setw(10) << phaseName(static_cast<StatPhase>(phase)) << std::right << std::setw(8) << histogram.count()
+				<< std::setw(12) << histogram.mean() / 1e6 << std::setw(12) << histogram.percentile(0.50) / 1e6
+				<< std::setw(12) << histogram.percentile(0.99) / 1e6 << std::setw(12) << histogram.max() / 1e6 << "\n";
+		}
+	}
+	return out.str();
+}
+
+
+std::string Stats::csv() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::ostringstream out;
+	out << "code,phase,count,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,bytes_sent,bytes_received,timeouts,retries,hedges,hedge_wins\n";
+
+	for (const auto& [code, stats] : m_requests) {
+		for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+			const LatencyHistogram& histogram = stats.phases[phase];
+			if (histogram.count() == 0) continue;
+			out << code << "," << phaseName(static_cast<StatPhase>(phase)) << "," << histogram.count() << ","
+				<< static_cast<uint64_t>(histogram.mean()) << "," << histogram.percentile(0.50) << "," << histogram.percentile(0.99) << ","
+				<< histogram.percentile(0.999) << "," << histogram.max() << "," << stats.bytesSent << "," << stats.bytesReceived << ","
+				<< stats.events[EVENT_TIMEOUT] << "," << stats.events[EVENT_RETRY] << "," << stats.events[EVENT_HEDGE] << "," << stats.events[EVENT_HEDGE_WIN] << "\n";
+		}
+	}
+	return out.str();
+}
+
+
+
+const char* Stats::phaseName(StatPhase phase) {
+	switch (phase) {
+	case PHASE_RESOLVE: return "resolve";
+	case PHASE_CONNECT: return "connect";
+	case PHASE_WRITE: return "write";
+	case PHASE_WAIT: return "wait";
+	case PHASE_READ: return "read";
+	case PHASE_PARSE: return "parse";
+	case PHASE_CRYPTO: return "crypto";
+	case PHASE_TOTAL: return "total";
+	default: return "unknown";
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+
+
+constexpr auto STATS_DUMP_PATH = "client_stats.csv";
+
+
+// Where the time of a request goes, recorded per request code.
+enum StatPhase {
+	PHASE_RESOLVE = 0,
+	PHASE_CONNECT,
+	PHASE_WRITE,
+	PHASE_WAIT,		// request written until the first response block is read
+	PHASE_READ,		// the rest of the response payload
+	PHASE_PARSE,
+	PHASE_CRYPTO,
+	PHASE_TOTAL,	// the whole socket round trip
+	PHASE_COUNT
+};
+
+
+// How often the socket layer had to work around a slow or failed request.
+enum StatEvent {
+	EVENT_TIMEOUT = 0,
+	EVENT_RETRY,
+	EVENT_HEDGE,		// a second request was raced against a slow one
+	EVENT_HEDGE_WIN,	// and answered first
+	EVENT_COUNT
+};
+
+
+/**
+ * Log-linear latency histogram, 8 buckets per power of two nanoseconds (about 12% precision).
+ */
+class LatencyHistogram {
+public:
+	LatencyHistogram() : m_buckets{ 0 }, m_count(0), m_sum(0), m_max(0) {}
+
+	void add(uint64_t);
+	uint64_t count() const { return m_count; }
+	uint64_t max() const { return m_max; }
+	double mean() const { return m_count ? static_cast<double>(m_sum) / m_count : 0; }
+	uint64_t percentile(double) const;
+
+private:
+	static constexpr size_t SUB_BUCKET_BITS = 3;
+	static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+	static size_t bucketOf(uint64_t);
+	static uint64_t bucketMiddle(size_t);
+
+	uint32_t m_buckets[BUCKET_COUNT];
+	uint64_t m_count;
+	uint64_t m_sum;
+	uint64_t m_max;
+};
+
+
+/**
+ * Timing and byte counters of the client's requests. Disabled stats cost one branch per probe.
+ */
+class Stats {
+public:
+	Stats() : m_enabled(false) {}
+	virtual ~Stats() = default;
+	Stats(const Stats& other) = delete;
+	Stats(Stats&& other) noexcept = delete;
+	Stats& operator=(const Stats& other) = delete;
+	Stats& operator=(Stats&& other) noexcept = delete;
+
+	void setEnabled(bool enabled) { m_enabled = enabled; }
+	bool enabled() const { return m_enabled; }
+	void record(uint16_t, StatPhase, uint64_t);
+	void addBytes(uint16_t, uint64_t, uint64_t);
+	void addEvent(uint16_t, StatEvent);
+	void reset();
+	std::string report();
+	std::string csv();
+
+	static const char* phaseName(StatPhase);
+
+private:
+	struct RequestStats {
+		LatencyHistogram phases[PHASE_COUNT];
+		uint64_t bytesSent = 0;
+		uint64_t bytesReceived = 0;
+		uint64_t events[EVENT_COUNT] = { 0 };
+	};
+
+	bool m_enabled;
+	std::mutex m_mutex;
+	std::map<uint16_t, RequestStats> m_requests;
+};
+
+
+/**
+ * Records the lifetime of the scope, the clock is not read when the stats are disabled.
+ */
+class ScopedTimer {
+public:
+	ScopedTimer(Stats* stats, uint16_t code, StatPhase phase) : m_stats((stats != nullptr && stats->enabled()) ? stats : nullptr), m_code(code), m_phase(phase) {
+		if (m_stats != nullptr) m_start = std::chrono::steady_clock::now();
+	}
+
+	~ScopedTimer() {
+		if (m_stats != nullptr) {
+			m_stats->record(m_code, m_phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+		}
+	}
+
+	ScopedTimer(const ScopedTimer& other) = delete;
+	ScopedTimer& operator=(const ScopedTimer& other) = delete;
+
+private:
+	Stats* const m_stats;
+	const uint16_t m_code;
+	const StatPhase m_phase;
+	std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,98 @@
+#include "Trace.h"
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+
+
+
+static std::atomic<uint64_t> s_nextTracerID{ 1 };
+
+
+Tracer::Tracer(const size_t eventsPerThread) : m_id(s_nextTracerID++), m_capacity(std::max<size_t>(1, eventsPerThread)), m_epoch(std::chrono::steady_clock::now()), m_enabled(false) {}
+
+
+uint64_t Tracer::now() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+}
+
+
+
+void Tracer::record(const char* name, uint16_t code, uint32_t messageID, uint64_t start, uint64_t duration) {
+	Ring* ring = threadRing();
+	const uint64_t head = ring->head.load(std::memory_order_relaxed);
+	// the previous head store is visible before this slot changes, json() relies on it to drop torn events
+	std::atomic_thread_fence(std::memory_order_release);
+
+	TraceEvent& event = ring->events[head % m_capacity];
+	event.name = name;
+	event.start = start;
+	event.duration = duration;
+	event.messageID = messageID;
+	event.code = code;
+
+	// publish the event to the exporting thread
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+
+/**
+ * The calling thread's ring of this tracer, created on its first event.
+ * Tracer ids are never reused, so entries of destroyed tracers are never looked up again.
+ */
+Tracer::Ring* Tracer::threadRing() {
+	thread_local std::unordered_map<uint64_t, Ring*> rings;
+	const auto cached = rings.find(m_id);
+	if (cached != rings.end()) return cached->second;
+
+	std::lock_guard<std::mutex> lock(m_ringsMutex);
+	m_rings.push_back(std::make_unique<Ring>(m_capacity, static_cast<uint32_t>(m_rings.size() + 1)));
+	Ring* ring = m_rings.back().get();
+	rings.emplace(m_id, ring);
+	return ring;
+}
+
+
+
+/**
+ * Complete ("X") events in the Chrome trace event format, timestamps are in microseconds.
+ * Every ring is copied and then checked against its head again, events the writer may have
+ * overwritten during the copy are dropped, events written while exporting may be skipped.
+ */
+std::string Tracer::json() {
+	std::ostringstream out;
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+
+	std::vector<TraceEvent> snapshot;
+	snapshot.reserve(m_capacity);
+
+	std::lock_guard<std::mutex> lock(m_ringsMutex);
+	for (const auto& ring : m_rings) {
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		const uint64_t begin = (head > m_capacity) ? head - m_capacity : 0;
+
+		snapshot.clear();
+		for (uint64_t i = begin; i < head; ++i)
+			snapshot.push_back(ring->events[i % m_capacity]);
+
+		// the writer may be filling the slot of event 'after', which held event after - capacity
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64_t after = ring->head.load(std::memory_order_relaxed);
+		const uint64_t firstIntact = (after >= m_capacity) ? after - m_capacity + 1 : 0;
+		const size_t skip = static_cast<size_t>(std::min<uint64_t>(head - begin, (firstIntact > begin) ? firstIntact - begin : 0));
+
+		for (size_t i = skip; i < snapshot.size(); ++i) {
+			const TraceEvent& event = snapshot[i];
+			out << (first ? "\n" : ",\n");
+			out << "{\"name\":\"" << event.name << "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->threadID
+				<< ",\"ts\":" << event.start / 1000 << "." << (event.start % 1000) / 100
+				<< ",\"dur\":" << event.duration / 1000 << "." << (event.duration % 1000) / 100
+				<< ",\"args\":{\"code\":" << event.code << ",\"message_id\":" << event.messageID << "}}";
+			first = false;
+		}
+	}
+
+	out << "\n]}\n";
+	return out.str();
+}
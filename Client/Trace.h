@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+
+
+constexpr auto TRACE_PATH = "client_trace.json";
+constexpr size_t DEFAULT_TRACE_EVENTS = 16384;	// per thread
+
+
+struct TraceEvent {
+	const char* name;		// string literal
+	uint64_t start;			// nanoseconds since the tracer started
+	uint64_t duration;
+	uint32_t messageID;
+	uint16_t code;
+};
+
+
+/**
+ * Records spans of the client's request phases and exports them as Chrome trace events.
+ * Every thread writes to its own ring buffer without locking, the oldest events are overwritten.
+ */
+class Tracer {
+public:
+	explicit Tracer(const size_t eventsPerThread = DEFAULT_TRACE_EVENTS);
+	virtual ~Tracer() = default;
+	Tracer(const Tracer& other) = delete;
+	Tracer(Tracer&& other) noexcept = delete;
+	Tracer& operator=(const Tracer& other) = delete;
+	Tracer& operator=(Tracer&& other) noexcept = delete;
+
+	void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+	bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+	uint64_t now() const;
+	void record(const char*, uint16_t, uint32_t, uint64_t, uint64_t);
+	std::string json();
+
+private:
+	// single producer ring, 'head' counts every event ever written to it
+	struct Ring {
+		std::vector<TraceEvent> events;
+		std::atomic<uint64_t> head;
+		uint32_t threadID;
+
+		Ring(size_t capacity, uint32_t id) : events(capacity), head(0), threadID(id) {}
+	};
+
+	Ring* threadRing();
+
+	const uint64_t m_id;			// tells tracers apart in the per-thread cache
+	const size_t m_capacity;
+	const std::chrono::steady_clock::time_point m_epoch;
+	std::atomic<bool> m_enabled;
+	std::mutex m_ringsMutex;		// only taken when a thread records its first event and on export
+	std::vector<std::unique_ptr<Ring>> m_rings;
+};
+
+
+/**
+ * A span for the lifetime of the scope, nothing is read or written when tracing is off.
+ */
+class TraceSpan {
+public:
+	TraceSpan(Tracer* tracer, const char* name, uint16_t code, uint32_t messageID = 0)
+		: m_tracer((tracer != nullptr && tracer->enabled()) ? tracer : nullptr), m_name(name), m_code(code), m_messageID(messageID), m_start(0) {
+		if (m_tracer != nullptr) m_start = m_tracer->now();
+	}
+
+	~TraceSpan() {
+		if (m_tracer != nullptr) m_tracer->record(m_name, m_code, m_messageID, m_start, m_tracer->now() - m_start);
+	}
+
+	TraceSpan(const TraceSpan& other) = delete;
+	TraceSpan& operator=(const TraceSpan& other) = delete;
+
+private:
+	Tracer* const m_tracer;
+	const char* const m_name;
+	const uint16_t m_code;
+	const uint32_t m_messageID;
+	uint64_t m_start;
+};
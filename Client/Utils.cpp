@@ -1,17 +1,496 @@
 #include "Utils.h"
+#include <immintrin.h>
+#include <intrin.h>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
 
 
 
+namespace {
+
+	const char HEX_DIGITS[] = "0123456789ABCDEF";
+	const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+	// Value of every character, -1 outside the alphabet
+	struct DecodeTables {
+		int8_t hex[256];
+		int8_t base64[256];
+
+		DecodeTables() {
+			memset(hex, -1, sizeof(hex));
+			memset(base64, -1, sizeof(base64));
+			for (int i = 0; i < 16; ++i) {
+				hex[static_cast<uint8_t>(HEX_DIGITS[i])] = static_cast<int8_t>(i);
+				hex[static_cast<uint8_t>(tolower(HEX_DIGITS[i]))] = static_cast<int8_t>(i);
+			}
+			for (int i = 0; i < 64; ++i) base64[static_cast<uint8_t>(BASE64_ALPHABET[i])] = static_cast<int8_t>(i);
+		}
+	};
+
+	const DecodeTables g_tables;
+
+
+	SimdLevel detectSimdLevel() {
+		int info[4];
+		__cpuid(info, 0);
+		const int maxLeaf = info[0];
+		__cpuid(info, 1);
+		const bool ssse3 = (info[2] & (1 << 9)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+		// AVX2 also needs the OS to save the YMM registers
+		if (maxLeaf >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5)) return SimdLevel::AVX2;
+		}
+		return ssse3 ? SimdLevel::SSSE3 : SimdLevel::SCALAR;
+	}
+
+	SimdLevel g_simdLevel = Utils::supportedSimdLevel();
+
+
+	unsigned long firstSet(uint32_t mask) {
+		unsigned long index = 0;
+		_BitScanForward(&index, mask);
+		return index;
+	}
+
+
+
+	void hexEncodeScalar(const uint8_t* in, size_t size, char* out) {
+		for (size_t i = 0; i < size; ++i) {
+			out[2 * i] = HEX_DIGITS[in[i] >> 4];
+			out[2 * i + 1] = HEX_DIGITS[in[i] & 0x0F];
+		}
+	}
+
+
+	void hexEncodeSSSE3(const uint8_t* in, size_t size, char* out) {
+		const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i*>(HEX_DIGITS));
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16) {
+			const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			const __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+			const __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibble));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(high, low));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+		}
+		hexEncodeScalar(in + i, size - i, out + 2 * i);
+	}
+
+
+	void hexEncodeAVX2(const uint8_t* in, size_t size, char* out) {
+		const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(HEX_DIGITS)));
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+			const __m256i high = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+			const __m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(bytes, nibble));
+			// the unpacks work per 128 bit lane, put the lanes back in order
+			const __m256i first = _mm256_unpacklo_epi8(high, low);
+			const __m256i second = _mm256_unpackhi_epi8(high, low);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+		}
+		hexEncodeScalar(in + i, size - i, out + 2 * i);
+	}
+
+
+
+	bool hexDecodeScalar(const char* in, size_t size, uint8_t* out) {
+		for (size_t i = 0; i + 1 < size; i += 2) {
+			const int8_t high = g_tables.hex[static_cast<uint8_t>(in[i])];
+			const int8_t low = g_tables.hex[static_cast<uint8_t>(in[i + 1])];
+			if (high < 0 || low < 0) return false;
+			out[i / 2] = static_cast<uint8_t>(high << 4 | low);
+		}
+		return true;
+	}
+
+
+	/**
+	 * Digit values of 16 characters, digits and letters are told apart by range checks.
+	 * The subtractions wrap, so characters above 0x7F never land in a range.
+	 */
+	__m128i hexValuesSSSE3(__m128i chars, __m128i& valid) {
+		const __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+		const __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(digit, _mm_set1_epi8(-1)), _mm_cmpgt_epi8(_mm_set1_epi8(10), digit));
+		const __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(letter, _mm_set1_epi8(-1)), _mm_cmpgt_epi8(_mm_set1_epi8(6), letter));
+		valid = _mm_and_si128(valid, _mm_or_si128(isDigit, isLetter));
+		return _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+	}
+
+
+	bool hexDecodeSSSE3(const char* in, size_t size, uint8_t* out) {
+		const __m128i weights = _mm_set1_epi16(0x0110);	// high digit * 16 + low digit
+
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32) {
+			__m128i valid = _mm_set1_epi8(-1);
+			const __m128i first = hexValuesSSSE3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), valid);
+			const __m128i second = hexValuesSSSE3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 16)), valid);
+			if (_mm_movemask_epi8(valid) != 0xFFFF) return false;
+			const __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(first, weights), _mm_maddubs_epi16(second, weights));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 2), bytes);
+		}
+		return hexDecodeScalar(in + i, size - i, out + i / 2);
+	}
+
+
+	__m256i hexValuesAVX2(__m256i chars, __m256i& valid) {
+		const __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+		const __m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+		const __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(digit, _mm256_set1_epi8(-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(10), digit));
+		const __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(letter, _mm256_set1_epi8(-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(6), letter));
+		valid = _mm256_and_si256(valid, _mm256_or_si256(isDigit, isLetter));
+		return _mm256_or_si256(_mm256_and_si256(isDigit, digit), _mm256_and_si256(isLetter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+	}
+
+
+	bool hexDecodeAVX2(const char* in, size_t size, uint8_t* out) {
+		const __m256i weights = _mm256_set1_epi16(0x0110);
+
+		size_t i = 0;
+		for (; i + 64 <= size; i += 64) {
+			__m256i valid = _mm256_set1_epi8(-1);
+			const __m256i first = hexValuesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)), valid);
+			const __m256i second = hexValuesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 32)), valid);
+			if (static_cast<uint32_t>(_mm256_movemask_epi8(valid)) != 0xFFFFFFFF) return false;
+			const __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(first, weights), _mm256_maddubs_epi16(second, weights));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i / 2), _mm256_permute4x64_epi64(packed, 0xD8));
+		}
+		return hexDecodeScalar(in + i, size - i, out + i / 2);
+	}
+
+
+
+	void base64EncodeScalar(const uint8_t* in, size_t size, char* out) {
+		size_t i = 0;
+		for (; i + 3 <= size; i += 3, out += 4) {
+			const uint32_t group = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+			out[0] = BASE64_ALPHABET[group >> 18];
+			out[1] = BASE64_ALPHABET[(group >> 12) & 0x3F];
+			out[2] = BASE64_ALPHABET[(group >> 6) & 0x3F];
+			out[3] = BASE64_ALPHABET[group & 0x3F];
+		}
+		if (i == size) return;
+
+		const uint32_t group = in[i] << 16 | ((i + 1 < size) ? in[i + 1] << 8 : 0);
+		out[0] = BASE64_ALPHABET[group >> 18];
+		out[1] = BASE64_ALPHABET[(group >> 12) & 0x3F];
+		out[2] = (i + 1 < size) ? BASE64_ALPHABET[(group >> 6) & 0x3F] : '=';
+		out[3] = '=';
+	}
+
+
+	/**
+	 * Splits 12 bytes into 16 six bit indices, the 3 byte groups are spread over 32 bit words
+	 * and each index is shifted into place with a multiply. The indices are turned into
+	 * characters by adding an offset that depends on the range they fall in.
+	 */
+	__m128i base64CharsSSSE3(__m128i bytes) {
+		const __m128i spread = _mm_shuffle_epi8(bytes, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		const __m128i first = _mm_mulhi_epu16(_mm_and_si128(spread, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+		const __m128i second = _mm_mullo_epi16(_mm_and_si128(spread, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+		const __m128i indices = _mm_or_si128(first, second);
+
+		// 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+		__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+		const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+	}
+
+
+	void base64EncodeSSSE3(const uint8_t* in, size_t size, char* out) {
+		size_t i = 0;
+		for (; i + 16 <= size; i += 12, out += 16) {
+			const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), base64CharsSSSE3(bytes));
+		}
+		base64EncodeScalar(in + i, size - i, out);
+	}
+
+
+	__m256i base64CharsAVX2(__m256i bytes) {
+		const __m256i spread = _mm256_shuffle_epi8(bytes, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+			10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		const __m256i first = _mm256_mulhi_epu16(_mm256_and_si256(spread, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+		const __m256i second = _mm256_mullo_epi16(_mm256_and_si256(spread, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+		const __m256i indices = _mm256_or_si256(first, second);
+
+		__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+		const __m256i offsets = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+		return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range));
+	}
+
+
+	// Each lane takes 12 bytes, loaded 16 at a time, so 4 more bytes than encoded must be readable.
+	void base64EncodeAVX2(const uint8_t* in, size_t size, char* out) {
+		size_t i = 0;
+		for (; i + 28 <= size; i += 24, out += 32) {
+			const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+			const __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), base64CharsAVX2(bytes));
+		}
+		base64EncodeSSSE3(in + i, size - i, out);
+	}
+
+
+
+	// Sextets of the group of four characters being decoded
+	struct Base64Group {
+		uint32_t bits = 0;
+		size_t count = 0;
+	};
+
+
+	/**
+	 * Decodes characters up to end, skipping those outside the alphabet like Crypto++ does.
+	 * With untilAligned it stops as soon as the current group of four is complete.
+	 */
+	const char* base64DecodeScalar(const char* in, const char* end, uint8_t*& out, Base64Group& group, bool untilAligned) {
+		while (in < end) {
+			const int8_t value = g_tables.base64[static_cast<uint8_t>(*in++)];
+			if (value < 0) continue;
+			group.bits = group.bits << 6 | static_cast<uint32_t>(value);
+			if (++group.count < 4) continue;
+
+			out[0] = static_cast<uint8_t>(group.bits >> 16);
+			out[1] = static_cast<uint8_t>(group.bits >> 8);
+			out[2] = static_cast<uint8_t>(group.bits);
+			out += 3;
+			group = Base64Group();
+			if (untilAligned) break;
+		}
+		return in;
+	}
+
+
+	// A trailing group of two or three characters carries one or two bytes.
+	size_t base64DecodeFinish(const uint8_t* start, uint8_t* out, const Base64Group& group) {
+		if (group.count == 2) {
+			*out++ = static_cast<uint8_t>(group.bits >> 4);
+		} else if (group.count == 3) {
+			*out++ = static_cast<uint8_t>(group.bits >> 10);
+			*out++ = static_cast<uint8_t>(group.bits >> 2);
+		}
+		return out - start;
+	}
+
+
+	// Skips the block up to its first character outside the alphabet and realigns on a group of four.
+	const char* base64DecodeSkip(const char* in, unsigned long invalid, const char* end, uint8_t*& out, Base64Group& group) {
+		in = base64DecodeScalar(in, in + invalid + 1, out, group, false);
+		if (group.count != 0) in = base64DecodeScalar(in, end, out, group, true);
+		return in;
+	}
+
+
+	/**
+	 * Sextet values of 16 characters and a mask of the characters outside the alphabet.
+	 * Every range adds its own offset, characters above 0x7F are negative and match none.
+	 */
+	__m128i base64ValuesSSSE3(__m128i chars, uint32_t& invalid) {
+		const auto inRange = [&chars](char low, char high) {
+			return _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8(low - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), chars));
+		};
+		const __m128i upper = inRange('A', 'Z');
+		const __m128i lower = inRange('a', 'z');
+		const __m128i digit = inRange('0', '9');
+		const __m128i plus = _mm_cmpeq_epi8(chars, _mm_set1_epi8('+'));
+		const __m128i slash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+
+		const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+		invalid = ~static_cast<uint32_t>(_mm_movemask_epi8(valid)) & 0xFFFF;
+
+		__m128i offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+		offset = _mm_or_si128(offset, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+		offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+		offset = _mm_or_si128(offset, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+		offset = _mm_or_si128(offset, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+		return _mm_add_epi8(chars, offset);
+	}
+
+
+	// Joins the sextets of every 32 bit word into 3 bytes, big endian, in the low 12 bytes.
+	__m128i base64PackSSSE3(__m128i values) {
+		const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+		const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+		return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	}
+
+
+	size_t base64DecodeSSSE3(const char* in, size_t size, uint8_t* out) {
+		const char* end = in + size;
+		uint8_t* const start = out;
+		Base64Group group;
+		uint8_t block[16];
+
+		while (end - in >= 16) {
+			uint32_t invalid = 0;
+			const __m128i values = base64ValuesSSSE3(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), invalid);
+			if (invalid != 0) {
+				in = base64DecodeSkip(in, firstSet(invalid), end, out, group);
+				continue;
+			}
+			// the caller's buffer may end right after the 12 decoded bytes
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(block), base64PackSSSE3(values));
+			memcpy(out, block, 12);
+			in += 16;
+			out += 12;
+		}
+		base64DecodeScalar(in, end, out, group, false);
+		return base64DecodeFinish(start, out, group);
+	}
+
+
+	__m256i base64ValuesAVX2(__m256i chars, uint32_t& invalid) {
+		const auto inRange = [&chars](char low, char high) {
+			return _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8(low - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), chars));
+		};
+		const __m256i upper = inRange('A', 'Z');
+		const __m256i lower = inRange('a', 'z');
+		const __m256i digit = inRange('0', '9');
+		const __m256i plus = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('+'));
+		const __m256i slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+
+		const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+		invalid = ~static_cast<uint32_t>(_mm256_movemask_epi8(valid));
+
+		__m256i offset = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+		return _mm256_add_epi8(chars, offset);
+	}
+
+
+	size_t base64DecodeAVX2(const char* in, size_t size, uint8_t* out) {
+		const char* end = in + size;
+		uint8_t* const start = out;
+		Base64Group group;
+		uint8_t block[32];
+
+		while (end - in >= 32) {
+			uint32_t invalid = 0;
+			const __m256i values = base64ValuesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)), invalid);
+			if (invalid != 0) {
+				in = base64DecodeSkip(in, firstSet(invalid), end, out, group);
+				continue;
+			}
+			const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+			const __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+			const __m256i lanes = _mm256_shuffle_epi8(words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+				2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(block), _mm256_permutevar8x32_epi32(lanes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)));
+			memcpy(out, block, 24);
+			in += 32;
+			out += 24;
+		}
+		base64DecodeScalar(in, end, out, group, false);
+		return base64DecodeFinish(start, out, group);
+	}
+}
+
+
+
+SimdLevel Utils::supportedSimdLevel() {
+	static const SimdLevel supported = detectSimdLevel();
+	return supported;
+}
+
+
+SimdLevel Utils::simdLevel() {
+	return g_simdLevel;
+}
+
+
+// Lowers the level the codecs run on, to compare them. Not to be called while they run on other threads.
+void Utils::setSimdLevel(SimdLevel level) {
+	g_simdLevel = std::min(level, supportedSimdLevel());
+}
+
+
+
+void Utils::hexEncode(const uint8_t* in, size_t size, char* out) {
+	switch (g_simdLevel) {
+	case SimdLevel::AVX2: return hexEncodeAVX2(in, size, out);
+	case SimdLevel::SSSE3: return hexEncodeSSSE3(in, size, out);
+	default: return hexEncodeScalar(in, size, out);
+	}
+}
+
+
+bool Utils::hexDecode(const char* in, size_t size, uint8_t* out) {
+	if (size % 2 != 0) return false;
+
+	switch (g_simdLevel) {
+	case SimdLevel::AVX2: return hexDecodeAVX2(in, size, out);
+	case SimdLevel::SSSE3: return hexDecodeSSSE3(in, size, out);
+	default: return hexDecodeScalar(in, size, out);
+	}
+}
+
+
+void Utils::base64Encode(const uint8_t* in, size_t size, char* out) {
+	switch (g_simdLevel) {
+	case SimdLevel::AVX2: return base64EncodeAVX2(in, size, out);
+	case SimdLevel::SSSE3: return base64EncodeSSSE3(in, size, out);
+	default: return base64EncodeScalar(in, size, out);
+	}
+}
+
+
+size_t Utils::base64Decode(const char* in, size_t size, uint8_t* out) {
+	switch (g_simdLevel) {
+	case SimdLevel::AVX2: return base64DecodeAVX2(in, size, out);
+	case SimdLevel::SSSE3: return base64DecodeSSSE3(in, size, out);
+	default: {
+		uint8_t* const start = out;
+		Base64Group group;
+		base64DecodeScalar(in, in + size, out, group, false);
+		return base64DecodeFinish(start, out, group);
+	}
+	}
+}
+
+
+
+/**
+ * Same output as the Crypto++ Base64Encoder: lines of BASE64_LINE_LENGTH, each ending with a line break.
+ */
 std::string Utils::encodeBase64(const std::string& str) {
-	std::string encoded;
-	CryptoPP::StringSource ss(str, true, new CryptoPP::Base64Encoder(new CryptoPP::StringSink(encoded)));
+	const size_t size = base64EncodedSize(str.size());
+	const size_t lines = (size + BASE64_LINE_LENGTH - 1) / BASE64_LINE_LENGTH;
+	std::string encoded(size + std::max<size_t>(lines, 1), '\n');
+
+	// encoded in one pass behind the room for the line breaks, then every line moves down to its place
+	base64Encode(reinterpret_cast<const uint8_t*>(str.data()), str.size(), &encoded[lines]);
+	for (size_t line = 0; line < lines; ++line) {
+		const size_t length = std::min(BASE64_LINE_LENGTH, size - line * BASE64_LINE_LENGTH);
+		memmove(&encoded[line * (BASE64_LINE_LENGTH + 1)], &encoded[lines + line * BASE64_LINE_LENGTH], length);
+		encoded[line * (BASE64_LINE_LENGTH + 1) + length] = '\n';
+	}
 	return encoded;
 }
 
 
 std::string Utils::decodeBase64(const std::string& str) {
-	std::string decoded;
-	CryptoPP::StringSource ss(str, true, new CryptoPP::Base64Decoder(new CryptoPP::StringSink(decoded)));
+	std::string decoded(base64DecodedMaxSize(str.size()), '\0');
+	decoded.resize(base64Decode(str.data(), str.size(), reinterpret_cast<uint8_t*>(&decoded[0])));
 	return decoded;
 }
 
@@ -23,13 +502,9 @@ std::string Utils::decodeBase64(const std::string& str) {
 std::string Utils::bytesToHex(const uint8_t* buffer, const size_t size) {
 	if (size == 0 || buffer == nullptr) return "";
 
-	const std::string byteString(buffer, buffer + size);
-
-	try {
-		return boost::algorithm::hex(byteString);
-	} catch (...) {
-		return "";
-	}
+	std::string hex(2 * size, '\0');
+	hexEncode(buffer, size, &hex[0]);
+	return hex;
 }
 
 
@@ -40,22 +515,19 @@ std::string Utils::bytesToHex(const uint8_t* buffer, const size_t size) {
 std::string Utils::hexToBytes(const std::string& hexString) {
 	if (hexString.empty()) return "";
 
-	try {
-		std::vector<uint8_t> bytes;
-		return boost::algorithm::unhex(hexString);
-	} catch (...) {
-		return "";
-	}
+	std::string bytes(hexString.size() / 2, '\0');
+	if (!hexDecode(hexString.data(), hexString.size(), reinterpret_cast<uint8_t*>(&bytes[0]))) return "";
+	return bytes;
 }
 
 
 /**
  * Return current timestamp as sting.
- 
+
 std::string Utils::getTimestamp()
 {
 	const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
 	return std::to_string(now.count());
 }
 
-*/
\ No newline at end of file
+*/
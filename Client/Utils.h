@@ -1,10 +1,20 @@
 #pragma once
 #include <string>
-#include <base64.h>
-#include <boost/algorithm/hex.hpp>
+#include <cstdint>
 #include <chrono>
 
 
+constexpr size_t BASE64_LINE_LENGTH = 72;	// line length of the Crypto++ Base64Encoder, kept for me.info
+
+
+// Instruction sets the codecs can run on, the best one the CPU supports is picked at startup
+enum class SimdLevel {
+	SCALAR,
+	SSSE3,
+	AVX2
+};
+
+
 class Utils {
 
 public:
@@ -12,5 +22,22 @@ public:
 	static std::string decodeBase64(const std::string& str);
 	static std::string bytesToHex(const uint8_t* buffer, const size_t size);
 	static std::string hexToBytes(const std::string& hexString);
-};
 
+	/**
+	 * Codecs into caller provided buffers, they do not allocate.
+	 * hexEncode writes 2 * size upper case digits, hexDecode size / 2 bytes and fails on odd sizes and non hex digits.
+	 * base64Encode writes base64EncodedSize(size) characters without line breaks. base64Decode skips characters
+	 * outside the alphabet, like line breaks and padding, writes at most base64DecodedMaxSize(size) bytes and
+	 * returns how many it wrote.
+	 */
+	static void hexEncode(const uint8_t* in, size_t size, char* out);
+	static bool hexDecode(const char* in, size_t size, uint8_t* out);
+	static size_t base64EncodedSize(size_t size) { return (size + 2) / 3 * 4; }
+	static size_t base64DecodedMaxSize(size_t size) { return size / 4 * 3 + 2; }
+	static void base64Encode(const uint8_t* in, size_t size, char* out);
+	static size_t base64Decode(const char* in, size_t size, uint8_t* out);
+
+	static SimdLevel simdLevel();
+	static SimdLevel supportedSimdLevel();
+	static void setSimdLevel(SimdLevel level);
+};
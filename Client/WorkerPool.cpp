@@ -0,0 +1,49 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+
+
+WorkerPool::WorkerPool(const size_t workers) : m_stop(false) {
+	const size_t count = std::max<size_t>(workers, 1);
+	for (size_t i = 0; i < count; ++i)
+		m_workers.emplace_back(&WorkerPool::run, this);
+}
+
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_jobReady.notify_all();
+
+	// pending jobs are still completed, callers may be waiting on them
+	for (auto& worker : m_workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+
+
+void WorkerPool::post(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_jobReady.notify_one();
+}
+
+
+void WorkerPool::run() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobReady.wait(lock, [this] { return !m_jobs.empty() || m_stop; });
+			if (m_jobs.empty()) return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
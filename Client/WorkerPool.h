@@ -0,0 +1,45 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+
+/**
+ * Fixed set of threads running submitted jobs in order, for CPU bound work such as decryption.
+ * Jobs must not wait on other jobs of the same pool.
+ */
+class WorkerPool {
+public:
+	explicit WorkerPool(const size_t workers = std::thread::hardware_concurrency());
+	virtual ~WorkerPool();
+	WorkerPool(const WorkerPool& other) = delete;
+	WorkerPool(WorkerPool&& other) noexcept = delete;
+	WorkerPool& operator=(const WorkerPool& other) = delete;
+	WorkerPool& operator=(WorkerPool&& other) noexcept = delete;
+
+	template <typename Job>
+	auto submit(Job&& job) -> std::future<decltype(job())> {
+		auto task = std::make_shared<std::packaged_task<decltype(job())()>>(std::forward<Job>(job));
+		auto result = task->get_future();
+		post([task]() { (*task)(); });
+		return result;
+	}
+
+	size_t size() const { return m_workers.size(); }
+
+private:
+	void run();
+	void post(std::function<void()>);
+
+	std::deque<std::function<void()>> m_jobs;
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_jobReady;
+	bool m_stop;
+};
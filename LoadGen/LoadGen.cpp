@@ -0,0 +1,363 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "Protocol.h"
+#include "SocketHandler.h"
+#include "AESHandler.h"
+#include "ECDHHandler.h"
+
+
+
+constexpr auto DEFAULT_ADDRESS = "127.0.0.1";
+constexpr auto DEFAULT_PORT = "1234";
+
+
+struct Options {
+	std::string address = DEFAULT_ADDRESS;
+	std::string port = DEFAULT_PORT;
+	size_t clients = 100;
+	size_t threads = 8;
+	size_t duration = 30;		// seconds of mixed traffic
+	size_t messageSize = 64;	// plain text bytes per message
+	// relative weights of sends, clients list fetches and unread polls
+	double sendWeight = 60;
+	double listWeight = 10;
+	double pollWeight = 30;
+};
+
+
+// A simulated client, identities use X25519 keys so thousands of them are cheap to create.
+struct Identity {
+	std::string name;
+	ClientID clientId;
+	ECDHWrapper ecdh;
+	std::string publicKey;
+	size_t peer = 0;
+	ClientID peerId;
+	uint8_t symKey[SYM_KEY_SIZE] = { 0 };
+	bool registered = false;
+	bool hasSymKey = false;
+};
+
+
+// Latency samples of one thread, merged after the threads joined.
+struct Recorder {
+	std::map<uint16_t, std::vector<uint64_t>> samples;	// nanoseconds by request code
+	std::map<uint16_t, size_t> errors;
+
+	void record(uint16_t code, uint64_t ns, bool ok) {
+		if (ok) samples[code].push_back(ns);
+		else ++errors[code];
+	}
+
+	void merge(const Recorder& other) {
+		for (const auto& [code, values] : other.samples) samples[code].insert(samples[code].end(), values.begin(), values.end());
+		for (const auto& [code, count] : other.errors) errors[code] += count;
+	}
+};
+
+
+
+/**
+ * Send one request and read the whole response, the server closes the connection after every request.
+ */
+bool transact(SocketHandler& socket, const uint8_t* request, const size_t size, ResponseCode expected, std::vector<uint8_t>& payload) {
+	uint8_t buffer[PACKET_SIZE];
+	if (!socket.socketWrapper(request, size, buffer, PACKET_SIZE, false)) return false;
+
+	ResponseHeader header;
+	memcpy(&header, buffer, sizeof(header));
+	if (header.code != expected) {
+		socket.closeSocket();
+		return false;
+	}
+
+	const size_t first = std::min<size_t>(header.payloadtSize, PACKET_SIZE - sizeof(header));
+	payload.assign(buffer + sizeof(header), buffer + sizeof(header) + first);
+
+	while (payload.size() < header.payloadtSize) {
+		const size_t toRead = std::min<size_t>(PACKET_SIZE, header.payloadtSize - payload.size());
+		if (!socket.read(buffer, toRead)) {
+			socket.closeSocket();
+			return false;
+		}
+		payload.insert(payload.end(), buffer, buffer + toRead);
+	}
+
+	socket.closeSocket();
+	return true;
+}
+
+
+template <typename Func>
+bool timed(Recorder& recorder, uint16_t code, Func request) {
+	const auto start = std::chrono::steady_clock::now();
+	const bool ok = request();
+	const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	recorder.record(code, elapsed, ok);
+	return ok;
+}
+
+
+
+bool registerIdentity(SocketHandler& socket, Identity& identity) {
+	RegistrationRequest req;
+	identity.ecdh.generateKeyPair();
+	identity.publicKey = identity.ecdh.getPublicKey();
+
+	memcpy(req.name, identity.name.c_str(), std::min(identity.name.size(), NAME_SIZE - 1));
+	memcpy(req.publicKey, identity.publicKey.c_str(), identity.publicKey.size());
+	req.keyType = X25519_KEY;
+
+	std::vector<uint8_t> payload;
+	if (!transact(socket, reinterpret_cast<const uint8_t*>(&req), sizeof(req), REGISTER_SUCCESS, payload)) return false;
+	if (payload.size() < sizeof(ClientID)) return false;
+
+	memcpy(identity.clientId.id, payload.data(), CLIENT_ID_SIZE);
+	identity.registered = true;
+	return true;
+}
+
+
+bool exchangeKeys(SocketHandler& socket, Identity& identity, const Identity& peer) {
+	PublicKeyRequest req;
+	req.header.clientId = identity.clientId;
+	memcpy(req.name, peer.name.c_str(), std::min(peer.name.size(), NAME_SIZE - 1));
+
+	std::vector<uint8_t> payload;
+	if (!transact(socket, reinterpret_cast<const uint8_t*>(&req), sizeof(req), GET_PUBLIC_KEY_SUCCESS, payload)) return false;
+	if (payload.size() < sizeof(PublicKeyResponse) - sizeof(ResponseHeader)) return false;
+
+	PublicKeyResponse resp;
+	memcpy(reinterpret_cast<uint8_t*>(&resp) + sizeof(ResponseHeader), payload.data(), sizeof(resp) - sizeof(ResponseHeader));
+	if (resp.keyType != X25519_KEY) return false;
+
+	identity.peerId = resp.clientID;
+	identity.hasSymKey = identity.ecdh.deriveSymKey(resp.publicKey, X25519_KEY_SIZE, identity.symKey, SYM_KEY_SIZE);
+	return identity.hasSymKey;
+}
+
+
+bool sendText(SocketHandler& socket, Identity& identity, const std::string& text) {
+	AESWrapper aes;
+	aes.loadKey(identity.symKey, SYM_KEY_SIZE);
+	std::string cipher = aes.encrypt(text);
+
+	SendMessageRequest req;
+	req.header.clientId = identity.clientId;
+	req.clientId = identity.peerId;
+	req.msgType = TEXT_MESSAGE;
+	req.contentSize = static_cast<uint32_t>(cipher.size());
+	req.msgContent = reinterpret_cast<uint8_t*>(&cipher[0]);
+	const std::vector<uint8_t> packet = req.pack();
+
+	std::vector<uint8_t> payload;
+	return transact(socket, packet.data(), packet.size(), MESSAGE_SENT_SUCCESS, payload);
+}
+
+
+bool emptyPayloadRequest(SocketHandler& socket, const Identity& identity, RequestCode code, ResponseCode expected) {
+	RequestHeader req(code);
+	req.clientId = identity.clientId;
+	std::vector<uint8_t> payload;
+	return transact(socket, reinterpret_cast<const uint8_t*>(&req), sizeof(req), expected, payload);
+}
+
+
+
+/**
+ * Run 'work' for every identity owned by each thread, identity i belongs to thread i % threads.
+ */
+template <typename Func>
+void runPhase(const Options& options, std::vector<std::unique_ptr<Identity>>& identities, std::vector<Recorder>& recorders, Func work) {
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < options.threads; ++t) {
+		threads.emplace_back([&, t] {
+			SocketHandler socket(options.address, options.port);
+			for (size_t i = t; i < identities.size(); i += options.threads) work(socket, *identities[i], recorders[t]);
+		});
+	}
+	for (auto& thread : threads) thread.join();
+}
+
+
+void runMix(const Options& options, std::vector<std::unique_ptr<Identity>>& identities, std::vector<Recorder>& recorders) {
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.duration);
+
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < options.threads; ++t) {
+		threads.emplace_back([&, t] {
+			SocketHandler socket(options.address, options.port);
+			std::mt19937 rng(static_cast<uint32_t>(t * 7919 + 1));
+			std::discrete_distribution<int> pick({ options.sendWeight, options.listWeight, options.pollWeight });
+			const std::string text(options.messageSize, 'x');
+
+			std::vector<Identity*> owned;
+			for (size_t i = t; i < identities.size(); i += options.threads) {
+				if (identities[i]->hasSymKey) owned.push_back(identities[i].get());
+			}
+			if (owned.empty()) return;
+
+			for (size_t next = 0; std::chrono::steady_clock::now() < deadline; next = (next + 1) % owned.size()) {
+				Identity& identity = *owned[next];
+				switch (pick(rng)) {
+				case 0:
+					timed(recorders[t], SEND_MESSAGE, [&] { return sendText(socket, identity, text); });
+					break;
+				case 1:
+					timed(recorders[t], GET_CLIENTS_LIST, [&] { return emptyPayloadRequest(socket, identity, GET_CLIENTS_LIST, GET_CLIENTS_LIST_SUCCESS); });
+					break;
+				default:
+					timed(recorders[t], GET_UNREAD_MESSAGES, [&] { return emptyPayloadRequest(socket, identity, GET_UNREAD_MESSAGES, GET_UNREAD_MESSAGES_SUCCESS); });
+					break;
+				}
+			}
+		});
+	}
+	for (auto& thread : threads) thread.join();
+}
+
+
+
+const char* requestName(uint16_t code) {
+	switch (code) {
+	case REGISTER_CLIENT: return "register";
+	case GET_CLIENTS_LIST: return "clients_list";
+	case GET_PUBLIC_KEY: return "public_key";
+	case SEND_MESSAGE: return "send_message";
+	case GET_UNREAD_MESSAGES: return "unread_messages";
+	default: return "unknown";
+	}
+}
+
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+	if (sorted.empty()) return 0;
+	const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+	return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)] / 1e6;
+}
+
+
+/**
+ * Throughput is per second of the phase the request code ran in.
+ */
+void report(Recorder& total, const std::map<uint16_t, double>& seconds) {
+	std::printf("%-16s %10s %8s %12s %10s %10s %10s\n", "request", "ok", "errors", "req/s", "p50 ms", "p99 ms", "p999 ms");
+
+	std::map<uint16_t, bool> codes;
+	for (const auto& entry : total.samples) codes[entry.first] = true;
+	for (const auto& entry : total.errors) codes[entry.first] = true;
+
+	for (const auto& entry : codes) {
+		const uint16_t code = entry.first;
+		auto& values = total.samples[code];
+		std::sort(values.begin(), values.end());
+		const auto it = seconds.find(code);
+		const double elapsed = (it == seconds.end() || it->second <= 0) ? 1 : it->second;
+
+		std::printf("%-16s %10zu %8zu %12.1f %10.3f %10.3f %10.3f\n", requestName(code), values.size(), total.errors[code],
+			values.size() / elapsed, percentile(values, 0.50), percentile(values, 0.99), percentile(values, 0.999));
+	}
+}
+
+
+
+bool parseMix(const std::string& mix, Options& options) {
+	double weights[3] = { 0 };
+	if (std::sscanf(mix.c_str(), "%lf:%lf:%lf", &weights[0], &weights[1], &weights[2]) != 3) return false;
+	if (weights[0] < 0 || weights[1] < 0 || weights[2] < 0 || weights[0] + weights[1] + weights[2] <= 0) return false;
+
+	options.sendWeight = weights[0];
+	options.listWeight = weights[1];
+	options.pollWeight = weights[2];
+	return true;
+}
+
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+	try {
+		for (int i = 1; i + 1 < argc; i += 2) {
+			const std::string arg = argv[i];
+			const std::string value = argv[i + 1];
+			if (arg == "--address") options.address = value;
+			else if (arg == "--port") options.port = value;
+			else if (arg == "--clients") options.clients = std::stoul(value);
+			else if (arg == "--threads") options.threads = std::stoul(value);
+			else if (arg == "--duration") options.duration = std::stoul(value);
+			else if (arg == "--message-size") options.messageSize = std::stoul(value);
+			else if (arg == "--mix") {
+				if (!parseMix(value, options)) return false;
+			}
+			else return false;
+		}
+	} catch (...) {
+		return false;
+	}
+	options.threads = std::max<size_t>(1, std::min(options.threads, options.clients));
+	return options.clients >= 2;
+}
+
+
+
+/**
+ * Usage: LoadGen [--address ip] [--port port] [--clients n] [--threads n] [--duration seconds]
+ *                [--message-size bytes] [--mix send:list:poll]
+ */
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		std::cout << "Usage: LoadGen [--address ip] [--port port] [--clients n>=2] [--threads n] [--duration seconds]"
+			" [--message-size bytes] [--mix send:list:poll]" << std::endl;
+		return 1;
+	}
+
+	// names must be unique on the server, so every run gets its own prefix
+	const auto runId = std::chrono::system_clock::now().time_since_epoch().count() & 0xFFFFFF;
+	std::vector<std::unique_ptr<Identity>> identities;
+	for (size_t i = 0; i < options.clients; ++i) {
+		auto identity = std::make_unique<Identity>();
+		identity->name = "lg" + std::to_string(runId) + "_" + std::to_string(i);
+		identity->peer = (i + 1) % options.clients;
+		identities.push_back(std::move(identity));
+	}
+
+	std::vector<Recorder> recorders(options.threads);
+	std::map<uint16_t, double> seconds;
+	using clock = std::chrono::steady_clock;
+
+	std::cout << "Registering " << options.clients << " clients on " << options.threads << " threads..." << std::endl;
+	auto start = clock::now();
+	runPhase(options, identities, recorders, [](SocketHandler& socket, Identity& identity, Recorder& recorder) {
+		timed(recorder, REGISTER_CLIENT, [&] { return registerIdentity(socket, identity); });
+	});
+	seconds[REGISTER_CLIENT] = std::chrono::duration<double>(clock::now() - start).count();
+
+	std::cout << "Exchanging keys..." << std::endl;
+	start = clock::now();
+	runPhase(options, identities, recorders, [&identities](SocketHandler& socket, Identity& identity, Recorder& recorder) {
+		const Identity& peer = *identities[identity.peer];
+		if (!identity.registered || !peer.registered) return;
+		timed(recorder, GET_PUBLIC_KEY, [&] { return exchangeKeys(socket, identity, peer); });
+	});
+	seconds[GET_PUBLIC_KEY] = std::chrono::duration<double>(clock::now() - start).count();
+
+	std::cout << "Running mixed traffic for " << options.duration << " seconds..." << std::endl;
+	start = clock::now();
+	runMix(options, identities, recorders);
+	const double mixSeconds = std::chrono::duration<double>(clock::now() - start).count();
+	seconds[SEND_MESSAGE] = seconds[GET_CLIENTS_LIST] = seconds[GET_UNREAD_MESSAGES] = mixSeconds;
+
+	Recorder total;
+	for (const auto& recorder : recorders) total.merge(recorder);
+	report(total, seconds);
+	return 0;
+}
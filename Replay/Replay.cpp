@@ -0,0 +1,229 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "Protocol.h"
+#include "SocketHandler.h"
+#include "PayloadParser.h"
+#include "Capture.h"
+#include "Stats.h"
+
+
+
+constexpr auto DEFAULT_ADDRESS = "127.0.0.1";
+constexpr auto DEFAULT_PORT = "1234";
+
+
+struct Options {
+	std::string capturePath;
+	std::string address = DEFAULT_ADDRESS;
+	std::string port = DEFAULT_PORT;
+	bool originalPace = true;
+	bool offline = false;		// only run the client parser over the captured responses
+	size_t repeat = 1;
+};
+
+
+// One request and the response it got in the capture.
+struct Exchange {
+	uint32_t connection = 0;
+	uint64_t timestamp = 0;		// microseconds since the capture started
+	uint16_t code = 0;
+	std::vector<uint8_t> request;
+	std::vector<uint8_t> response;
+};
+
+
+struct CodeResult {
+	LatencyHistogram latency;
+	size_t errors = 0;
+	size_t mismatches = 0;	// a different response code than in the capture
+};
+
+
+
+bool loadCapture(const std::string& path, std::vector<Exchange>& exchanges) {
+	CaptureReader reader;
+	if (!reader.open(path)) return false;
+
+	std::map<uint32_t, size_t> byConnection;
+	CaptureRecord record;
+	const uint8_t* data = nullptr;
+
+	while (reader.next(record, data)) {
+		auto it = byConnection.find(record.connection);
+		if (record.direction == CAPTURE_REQUEST) {
+			Exchange exchange;
+			exchange.connection = record.connection;
+			exchange.timestamp = record.timestamp;
+			exchange.request.assign(data, data + record.size);
+			if (record.size >= sizeof(RequestHeader)) {
+				RequestHeader header(0);
+				memcpy(&header, data, sizeof(header));
+				exchange.code = header.code;
+			}
+			byConnection[record.connection] = exchanges.size();
+			exchanges.push_back(std::move(exchange));
+		} else if (it != byConnection.end()) {
+			auto& response = exchanges[it->second].response;
+			response.insert(response.end(), data, data + record.size);
+		}
+	}
+	return true;
+}
+
+
+uint16_t responseCode(const std::vector<uint8_t>& response) {
+	if (response.size() < sizeof(ResponseHeader)) return 0;
+	ResponseHeader header;
+	memcpy(&header, response.data(), sizeof(header));
+	return header.code;
+}
+
+
+
+/**
+ * Send the captured request and read the whole response the server gives now.
+ */
+bool roundTrip(SocketHandler& socket, const Exchange& exchange, std::vector<uint8_t>& response) {
+	uint8_t buffer[PACKET_SIZE];
+	if (!socket.socketWrapper(exchange.request.data(), exchange.request.size(), buffer, PACKET_SIZE, false)) return false;
+
+	ResponseHeader header;
+	memcpy(&header, buffer, sizeof(header));
+	const size_t total = sizeof(header) + header.payloadtSize;
+	response.assign(buffer, buffer + std::min<size_t>(total, PACKET_SIZE));
+
+	while (response.size() < total) {
+		const size_t toRead = std::min<size_t>(PACKET_SIZE, total - response.size());
+		if (!socket.read(buffer, toRead)) {
+			socket.closeSocket();
+			return false;
+		}
+		response.insert(response.end(), buffer, buffer + toRead);
+	}
+
+	socket.closeSocket();
+	return true;
+}
+
+
+void replayOnline(const Options& options, const std::vector<Exchange>& exchanges, std::map<uint16_t, CodeResult>& results) {
+	SocketHandler socket(options.address, options.port);
+	std::vector<uint8_t> response;
+
+	for (size_t round = 0; round < options.repeat; ++round) {
+		const auto start = std::chrono::steady_clock::now();
+		for (const auto& exchange : exchanges) {
+			if (options.originalPace) std::this_thread::sleep_until(start + std::chrono::microseconds(exchange.timestamp));
+
+			CodeResult& result = results[exchange.code];
+			const auto sent = std::chrono::steady_clock::now();
+			if (!roundTrip(socket, exchange, response)) {
+				++result.errors;
+				continue;
+			}
+			result.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent).count());
+			if (responseCode(response) != responseCode(exchange.response)) ++result.mismatches;
+		}
+	}
+}
+
+
+/**
+ * Feed the captured responses to the client's payload parser, no network involved.
+ */
+void replayOffline(const Options& options, const std::vector<Exchange>& exchanges, std::map<uint16_t, CodeResult>& results) {
+	std::vector<UnpackClient> clients;
+	std::vector<ParsedMessage> messages;
+
+	for (size_t round = 0; round < options.repeat; ++round) {
+		for (const auto& exchange : exchanges) {
+			if (exchange.response.size() < sizeof(ResponseHeader)) continue;
+			ResponseHeader header;
+			memcpy(&header, exchange.response.data(), sizeof(header));
+			const uint8_t* payload = exchange.response.data() + sizeof(header);
+			const size_t size = std::min<size_t>(header.payloadtSize, exchange.response.size() - sizeof(header));
+
+			if (header.code != GET_CLIENTS_LIST_SUCCESS && header.code != GET_UNREAD_MESSAGES_SUCCESS) continue;
+
+			CodeResult& result = results[exchange.code];
+			const auto start = std::chrono::steady_clock::now();
+			const bool valid = (header.code == GET_CLIENTS_LIST_SUCCESS)
+				? PayloadParser::parseClients(payload, size, clients)
+				: PayloadParser::parseMessages(payload, size, messages);
+
+			result.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			if (!valid) ++result.errors;
+		}
+	}
+}
+
+
+
+void report(const std::map<uint16_t, CodeResult>& results, double seconds) {
+	size_t total = 0;
+	std::printf("%-8s %10s %8s %11s %12s %12s %12s\n", "code", "ok", "errors", "mismatches", "p50 ms", "p99 ms", "max ms");
+	for (const auto& [code, result] : results) {
+		total += result.latency.count();
+		std::printf("%-8u %10llu %8zu %11zu %12.3f %12.3f %12.3f\n", code, static_cast<unsigned long long>(result.latency.count()), result.errors,
+			result.mismatches, result.latency.percentile(0.50) / 1e6, result.latency.percentile(0.99) / 1e6, result.latency.max() / 1e6);
+	}
+	std::printf("%zu requests in %.3f seconds, %.1f req/s\n", total, seconds, seconds > 0 ? total / seconds : 0);
+}
+
+
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+	try {
+		for (int i = 1; i < argc; ++i) {
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (arg == "--fast") options.originalPace = false;
+			else if (arg == "--offline") options.offline = true;
+			else if (arg == "--capture" && hasValue) options.capturePath = argv[++i];
+			else if (arg == "--address" && hasValue) options.address = argv[++i];
+			else if (arg == "--port" && hasValue) options.port = argv[++i];
+			else if (arg == "--repeat" && hasValue) options.repeat = std::stoul(argv[++i]);
+			else return false;
+		}
+	} catch (...) {
+		return false;
+	}
+	return !options.capturePath.empty() && options.repeat > 0;
+}
+
+
+
+/**
+ * Usage: Replay --capture <file> [--address ip] [--port port] [--fast] [--offline] [--repeat n]
+ *
+ * Requests are sent as captured, so the server must know the captured client IDs
+ * (replay against a copy of the database the capture was taken with).
+ */
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		std::cout << "Usage: Replay --capture <file> [--address ip] [--port port] [--fast] [--offline] [--repeat n]" << std::endl;
+		return 1;
+	}
+
+	std::vector<Exchange> exchanges;
+	if (!loadCapture(options.capturePath, exchanges)) {
+		std::cout << "Can not read capture file '" << options.capturePath << "'" << std::endl;
+		return 1;
+	}
+	std::cout << "Loaded " << exchanges.size() << " requests from '" << options.capturePath << "'" << std::endl;
+
+	std::map<uint16_t, CodeResult> results;
+	const auto start = std::chrono::steady_clock::now();
+	if (options.offline) replayOffline(options, exchanges, results);
+	else replayOnline(options, exchanges, results);
+
+	report(results, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	return 0;
+}
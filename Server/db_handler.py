@@ -1,21 +1,35 @@
 import sqlite3
-from datetime import datetime
+import time
 import uuid
-from protocol import CLIENT_ID_SIZE, NAME_SIZE, PUBLIC_KEY_SIZE
+import hashlib
+import os
+import collections
+import contextlib
+from protocol import CLIENT_ID_SIZE, NAME_SIZE, PUBLIC_KEY_SIZE, MESSAGE_TYPE_MASK, MessageType
 
 
 
+# A message body kept in a file of the spool directory instead of the database
+SpoolFile = collections.namedtuple("SpoolFile", ["path", "size"])
+
+
 
 class DB_Handler():
     DB_PATH = "server.db"
     CLIENTS_TABLE = "Clients"
     MESSAGES_TABLE = "Messages"
+    CHUNKS_TABLE = "Chunks"
+    CHUNK_SIZE = 64 * 1024
+    HASH_SIZE = hashlib.sha256().digest_size
+    SPOOL_THRESHOLD = 1024 * 1024      # larger file bodies are spooled to disk as one chunk
+    STATEMENT_CACHE_SIZE = 256
 
     create_table_clients_sql = f""" CREATE TABLE IF NOT EXISTS {CLIENTS_TABLE}(
                                     ID CHAR({CLIENT_ID_SIZE}) NOT NULL UNIQUE PRIMARY KEY,
                                     Name CHAR({NAME_SIZE}) NOT NULL,
                                     PublicKey CHAR({PUBLIC_KEY_SIZE}) NOT NULL,
-                                    LastSeen DATE
+                                    LastSeen DATE,
+                                    KeyType INTEGER NOT NULL DEFAULT 0
                                 ); """
 
 
@@ -30,43 +44,138 @@ class DB_Handler():
                                 ); """
 
 
-    def __init__(self):
-        self.path = self.DB_PATH
+    # File bodies are split into chunks stored once per ciphertext hash, messages keep the list of hashes.
+    # A spooled chunk has no Data, its bytes are in the spool file named by its hash.
+    create_table_chunks_sql = f"""CREATE TABLE IF NOT EXISTS {CHUNKS_TABLE}(
+                                    Hash BLOB NOT NULL PRIMARY KEY,
+                                    Data BLOB NOT NULL,
+                                    RefCount INTEGER NOT NULL
+                                ); """
+
+
+    def __init__(self, path=None):
+        self.path = path or self.DB_PATH
+        self.spool_dir = os.path.splitext(self.path)[0] + "_spool"
+        self.conn = None
+        self.depth = 0          # transactions open
+        self.removals = []      # spool files to remove when the transaction commits
         self.init()
 
 
     def init(self):
-        self.execute(self.create_table_clients_sql, script=True, commit=True)
-        self.execute(self.create_table_messages_sql, script=True, commit=True)
+        if not self.migrate():
+            raise RuntimeError(f"Can not bring the schema of {self.path} up to date")
+        os.makedirs(self.spool_dir, exist_ok=True)
+        self.collect_chunks()
+
+
+    def migrate(self):
+        """ Runs the migrations the database has not seen yet, each in its own transaction with the version it reaches. """
+        version = self.execute("PRAGMA user_version", res=True)
+        if not version:
+            return False
+        for number, migration in enumerate(self.MIGRATIONS[version[0][0]:], version[0][0] + 1):
+            def work(c):
+                migration(self, c)
+                c.execute(f"PRAGMA user_version = {number}")
+                return True
+            if not self.transaction(work):
+                return False
+        return True
+
+
+    def add_column_if_missing(self, c, table, column, definition):
+        columns = c.execute(f"PRAGMA table_info({table})").fetchall()
+        if columns and column not in [col[1] for col in columns]:
+            c.execute(f"ALTER TABLE {table} ADD COLUMN {column} {definition}")
+
+
+    def migrate_legacy_schema(self, c):
+        """ 1: the tables as the server created them before versioning, older databases may lack some columns. """
+        c.execute(self.create_table_clients_sql)
+        c.execute(self.create_table_messages_sql)
+        c.execute(self.create_table_chunks_sql)
+        self.add_column_if_missing(c, self.CLIENTS_TABLE, "KeyType", "INTEGER NOT NULL DEFAULT 0")
+        self.add_column_if_missing(c, self.MESSAGES_TABLE, "ChunkList", "BLOB")
+        self.add_column_if_missing(c, self.CHUNKS_TABLE, "Spooled", "INTEGER NOT NULL DEFAULT 0")
+
+
+    def migrate_typed_indexed_schema(self, c):
+        """
+        2: integer Type and LastSeen (unix time), unique names and an index for the unread messages of a client.
+        SQLite can not change column types, both tables are copied into new ones. Of clients sharing a name
+        the first registered keeps it.
+        """
+        c.execute(f"""CREATE TABLE {self.CLIENTS_TABLE}_new(
+                        ID BLOB NOT NULL PRIMARY KEY,
+                        Name TEXT NOT NULL,
+                        PublicKey BLOB NOT NULL,
+                        LastSeen INTEGER,
+                        KeyType INTEGER NOT NULL DEFAULT 0
+                    )""")
+        c.execute(f"CREATE UNIQUE INDEX ClientsName ON {self.CLIENTS_TABLE}_new (Name)")
+        c.execute(f"""INSERT OR IGNORE INTO {self.CLIENTS_TABLE}_new (ID, Name, PublicKey, LastSeen, KeyType)
+                        SELECT ID, Name, PublicKey,
+                               CAST(strftime('%s', substr(LastSeen, 7, 4) || '-' || substr(LastSeen, 4, 2) || '-' || substr(LastSeen, 1, 2)
+                                                   || ' ' || substr(LastSeen, 12), 'utc') AS INTEGER),
+                               KeyType
+                        FROM {self.CLIENTS_TABLE} ORDER BY rowid""")
+        c.execute(f"DROP TABLE {self.CLIENTS_TABLE}")
+        c.execute(f"ALTER TABLE {self.CLIENTS_TABLE}_new RENAME TO {self.CLIENTS_TABLE}")
+
+        c.execute(f"""CREATE TABLE {self.MESSAGES_TABLE}_new(
+                        ID INTEGER PRIMARY KEY,
+                        ToClient BLOB NOT NULL,
+                        FromClient BLOB NOT NULL,
+                        Type INTEGER NOT NULL,
+                        Content BLOB,
+                        ChunkList BLOB,
+                        FOREIGN KEY(ToClient) REFERENCES {self.CLIENTS_TABLE} (ID),
+                        FOREIGN KEY(FromClient) REFERENCES {self.CLIENTS_TABLE} (ID)
+                    )""")
+        c.execute(f"""INSERT INTO {self.MESSAGES_TABLE}_new (ID, ToClient, FromClient, Type, Content, ChunkList)
+                        SELECT ID, ToClient, FromClient, CAST(Type AS INTEGER), Content, ChunkList FROM {self.MESSAGES_TABLE}""")
+        c.execute(f"DROP TABLE {self.MESSAGES_TABLE}")
+        c.execute(f"ALTER TABLE {self.MESSAGES_TABLE}_new RENAME TO {self.MESSAGES_TABLE}")
+        c.execute(f"CREATE INDEX MessagesToClient ON {self.MESSAGES_TABLE} (ToClient, ID)")
+
+
+    # Append only, PRAGMA user_version is the number of migrations a database went through
+    MIGRATIONS = [migrate_legacy_schema, migrate_typed_indexed_schema]
 
 
     def connect(self):
-        conn = None
-        try:
-            conn = sqlite3.connect(self.path)
-            return conn
-        except:
-            pass
-        
-        return conn
+        """ The one connection of the handler, opened on first use and kept, with its prepared statements. """
+        if self.conn is None:
+            try:
+                self.conn = sqlite3.connect(self.path, isolation_level=None, cached_statements=self.STATEMENT_CACHE_SIZE)
+                self.conn.execute("PRAGMA journal_mode=WAL")
+                self.conn.execute("PRAGMA synchronous=NORMAL")     # WAL stays consistent, only the last commits may be lost on power loss
+            except Exception as e:
+                print(e)
+                self.conn = None
+        return self.conn
+
+
+    def close(self):
+        if self.conn is not None:
+            self.conn.close()
+            self.conn = None
 
 
     def execute(self, command, args = [], script = False, commit = False, res=False, get_id=False):
+        """ A statement outside of a transaction commits on its own, commit is only kept for the callers. """
         return_val = True
         try:
-            conn = self.connect()
-            c = conn.cursor()
+            c = self.connect().cursor()
             if not script:
                 c.execute(command, args)
             else:
                 c.executescript(command)
-            if commit:
-                conn.commit()
             if res:
                 return_val = c.fetchall()
             elif get_id:
                 return_val = c.lastrowid
-            conn.close()
             return return_val
         except Exception as e:
             print(e)
@@ -74,15 +183,78 @@ class DB_Handler():
         return False
 
 
-    def insert_client(self, client_id, client_name, public_key):
+    def begin(self):
+        """ Transactions nest as savepoints, releasing the outermost one commits. """
+        savepoint = f"sp{self.depth}"
+        self.connect().execute(f"SAVEPOINT {savepoint}")
+        self.depth += 1
+        return savepoint, len(self.removals)
+
+
+    def end(self, token, ok):
+        savepoint, removals = token
+        self.depth -= 1
+        try:
+            if not ok:
+                self.conn.execute(f"ROLLBACK TO {savepoint}")
+                del self.removals[removals:]
+            self.conn.execute(f"RELEASE {savepoint}")
+        except Exception as e:
+            print(e)
+            ok = False
+            if self.depth == 0 and self.conn.in_transaction:
+                self.conn.execute("ROLLBACK")
+
+        if self.depth == 0:
+            # files go only once the rows that referred to them are gone for good
+            for path in (self.removals if ok else []):
+                self.remove_spool_file(path)
+            self.removals = []
+        return ok
+
+
+    def transaction(self, work):
+        """ Runs work(cursor) in one transaction, returns its result or False when anything failed. """
+        try:
+            token = self.begin()
+        except Exception as e:
+            print(e)
+            return False
+        try:
+            result = work(self.conn.cursor())
+        except Exception as e:
+            print(e)
+            self.end(token, False)
+            return False
+        return result if self.end(token, True) else False
+
+
+    @contextlib.contextmanager
+    def request(self):
+        """ Scopes all the statements of one request in one transaction. """
+        token = self.begin()
+        try:
+            yield
+        except:
+            self.end(token, False)
+            raise
+        self.end(token, True)
+
+
+    def insert_client(self, client_id, client_name, public_key, key_type=0):
+        """ False when a field is invalid or the name is taken, the unique index decides, not an earlier lookup. """
         if len(client_id) != CLIENT_ID_SIZE or len(client_name) >= NAME_SIZE or len(public_key) != PUBLIC_KEY_SIZE:
             return False
-        last_seen = datetime.now().strftime("%d/%m/%Y %H:%M:%S")
-        sql = f"INSERT INTO {self.CLIENTS_TABLE} VALUES (?, ?, ?, ?)"
-        return self.execute(sql, [client_id, client_name, public_key, last_seen], commit=True)
+        sql = f"""INSERT INTO {self.CLIENTS_TABLE} (ID, Name, PublicKey, LastSeen, KeyType) VALUES (?, ?, ?, ?, ?)
+                  ON CONFLICT(Name) DO NOTHING RETURNING ID"""
+        return bool(self.execute(sql, [client_id, client_name, public_key, int(time.time()), key_type], res=True))
 
 
     def insert_message(self, to_id, from_id, msg_type, msg):
+        if (int(msg_type) & MESSAGE_TYPE_MASK) == MessageType.FILE.value and len(msg) > self.SPOOL_THRESHOLD:
+            return self.insert_spooled_message(to_id, from_id, msg_type, msg)
+        if (int(msg_type) & MESSAGE_TYPE_MASK) == MessageType.FILE.value and msg:
+            return self.insert_chunked_message(to_id, from_id, msg_type, msg)
         sql = f"INSERT INTO {self.MESSAGES_TABLE} (ToClient, FromClient, Type, Content) VALUES (?, ?, ?, ?)"
         id = self.execute(sql, [to_id, from_id, msg_type, msg], commit=True, get_id=True)
         if not id:
@@ -90,8 +262,65 @@ class DB_Handler():
         return id
 
 
+    def insert_chunked_message(self, to_id, from_id, msg_type, msg):
+        """ Chunks already stored only gain a reference, the row keeps the concatenated chunk hashes. """
+        chunks = [bytes(msg[i:i + self.CHUNK_SIZE]) for i in range(0, len(msg), self.CHUNK_SIZE)]
+        hashes = [hashlib.sha256(chunk).digest() for chunk in chunks]
+
+        def work(c):
+            c.executemany(f"""INSERT INTO {self.CHUNKS_TABLE} (Hash, Data, RefCount) VALUES (?, ?, 1)
+                              ON CONFLICT(Hash) DO UPDATE SET RefCount = RefCount + 1""", zip(hashes, chunks))
+            c.execute(f"INSERT INTO {self.MESSAGES_TABLE} (ToClient, FromClient, Type, ChunkList) VALUES (?, ?, ?, ?)",
+                      [to_id, from_id, msg_type, b"".join(hashes)])
+            return c.lastrowid
+
+        return self.transaction(work)
+
+
+    def insert_spooled_message(self, to_id, from_id, msg_type, msg):
+        """ The body is written once per ciphertext hash, the file is in place before the row refers to it. """
+        hash = hashlib.sha256(msg).digest()
+        path = self.spool_path(hash)
+        if not os.path.exists(path):
+            try:
+                with open(path + ".tmp", "wb") as file:
+                    file.write(msg)
+                os.replace(path + ".tmp", path)
+            except OSError as e:
+                print(e)
+                return False
+
+        def work(c):
+            c.execute(f"""INSERT INTO {self.CHUNKS_TABLE} (Hash, Data, RefCount, Spooled) VALUES (?, ?, 1, 1)
+                           ON CONFLICT(Hash) DO UPDATE SET RefCount = RefCount + 1""", [hash, b""])
+            c.execute(f"INSERT INTO {self.MESSAGES_TABLE} (ToClient, FromClient, Type, ChunkList) VALUES (?, ?, ?, ?)",
+                      [to_id, from_id, msg_type, hash])
+            return c.lastrowid
+
+        return self.transaction(work)
+
+
+    def spool_path(self, hash):
+        return os.path.join(self.spool_dir, hash.hex())
+
+
+    def load_chunks(self, c, chunk_list):
+        """ Returns the body, or a SpoolFile for a spooled body so it is not read into memory. """
+        hashes = [chunk_list[i:i + self.HASH_SIZE] for i in range(0, len(chunk_list), self.HASH_SIZE)]
+        data = {}
+        for hash in set(hashes):
+            row = c.execute(f"SELECT Data, Spooled FROM {self.CHUNKS_TABLE} WHERE Hash = ?", [hash]).fetchone()
+            if row is None:
+                raise ValueError("Missing chunk of a stored message")
+            if row[1]:
+                path = self.spool_path(hash)
+                return SpoolFile(path, os.path.getsize(path))
+            data[hash] = row[0]
+        return b"".join(data[hash] for hash in hashes)
+
+
     def get_clients_list(self):
-        sql = f"SELECT * FROM {self.CLIENTS_TABLE}"
+        sql = f"SELECT ID, Name FROM {self.CLIENTS_TABLE}"
         return self.execute(sql, res=True)
 
 
@@ -102,11 +331,11 @@ class DB_Handler():
 
 
     def select_public_key(self, name):
-        sql = f"SELECT PublicKey FROM {self.CLIENTS_TABLE} WHERE Name = ?"
+        sql = f"SELECT PublicKey, KeyType FROM {self.CLIENTS_TABLE} WHERE Name = ?"
         res = self.execute(sql, [name], res=True)
         if not res:
             return False
-        return res[0][0]
+        return res[0]
 
     """  
     def select_public_key(self, client_id):
@@ -126,22 +355,81 @@ class DB_Handler():
         
 
     def select_unread_messages(self, to_id):
-        sql = f"SELECT FromClient, ID, Type, Content FROM {self.MESSAGES_TABLE} WHERE ToClient = ?"
-        res = self.execute(sql, [to_id], res=True)
+        def work(c):
+            rows = c.execute(f"SELECT FromClient, ID, Type, Content, ChunkList FROM {self.MESSAGES_TABLE} WHERE ToClient = ?", [to_id]).fetchall()
+            return [(from_id, id, type, self.load_chunks(c, chunk_list) if chunk_list else content)
+                    for from_id, id, type, content, chunk_list in rows]
+
+        res = self.transaction(work)
         if not res:
             return False
         return res
 
     
     def delete_msg(self, msg_id):
-        sql = f"DELETE FROM {self.MESSAGES_TABLE} WHERE ID = ?"
-        return self.execute(sql, [msg_id], commit=True)
+        """ Drops the message's references to its chunks, chunks nothing refers to anymore go with it. """
+        def work(c):
+            row = c.execute(f"SELECT ChunkList FROM {self.MESSAGES_TABLE} WHERE ID = ?", [msg_id]).fetchone()
+            c.execute(f"DELETE FROM {self.MESSAGES_TABLE} WHERE ID = ?", [msg_id])
+            if not row or not row[0]:
+                return True
+            chunk_list = row[0]
+            hashes = [[chunk_list[i:i + self.HASH_SIZE]] for i in range(0, len(chunk_list), self.HASH_SIZE)]
+            c.executemany(f"UPDATE {self.CHUNKS_TABLE} SET RefCount = RefCount - 1 WHERE Hash = ?", hashes)
+            for (hash,) in hashes:
+                if c.execute(f"SELECT 1 FROM {self.CHUNKS_TABLE} WHERE Hash = ? AND RefCount <= 0 AND Spooled = 1", [hash]).fetchone():
+                    self.removals.append(self.spool_path(hash))
+            c.executemany(f"DELETE FROM {self.CHUNKS_TABLE} WHERE Hash = ? AND RefCount <= 0", hashes)
+            return True
+
+        return self.transaction(work)
+
+
+    # A file still open for sending on Windows stays, the next collection removes it
+    def remove_spool_file(self, path):
+        try:
+            os.remove(path)
+        except OSError as e:
+            print(e)
+
+
+    def collect_chunks(self):
+        """ Recounts the references of every chunk from the messages and drops the unreferenced ones. """
+        def work(c):
+            counts = {}
+            for (chunk_list,) in c.execute(f"SELECT ChunkList FROM {self.MESSAGES_TABLE} WHERE ChunkList IS NOT NULL"):
+                for i in range(0, len(chunk_list), self.HASH_SIZE):
+                    hash = chunk_list[i:i + self.HASH_SIZE]
+                    counts[hash] = counts.get(hash, 0) + 1
+            c.execute(f"UPDATE {self.CHUNKS_TABLE} SET RefCount = 0")
+            c.executemany(f"UPDATE {self.CHUNKS_TABLE} SET RefCount = ? WHERE Hash = ?", [(n, h) for h, n in counts.items()])
+            c.execute(f"DELETE FROM {self.CHUNKS_TABLE} WHERE RefCount <= 0")
+            return {hash.hex() for (hash,) in c.execute(f"SELECT Hash FROM {self.CHUNKS_TABLE} WHERE Spooled = 1")}
+
+        spooled = self.transaction(work)
+        if spooled is False:
+            return False
+        # spool files without a chunk, left by a failed insert or delete
+        for name in os.listdir(self.spool_dir):
+            if name not in spooled:
+                self.remove_spool_file(os.path.join(self.spool_dir, name))
+        return True
+
+
+    def select_clients(self, after=0):
+        """ The clients registered after the given rowid in registration order, for the server's in-memory registry. """
+        sql = f"SELECT rowid, ID, Name, PublicKey, KeyType FROM {self.CLIENTS_TABLE} WHERE rowid > ? ORDER BY rowid"
+        return self.execute(sql, [after], res=True)
+
 
+    def update_last_seen(self, last_seen):
+        """ Writes a batch of client ID -> unix time in one transaction. """
+        def work(c):
+            c.executemany(f"UPDATE {self.CLIENTS_TABLE} SET LastSeen = ? WHERE ID = ?",
+                          [(seen, client_id) for client_id, seen in last_seen.items()])
+            return True
 
-    def update_last_seen(self, client_id): 
-        last_seen = datetime.now().strftime("%d/%m/%Y %H:%M:%S")
-        sql = f"UPDATE {self.CLIENTS_TABLE} SET LastSeen = ? WHERE ID = ?"
-        return self.execute(sql, [last_seen, client_id], commit=True)
+        return self.transaction(work)
 
 
 
@@ -1,4 +1,5 @@
 import logging
+import argparse
 from webbrowser import get
 from xmlrpc.client import Server
 import server
@@ -6,6 +7,7 @@ import server
 
 PORT_INFO_PATH = "port.info"
 HOST = "127.0.0.1"  # Standard loopback interface address (localhost)
+MIB = 1024 * 1024
 
 
 def get_port():
@@ -17,11 +19,37 @@ def get_port():
         return None
 
 
+def get_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, help=f"instead of the one in {PORT_INFO_PATH}")
+    parser.add_argument("--shard", help="INDEX/COUNT, this instance owns the clients whose ID maps to INDEX. "
+                                        "The clients' server.info lists the instances in index order and 'mode=shard'.")
+    parser.add_argument("--connection-limit", type=int, help="MiB of unfinished requests one connection may hold, "
+                                                             f"{server.Server.CONNECTION_LIMIT // MIB} by default")
+    parser.add_argument("--memory-limit", type=int, help="MiB of unfinished requests over all connections before reading pauses, "
+                                                         f"{server.Server.MEMORY_LIMIT // MIB} by default")
+    return parser.parse_args()
+
+
 def main():
-    port = get_port()
+    args = get_args()
+    port = args.port or get_port()
     if not port:
         logging.error()
-    s = server.Server("127.0.0.1", port)
+
+    shard, shards, db_path = 0, 1, None
+    if args.shard:
+        try:
+            shard, shards = [int(n) for n in args.shard.split("/")]
+        except ValueError:
+            shards = 0
+        if shards < 1 or not 0 <= shard < shards:
+            logging.error("Invalid shard, expected INDEX/COUNT")
+            exit(1)
+        db_path = f"server_shard{shard}.db"     # the shards don't share clients
+    connection_limit = args.connection_limit * MIB if args.connection_limit else None
+    memory_limit = args.memory_limit * MIB if args.memory_limit else None
+    s = server.Server("127.0.0.1", port, shard, shards, db_path, connection_limit, memory_limit)
     
     if not s.listen():
         logging.error("Exit")
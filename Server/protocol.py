@@ -9,6 +9,15 @@ CLIENT_ID_SIZE = 16
 NAME_SIZE = 255
 PUBLIC_KEY_SIZE = 160
 MESSAGE_ID_SIZE = 4
+KEY_TYPE_SIZE = 1
+KEY_TYPE_VERSION = 2    # first client version that sends the identity key type
+MAX_FRAME_SIZE = 16384  # payload bytes of one frame on a multiplexed connection
+FRAME_END = 0x01        # last frame of a request or response
+
+
+def shard_of(client_id, shard_count):
+    """ Must match the client: the first 4 bytes of the ID as a little endian number, modulo the shard count. """
+    return int.from_bytes(client_id[:4], 'little') % shard_count
 
 
 class RequestCodes(Enum):
@@ -17,6 +26,7 @@ class RequestCodes(Enum):
     GET_PUBLIC_KEY = 1002
     SEND_MESSAGE = 1003
     GET_UNREAD_MESSAGE = 1004
+    OPEN_MULTIPLEX = 1100
 
 
 class ResponseCodes(Enum):
@@ -25,6 +35,7 @@ class ResponseCodes(Enum):
     GET_PUBLIC_KEY_SUCCESS = 2002
     MESSAGE_SENT_SUCCESS = 2003
     GET_UNREAD_MESSAGES_SUCCESS = 2004
+    MULTIPLEX_ACCEPTED = 2100
     GENERIC_ERROR = 9000
 
 
@@ -38,6 +49,17 @@ class MessageType(Enum):
 
 
 
+COMPRESSED_MESSAGE = 0x80      # message type flag, the content was deflated before encryption
+MESSAGE_TYPE_MASK = 0x7F
+
+
+
+class KeyType(Enum):
+    RSA = 0
+    X25519 = 1
+
+
+
 class RequestHeader():   
     REQ_HEADER_SIZE = CLIENT_ID_SIZE + 7
 
@@ -64,6 +86,7 @@ class RegistrationRequest():
         self.header = RequestHeader()
         self.name = b""
         self.public_key = b""
+        self.key_type = KeyType.RSA.value
 
 
     def unpack(self, data):
@@ -75,7 +98,10 @@ class RegistrationRequest():
                 self.name = struct.unpack(f"<{NAME_SIZE}s", data[offset : offset + NAME_SIZE])[0].partition(b'\0')[0].decode()
                 offset += NAME_SIZE
                 self.public_key = struct.unpack(f"<{PUBLIC_KEY_SIZE}s", data[offset : offset + PUBLIC_KEY_SIZE])[0]
-                return True
+                offset += PUBLIC_KEY_SIZE
+                if self.header.client_version >= KEY_TYPE_VERSION:
+                    self.key_type = struct.unpack("<B", data[offset : offset + KEY_TYPE_SIZE])[0]
+                return self.key_type in [t.value for t in KeyType]
             except:
                 return False
 
@@ -129,7 +155,8 @@ class SendMessageRequest():
         self.message_content = b""
         
 
-    def unpack(self, conn, data, packet_size):
+    def unpack(self, data):
+        """ data holds the whole request, the server collects it before handling it. """
         if not self.header or not self.header.unpack(data):
            return False
         else:
@@ -139,20 +166,48 @@ class SendMessageRequest():
                 offset += CLIENT_ID_SIZE
                 self.message_type, self.content_size = struct.unpack("<BI", data[offset:offset + self.MESSAGE_TYPE_SIZE + self.CONTENT_SIZE])
                 offset += self.MESSAGE_TYPE_SIZE + self.CONTENT_SIZE
-                bytes_to_read = min(self.content_size, 
-                                packet_size - self.header.payload_size - CLIENT_ID_SIZE -  self.MESSAGE_TYPE_SIZE - self.CONTENT_SIZE)                 
-                self.message_content = struct.unpack(f"{bytes_to_read}s", data[offset:offset+bytes_to_read])[0]
-
-                while bytes_to_read < self.content_size:
-                    extra_data = conn.recv(packet_size)
-                    extra_data_len = min(len(extra_data), self.content_size - bytes_to_read)
-                    self.message_content += struct.unpack(f"{len(extra_data_len)}s", extra_data[:extra_data_len])[0]
-                    bytes_to_read += extra_data_len
+                if len(data) - offset < self.content_size:
+                    return False
+                self.message_content = bytes(data[offset:offset + self.content_size])
                 return True
             except:
                 return False
 
 
+class Frame():
+    """ A piece of one request or response on a multiplexed connection, tagged with its stream ID. """
+    HEADER_SIZE = 7
+    MAX_SIZE = HEADER_SIZE + 0xFFFF
+
+    def __init__(self, stream_id=0, flags=0, payload=b""):
+        self.stream_id = stream_id
+        self.flags = flags
+        self.payload = payload
+        self.size = self.HEADER_SIZE + len(payload)
+
+
+    def unpack(self, data):
+        """ False until data holds the whole frame. """
+        try:
+            if len(data) < self.HEADER_SIZE:
+                return False
+            self.stream_id, self.flags, length = struct.unpack("<IBH", data[:self.HEADER_SIZE])
+            if len(data) < self.HEADER_SIZE + length:
+                return False
+            self.payload = bytes(data[self.HEADER_SIZE:self.HEADER_SIZE + length])
+            self.size = self.HEADER_SIZE + length
+            return True
+        except:
+            return False
+
+
+    def pack(self):
+        try:
+            return struct.pack("<IBH", self.stream_id, self.flags, len(self.payload)) + self.payload
+        except:
+            return b""
+
+
 class ResponseHeader():
 
     RESP_HEADER_SIZE = 7
@@ -206,17 +261,21 @@ class ClientsListResponse():
 
 
 class PublicKeyResponse():
-    def __init__(self, server_version, code, payload_size, client_id, public_key):
+    def __init__(self, server_version, code, payload_size, client_id, public_key, key_type=None):
         self.header = ResponseHeader(server_version, code, payload_size)
         self.client_id = client_id
         self.public_key = public_key
+        self.key_type = key_type    # left out for clients older than KEY_TYPE_VERSION
     
     def pack(self):
         packed_header = self.header.pack()
         if not packed_header:
             return b""
         try:
-            return packed_header + struct.pack(f"<{CLIENT_ID_SIZE}s{PUBLIC_KEY_SIZE}s", self.client_id, self.public_key)
+            packed = packed_header + struct.pack(f"<{CLIENT_ID_SIZE}s{PUBLIC_KEY_SIZE}s", self.client_id, self.public_key)
+            if self.key_type is not None:
+                packed += struct.pack("<B", self.key_type)
+            return packed
         except:
             return b""
 
@@ -271,3 +330,11 @@ class Message():
                                                 self.from_id, self.id, self.type, self.size, self.content)
         except:
             return b""
+
+
+    def pack_header(self):
+        """ Everything but the content, for a content that is sent from its file. """
+        try:
+            return struct.pack(f"<{CLIENT_ID_SIZE}sLBL", self.from_id, self.id, self.type, self.size)
+        except:
+            return b""
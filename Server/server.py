@@ -2,26 +2,328 @@ from cgi import print_form
 import socket
 import logging
 import selectors
+import collections
 from unicodedata import name
 import protocol
 import db_handler
 import uuid
+import time
+import os
 
 
 
 
+class StreamWriter:
+    """ Stands in for the connection in the request handlers, collects one response.
+        It is sent once the request's transaction committed, a client never holds the database up. """
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.parts = None       # a response kept as its parts, spooled message bodies stay files
+        self.name = None
+        self.delivered = None   # runs once the response is sent
+
+    def send(self, data):
+        self.buffer += data
+        return len(data)
+
+    def recv(self, size):
+        return b""      # requests arrive whole
+
+    def send_parts(self, parts):
+        self.parts = parts
+
+    def clear(self):
+        self.buffer.clear()
+        self.parts = None
+        self.delivered = None
+
+    def empty(self):
+        return not self.buffer and not self.parts
+
+    def response(self):
+        return SpooledResponse(self.parts) if self.parts else bytes(self.buffer)
+
+
+
+class SpooledResponse:
+    """ A response whose spooled message bodies are read from their files a frame at a time. """
+
+    def __init__(self, parts):
+        # opened right away, the files are removed as soon as the messages count as delivered
+        self.parts = [(part, open(part.path, "rb")) if isinstance(part, db_handler.SpoolFile) else (part, None) for part in parts]
+        self.size = sum(part.size if file else len(part) for part, file in self.parts)
+        self.memory = sum(len(part) for part, file in self.parts if not file)     # bytes not read from a file
+
+    def __len__(self):
+        return self.size
+
+    def __getitem__(self, window):
+        data = bytearray()
+        offset = 0
+        for part, file in self.parts:
+            length = part.size if file else len(part)
+            start, end = max(window.start - offset, 0), min(window.stop - offset, length)
+            if start < end:
+                if file:
+                    file.seek(start)
+                    data += file.read(end - start)
+                else:
+                    data += part[start:end]
+            offset += length
+        if window.stop >= self.size:
+            for _, file in self.parts:
+                if file:
+                    file.close()
+        return bytes(data)
+
+
+class FileResponse:
+    """ The response of a plain connection, sent as far as the socket takes it on every write event.
+        Spooled message bodies go from their files to the socket with sendfile. """
+    STEP = 1024 * 1024      # bytes handed to one send call
+
+    def __init__(self, parts, timeout):
+        # opened right away, the files are removed as soon as the messages count as delivered
+        self.parts = collections.deque((part, open(part.path, "rb")) if isinstance(part, db_handler.SpoolFile) else (part, None) for part in parts)
+        self.offset = 0         # into the first part
+        self.timeout = timeout
+        self.deadline = time.monotonic() + timeout     # moved on by every send that makes progress
+
+    def send(self, conn):
+        """ True once everything is sent, raises OSError when the connection fails. """
+        while self.parts:
+            part, file = self.parts[0]
+            length = part.size if file else len(part)
+            if self.offset < length:
+                count = min(length - self.offset, self.STEP)
+                try:
+                    sent = self.send_file(conn, file, self.offset, count) if file else conn.send(memoryview(part)[self.offset:self.offset + count])
+                except BlockingIOError:
+                    return False
+                if not sent:
+                    raise OSError(f"{part.path} is shorter than {part.size} bytes" if file else "connection closed")
+                self.offset += sent
+                self.deadline = time.monotonic() + self.timeout
+                continue
+            if file:
+                file.close()
+            self.parts.popleft()
+            self.offset = 0
+        return True
+
+    @staticmethod
+    def send_file(conn, file, offset, count):
+        if hasattr(os, "sendfile"):
+            return os.sendfile(conn.fileno(), file.fileno(), offset, count)
+        # no sendfile on Windows, the step goes through a buffer
+        file.seek(offset)
+        return conn.send(file.read(count))
+
+    def close(self):
+        for _, file in self.parts:
+            if file:
+                file.close()
+        self.parts.clear()
+
+
+class PendingRequest:
+    """ The request of a plain connection as far as it arrived, it is handled once complete. """
+
+    def __init__(self):
+        self.data = bytearray()
+        self.header = None
+        self.size = 0           # bytes of the whole request, known with the header
+        self.reserved = 0       # bytes of the memory limit held for it
+
+    def wanted(self, recv_size, packet_size):
+        """ Bytes to receive next. The first block is never read past, a multiplexed connection's frames follow it. """
+        if self.header is None:
+            return packet_size - len(self.data)
+        return min(recv_size, self.size - len(self.data))
+
+    def parse_header(self, packet_size):
+        """ False until the header is in. """
+        if self.header is None:
+            header = protocol.RequestHeader()
+            if len(self.data) < header.size or not header.unpack(self.data):
+                return False
+            self.header = header
+            # the client pads its requests to whole blocks, the switch to frames takes exactly the first block.
+            # The padding is read too, closing with it unread resets the connection under the response.
+            if header.code == protocol.RequestCodes.OPEN_MULTIPLEX.value:
+                self.size = packet_size
+            else:
+                self.size = (header.size + header.payload_size + packet_size - 1) // packet_size * packet_size
+        return True
+
+    def complete(self):
+        return self.header is not None and len(self.data) >= self.size
+
+
+
+class MultiplexedConnection:
+    """ Reassembles the framed requests of one connection by stream ID and interleaves the response frames. """
+    SEND_BATCH = 65536
+
+    def __init__(self, greeting=b""):
+        self.inbound = bytearray()
+        self.streams = {}                       # stream ID -> request bytes so far
+        self.outbound = collections.deque()     # [stream ID, response, bytes framed, StreamWriter]
+        self.unsent = greeting                  # sent ahead of the first frame
+        self.framed = len(greeting)             # bytes ever queued for sending
+        self.sent = 0                           # of those, bytes the socket took
+        self.finishing = collections.deque()    # (framed count at the end of a stream's last frame, StreamWriter)
+        self.charged = 0                        # bytes of requests and responses counted against the memory limit
+
+    def buffered(self):
+        """ Bytes of requests not complete yet. """
+        return len(self.inbound) + sum(len(request) for request in self.streams.values())
+
+    def queued(self):
+        """ Bytes of responses waiting to be sent, spooled bodies stay in their files until then. """
+        return len(self.unsent) + sum(response.memory if isinstance(response, SpooledResponse) else len(response) - offset
+                                      for _, response, offset, _ in self.outbound)
+
+    def requests(self):
+        """ Yields (stream ID, request) for every request completed by the data received. """
+        frame = protocol.Frame()
+        offset = 0
+        while frame.unpack(self.inbound[offset:offset + protocol.Frame.MAX_SIZE]):
+            offset += frame.size
+            self.streams.setdefault(frame.stream_id, bytearray()).extend(frame.payload)
+            if frame.flags & protocol.FRAME_END:
+                yield frame.stream_id, bytes(self.streams.pop(frame.stream_id))
+        del self.inbound[:offset]
+
+    def respond(self, stream_id, response, writer):
+        self.outbound.append([stream_id, response, 0, writer])
+
+    def has_output(self):
+        return bool(self.unsent or self.outbound)
+
+    def next_batch(self):
+        """ One frame per response in turn, so a short response is not queued behind a long one. """
+        batch = bytearray(self.unsent)
+        while self.outbound and len(batch) < self.SEND_BATCH:
+            entry = self.outbound.popleft()
+            stream_id, response, offset, writer = entry
+            end = min(offset + protocol.MAX_FRAME_SIZE, len(response))
+            flags = protocol.FRAME_END if end == len(response) else 0
+            frame = protocol.Frame(stream_id, flags, response[offset:end]).pack()
+            batch += frame
+            self.framed += len(frame)
+            if end < len(response):
+                entry[2] = end
+                self.outbound.append(entry)
+            else:
+                self.finishing.append((self.framed, writer))
+        return bytes(batch)
+
+    def took(self, batch, sent):
+        """ Keeps what the socket did not take of the batch, returns the writers of the streams now completely sent. """
+        self.unsent = batch[sent:]
+        self.sent += sent
+        done = []
+        while self.finishing and self.finishing[0][0] <= self.sent:
+            done.append(self.finishing.popleft()[1])
+        return done
+
+
+class ClientRegistry:
+    """ The registered clients kept in memory, so a request does not need the database to know its sender.
+        Instances that share a database see each other's clients: a lookup that misses, and the clients list,
+        first read the registrations committed since the last read. A registration enters the registry only from
+        its committed row. LastSeen is collected here and written back in batches. """
+    FLUSH_INTERVAL = 5      # seconds between LastSeen writes
+
+    def __init__(self, db):
+        self.db = db
+        self.clients = {}       # client ID -> (name, public key, key type), in registration order
+        self.ids = {}           # name -> client ID
+        self.loaded = 0         # rowid of the last client read from the database
+        self.last_seen = {}     # client ID -> unix time not written yet
+        self.flushed = time.monotonic()
+
+    def load(self):
+        """ Reads the clients registered since the last load, False when the database fails. """
+        rows = self.db.select_clients(self.loaded)
+        if rows is False:
+            return False
+        for rowid, client_id, name, public_key, key_type in rows:
+            self.clients[client_id] = (name, public_key, key_type)
+            self.ids[name] = client_id
+            self.loaded = rowid
+        return True
+
+    def exists(self, client_id):
+        if client_id not in self.clients:
+            self.load()
+        return client_id in self.clients
+
+    def find(self, name):
+        """ Returns (client ID, public key, key type), or None for an unknown name. """
+        if name not in self.ids:
+            self.load()
+        client_id = self.ids.get(name)
+        if client_id is None:
+            return None
+        _, public_key, key_type = self.clients[client_id]
+        return client_id, public_key, key_type
+
+    def names(self):
+        self.load()
+        return [(client_id, name) for client_id, (name, _, _) in self.clients.items()]
+
+    def touch(self, client_id):
+        self.last_seen[client_id] = int(time.time())
+
+    def flush_due(self):
+        """ Seconds until the next flush, the selector waits no longer than that. """
+        return max(self.flushed + self.FLUSH_INTERVAL - time.monotonic(), 0)
+
+    def flush(self):
+        self.flushed = time.monotonic()
+        if not self.last_seen:
+            return True
+        last_seen, self.last_seen = self.last_seen, {}
+        if not self.db.update_last_seen(last_seen):
+            # kept for the next flush, unless a newer time came in meanwhile
+            for client_id, seen in last_seen.items():
+                self.last_seen.setdefault(client_id, seen)
+            return False
+        return True
+
+
+
 class Server:
     SERVER_VER = 2
     PACKET_SIZE = 1024
     MAX_CONNECTIONS = 5
+    RECV_SIZE = 65536       # bytes read per event once the header is in
+    SEND_TIMEOUT = 30       # seconds a response may go without sending a byte
+    CONNECTION_LIMIT = 64 * 1024 * 1024     # bytes of unfinished requests one connection may hold
+    MEMORY_LIMIT = 256 * 1024 * 1024        # the same over all connections, reading pauses beyond it
 
-    def __init__(self, host, port):
+    def __init__(self, host, port, shard=0, shards=1, db_path=None, connection_limit=None, memory_limit=None):
         self.host = host
         self.port = port
+        self.shard = shard      # index of this instance when the clients are sharded by ID
+        self.shards = shards
         self.version = self.SERVER_VER
         self.max_conn = self.MAX_CONNECTIONS
         self.sel = selectors.DefaultSelector()
-        self.db_handler = db_handler.DB_Handler()
+        self.multiplexed = {}       # connection -> MultiplexedConnection
+        self.pending = {}           # plain connection -> PendingRequest
+        self.sending = {}           # plain connection -> (FileResponse, response name, StreamWriter), closed once sent
+        self.connection_limit = connection_limit or self.CONNECTION_LIMIT
+        self.memory_limit = memory_limit or self.MEMORY_LIMIT
+        self.buffered = 0           # bytes reserved by plain connections and held by multiplexed ones
+        self.paused = collections.deque()   # connections waiting for memory, in the order they stopped
+        self.db_handler = db_handler.DB_Handler(db_path)
+        self.registry = ClientRegistry(self.db_handler)
+        if not self.registry.load():
+            raise RuntimeError("Can not load the registered clients")
         self.valid_requests = {protocol.RequestCodes.REGISTER_CLIENT.value : self.handle_register_request,
                             protocol.RequestCodes.GET_CLIENTS_LIST.value: self.handle_get_clients_request,
                             protocol.RequestCodes.GET_PUBLIC_KEY.value : self.handle_get_public_key_request,
@@ -43,77 +345,305 @@ class Server:
         except Exception as e:
             logging.error(e)
             return False
-        while True:
-            try:
-                events = self.sel.select()
-                for key, mask in events:
-                    callback = key.data
-                    callback(key.fileobj, mask)
-            except Exception as e:
-                logging.error(e)
+        try:
+            while True:
+                try:
+                    events = self.sel.select(timeout=min(self.registry.flush_due(), self.send_due()))
+                    for key, mask in events:
+                        callback = key.data
+                        callback(key.fileobj, mask)
+                    self.expire_sends()
+                    if not self.registry.flush_due():
+                        self.registry.flush()
+                except Exception as e:
+                    logging.error(e)
+        finally:
+            self.registry.flush()
 
 
     def accept(self, sock, mask):
         conn, addr = sock.accept()
         logging.info(f'Accepted connection from {addr}')
         conn.setblocking(False)
+        self.pending[conn] = PendingRequest()
         self.sel.register(conn, selectors.EVENT_READ, self.read)
 
 
     def read(self, conn, mask):
-        data = conn.recv(self.PACKET_SIZE)
-        isValid = True
-        if data:
-            header = protocol.RequestHeader()
-            if not header.unpack(data):
-                logging.error("Error while trying to unpack request header.")
-                isValid = False
-            elif header.code not in self.valid_requests:
-                logging.error("Invalid request code, can not carry out request.")
-                isValid = False
-            elif not self.db_handler.check_client_exists(header.client_id) and header.code != protocol.RequestCodes.REGISTER_CLIENT.value:
-                logging.error("Invalid request, client doesn't exist")
-                isValid = False
-
-            if isValid:
-                self.db_handler.update_last_seen(header.client_id)
-                if not self.valid_requests[header.code](conn, data):
-                    resp = protocol.ResponseHeader(self.version, protocol.ResponseCodes.GENERIC_ERROR.value)
-                    self.write(conn, resp.pack(), protocol.ResponseCodes.GENERIC_ERROR.name)
-        else:
+        """ Collects the request over as many events as it takes, other connections are served in between. """
+        pending = self.pending[conn]
+        try:
+            data = conn.recv(pending.wanted(self.RECV_SIZE, self.PACKET_SIZE))
+        except BlockingIOError:
+            return
+        except OSError:
+            data = b""
+        if not data:
             logging.info("no messages received...")
+            self.close(conn)
+            return
+        pending.data += data
+        if not pending.reserved:
+            if not pending.parse_header(self.PACKET_SIZE):
+                return
+            if pending.size > self.connection_limit:
+                logging.error(f"Request of {pending.size} bytes is over the connection limit.")
+                writer = StreamWriter()
+                resp = protocol.ResponseHeader(self.version, protocol.ResponseCodes.GENERIC_ERROR.value)
+                self.write(writer, resp.pack(), protocol.ResponseCodes.GENERIC_ERROR.name)
+                self.sel.unregister(conn)
+                self.release(conn)
+                self.respond(conn, writer)
+                return
+            if not pending.complete() and not self.reserve(pending):
+                self.pause(conn)
+                return
+        if not pending.complete():
+            return
+
         self.sel.unregister(conn)
+        self.release(conn)
+        if pending.header.code == protocol.RequestCodes.OPEN_MULTIPLEX.value:
+            self.open_multiplex(conn)
+            return
+        writer = StreamWriter()
+        self.handle_request(writer, bytes(pending.data))
+        self.respond(conn, writer)
+
+
+    def reserve(self, pending):
+        """ Holds the memory for the whole request up front, so a request that started reading can always finish.
+            One request is let through when nothing is buffered, whatever its size. """
+        if self.buffered and self.buffered + pending.size > self.memory_limit:
+            return False
+        pending.reserved = pending.size
+        self.buffered += pending.reserved
+        return True
+
+
+    def pause(self, conn):
+        self.sel.unregister(conn)
+        self.paused.append(conn)
+
+
+    def resume(self):
+        """ Paused connections go on in order as long as the memory allows it. """
+        while self.paused:
+            conn = self.paused[0]
+            if conn in self.multiplexed:
+                if self.buffered >= self.memory_limit:
+                    return
+                self.sel.register(conn, selectors.EVENT_READ, self.serve_multiplexed)
+            else:
+                if not self.reserve(self.pending[conn]):
+                    return
+                self.sel.register(conn, selectors.EVENT_READ, self.read)
+            self.paused.popleft()
+
+
+    def release(self, conn):
+        """ Gives back the memory of a connection's unfinished requests and queued responses. """
+        pending = self.pending.pop(conn, None)
+        mux = self.multiplexed.get(conn)
+        freed = (pending.reserved if pending else 0) + (mux.charged if mux else 0)
+        if mux:
+            mux.charged = 0
+        if conn in self.paused:
+            self.paused.remove(conn)
+        if freed:
+            self.buffered -= freed
+            self.resume()
+
+
+    def close(self, conn):
+        if conn not in self.paused:
+            self.sel.unregister(conn)
+        self.release(conn)
         conn.close()
 
 
-    def write(self, conn, resp_buffer, resp_type):
-        response_len = len(resp_buffer)
-        if response_len < self.PACKET_SIZE:
-            resp_buffer += bytearray(self.PACKET_SIZE - response_len)
-        elif response_len > self.PACKET_SIZE:
+    def handle_request(self, writer, data):
+        """ Runs the request's handler in one transaction, its response is left in the writer. """
+        header = protocol.RequestHeader()
+        if not header.unpack(data):
+            logging.error("Error while trying to unpack request header.")
+        elif header.code not in self.valid_requests:
+            logging.error("Invalid request code, can not carry out request.")
+        elif header.code != protocol.RequestCodes.REGISTER_CLIENT.value and not self.registry.exists(header.client_id):
+            logging.error("Invalid request, client doesn't exist")
+        else:
+            if header.code != protocol.RequestCodes.REGISTER_CLIENT.value:
+                self.registry.touch(header.client_id)
+            with self.db_handler.request():
+                if not self.valid_requests[header.code](writer, data):
+                    writer.clear()
+                    resp = protocol.ResponseHeader(self.version, protocol.ResponseCodes.GENERIC_ERROR.value)
+                    self.write(writer, resp.pack(), protocol.ResponseCodes.GENERIC_ERROR.name)
+
+
+    def open_multiplex(self, conn):
+        writer = StreamWriter()
+        resp = protocol.ResponseHeader(self.version, protocol.ResponseCodes.MULTIPLEX_ACCEPTED.value)
+        self.write(writer, resp.pack(), protocol.ResponseCodes.MULTIPLEX_ACCEPTED.name)
+        self.multiplexed[conn] = MultiplexedConnection(bytes(writer.buffer))
+        self.sel.register(conn, selectors.EVENT_READ | selectors.EVENT_WRITE, self.serve_multiplexed)
+
+
+    def serve_multiplexed(self, conn, mask):
+        """ Requests are handled as soon as their last frame arrives, the connection stays open until the client closes it. """
+        mux = self.multiplexed[conn]
+        if mask & selectors.EVENT_READ:
             try:
-                conn.send(resp_buffer[:self.PACKET_SIZE])
-                bytes_sent = self.PACKET_SIZE
-            except:
-                logging.error(f"Error while trying to send {resp_type} response")
-                return False
-            while bytes_sent < response_len:
-                to_send = min(response_len - bytes_sent, self.PACKET_SIZE)
-                conn.send(resp_buffer[bytes_sent:bytes_sent + to_send])
-                bytes_sent += to_send
-            logging.info(f"Successfully sent {resp_type} response")
-            return True
-        try:
-            conn.send(resp_buffer)
-        except:
-            logging.error(f"Error while trying to send {resp_type} response")
-            return False
+                data = conn.recv(self.RECV_SIZE)
+            except BlockingIOError:
+                data = None
+            except OSError:
+                data = b""
+            if data == b"":
+                self.close_multiplex(conn)
+                return
+            if data:
+                mux.inbound += data
+                for stream_id, request in mux.requests():
+                    writer = StreamWriter()
+                    try:
+                        self.handle_request(writer, request)
+                    except Exception as e:
+                        logging.error(e)
+                        writer.clear()
+                    if writer.empty():
+                        # invalid requests get an answer, the client would wait for the stream otherwise
+                        resp = protocol.ResponseHeader(self.version, protocol.ResponseCodes.GENERIC_ERROR.value)
+                        self.write(writer, resp.pack(), protocol.ResponseCodes.GENERIC_ERROR.name)
+                    mux.respond(stream_id, writer.response(), writer)
+                if not self.charge(mux):
+                    logging.error("Multiplexed connection is over the connection limit.")
+                    self.close_multiplex(conn)
+                    return
+
+        if mux.has_output():
+            batch = mux.next_batch()
+            try:
+                sent = conn.send(batch)
+            except BlockingIOError:
+                sent = 0
+            except OSError:
+                self.close_multiplex(conn)
+                return
+            # a stream counts as delivered once its last frame is out, a connection closed before drops the rest
+            for writer in mux.took(batch, sent):
+                self.delivered(writer)
+            self.charge(mux)
+
+        # a connection in the middle of a request keeps reading, it frees its memory only once the request is in.
+        # One whose client does not read its responses stops until they are below its limit.
+        reading = mux.queued() <= self.connection_limit and (mux.buffered() or self.buffered < self.memory_limit)
+        events = (selectors.EVENT_READ if reading else 0) | (selectors.EVENT_WRITE if mux.has_output() else 0)
+        if events:
+            self.sel.modify(conn, events, self.serve_multiplexed)
+        else:
+            self.pause(conn)
+
+
+    def charge(self, mux):
+        """ Counts the connection's unfinished requests and queued responses against the memory limit.
+            False when its requests are over its own limit, queued responses only stop it from reading. """
+        buffered = mux.buffered()
+        charged = buffered + mux.queued()
+        self.buffered += charged - mux.charged
+        freed = charged < mux.charged
+        mux.charged = charged
+        if freed:
+            self.resume()
+        return buffered <= self.connection_limit
+
+
+    def close_multiplex(self, conn):
+        logging.info("Multiplexed connection closed")
+        self.close(conn)
+        del self.multiplexed[conn]
+
 
-        logging.info(f"Successfully sent {resp_type} response")
-        #print(f"buffer : {resp_buffer}")
+    def write(self, writer, resp_buffer, resp_type):
+        """ Pads the response into the writer, it is sent and logged once the request committed. """
+        writer.name = resp_type
+        writer.send(resp_buffer + bytearray(max(self.PACKET_SIZE - len(resp_buffer), 0)))
         return True
 
 
+    def write_parts(self, writer, parts, resp_type, delivered):
+        """ Like write, but the parts are not joined, spooled bodies among them stay files until the response is sent.
+            delivered() runs once it is sent, on a multiplexed connection once its last frame is. """
+        writer.delivered = delivered
+        if sum(part.size if isinstance(part, db_handler.SpoolFile) else len(part) for part in parts) < self.PACKET_SIZE:
+            return self.write(writer, b"".join(parts), resp_type)
+        writer.send_parts(parts)
+        writer.name = resp_type
+        return True
+
+
+    def respond(self, conn, writer):
+        """ Sends a plain connection's response on its write events once the request committed, then closes the connection.
+            A request without a response is only closed. """
+        if writer.empty():
+            conn.close()
+            return
+        try:
+            self.sending[conn] = (FileResponse(writer.parts or [writer.buffer], self.SEND_TIMEOUT), writer.name, writer)
+        except OSError as e:
+            logging.error(f"Error while trying to send {writer.name} response: {e}")
+            conn.close()
+            return
+        self.sel.register(conn, selectors.EVENT_WRITE, self.send_response)
+
+
+    def delivered(self, writer):
+        if writer.delivered:
+            with self.db_handler.request():
+                writer.delivered()
+
+
+    def send_response(self, conn, mask):
+        response, resp_type, writer = self.sending[conn]
+        try:
+            if not response.send(conn):
+                return
+            logging.info(f"Successfully sent {resp_type} response")
+            self.delivered(writer)
+        except OSError as e:
+            logging.error(f"Error while trying to send {resp_type} response: {e}")
+        self.end_send(conn)
+
+
+    def end_send(self, conn):
+        response, _, _ = self.sending.pop(conn)
+        response.close()
+        self.sel.unregister(conn)
+        conn.close()
+
+
+    def send_due(self):
+        """ Seconds until the first response runs out of time, the selector waits no longer than that. """
+        deadline = min((response.deadline for response, _, _ in self.sending.values()), default=time.monotonic() + self.SEND_TIMEOUT)
+        return max(deadline - time.monotonic(), 0)
+
+
+    def expire_sends(self):
+        now = time.monotonic()
+        for conn, (response, resp_type, _) in list(self.sending.items()):
+            if response.deadline <= now:
+                logging.error(f"Sending the {resp_type} response timed out")
+                self.end_send(conn)
+
+
+
+
+    def new_client_id(self):
+        # a shard only hands out IDs that the clients route back to it
+        while True:
+            new_id = bytes.fromhex(uuid.uuid4().hex)
+            if protocol.shard_of(new_id, self.shards) == self.shard:
+                return new_id
 
 
     def handle_register_request(self, conn, data):
@@ -121,12 +651,9 @@ class Server:
         if not req.unpack(data):
             logging.error("Error while trying to unpack REGISTER CLIENT request.")
             return False
-        if self.db_handler.check_client_exists(client_name=req.name):
-            logging.error("Can not register client, user name is already taken.")
-            return False
-        new_id = bytes.fromhex(uuid.uuid4().hex) 
-        if not self.db_handler.insert_client(new_id, req.name, req.public_key):
-            logging.error("Error while trying to store client, please check that all fields are valid.")
+        new_id = self.new_client_id()
+        if not self.db_handler.insert_client(new_id, req.name, req.public_key, req.key_type):
+            logging.error("Can not register client, user name is already taken or a field is invalid.")
             return False
 
         resp = protocol.RegistrationResponse(self.version, protocol.ResponseCodes.REGISTER_SUCCESS.value, protocol.CLIENT_ID_SIZE, new_id)
@@ -142,14 +669,14 @@ class Server:
         if not req.unpack(data):
             logging.error("Error while trying to unpack client list request.")
             return False
-        clientsList = self.db_handler.get_clients_list()
+        clientsList = self.registry.names()
         if not clientsList:
             logging.error("No users")
 
         payload = b""
         client_data = protocol.Client()
         for client_t in clientsList:
-            id, name, _, _ = client_t
+            id, name = client_t
             if id != req.client_id:
                 client_data.id = id
                 client_data.name = name.encode()
@@ -172,18 +699,24 @@ class Server:
         if not req.unpack(data):
             logging.error("Error while trying to unpack GET PUBLIC KEY request.")
             return False
-        if not self.db_handler.check_client_exists(client_name=req.name):
+        client = self.registry.find(req.name)
+        if not client:
             logging.error("Can not get client's public key, client doesn't exist")
             return False
-        key = self.db_handler.select_public_key(req.name)
-        if not key:
-            logging.error("Error while trying to select public key")
-            return False
+        client_id, key, key_type = client
         payload_size = protocol.CLIENT_ID_SIZE + protocol.PUBLIC_KEY_SIZE
 
-        client_id = self.db_handler.select_id_from_name(req.name)
+        # legacy clients only understand RSA keys and don't expect the key type field
+        if req.header.client_version >= protocol.KEY_TYPE_VERSION:
+            payload_size += protocol.KEY_TYPE_SIZE
+        elif key_type != protocol.KeyType.RSA.value:
+            logging.error("Can not send a non RSA public key to a legacy client")
+            return False
+        else:
+            key_type = None
+
         print(client_id)
-        resp = protocol.PublicKeyResponse(self.version, protocol.ResponseCodes.GET_PUBLIC_KEY_SUCCESS.value, payload_size, client_id, key)
+        resp = protocol.PublicKeyResponse(self.version, protocol.ResponseCodes.GET_PUBLIC_KEY_SUCCESS.value, payload_size, client_id, key, key_type)
         resp_buffer = resp.pack()
         if not resp_buffer:
             logging.error("Error while trying to pack GET PUBLIC KEY response")
@@ -193,13 +726,13 @@ class Server:
         
     def handle_send_message_request(self, conn, data):
         req = protocol.SendMessageRequest()
-        if not req.unpack(conn, data, self.PACKET_SIZE):
+        if not req.unpack(data):
             logging.error("Error while trying to unpack SEND MESSAGE request")
             return False
-        if not self.db_handler.check_client_exists(req.client_id):
+        if not self.registry.exists(req.client_id):
             logging.error(f"Invalid request, user does not exist.")
             return False
-        if req.message_type not in self.valid_msg:
+        if (req.message_type & protocol.MESSAGE_TYPE_MASK) not in self.valid_msg:
             logging.error("Invalid message type, can not send message")
             return False
         msg_id = self.db_handler.insert_message(req.client_id, req.header.client_id, req.message_type, req.message_content)
@@ -222,7 +755,8 @@ class Server:
             logging.error("Error while trying to unpack message queue request.")
             return False
         messages = self.db_handler.select_unread_messages(req.client_id)
-        payload = b""
+        parts = []          # packed messages, spooled bodies stay files
+        payload_size = 0
         msg_ids = []
 
         if messages:
@@ -230,24 +764,30 @@ class Server:
             for msg_t in messages:
                 msg_obj.from_id, msg_obj.id, type, content = msg_t
                 msg_obj.type = int(type)
-                msg_obj.content = content.encode()
-                msg_obj.size = len(msg_obj.content)
+                if isinstance(content, db_handler.SpoolFile):
+                    msg_obj.size = content.size
+                    msg_buffer = msg_obj.pack_header()
+                else:
+                    msg_obj.content = content if isinstance(content, bytes) else content.encode()
+                    msg_obj.size = len(msg_obj.content)
+                    msg_buffer = msg_obj.pack()
                 print(msg_obj.size)
-                msg_buffer = msg_obj.pack()
                 if not msg_buffer:
                     logging.error("Error while trying to pack message.")
                     return False
                 msg_ids.append(msg_obj.id)
-                payload += msg_buffer
+                parts.append(msg_buffer)
+                payload_size += len(msg_buffer)
+                if isinstance(content, db_handler.SpoolFile):
+                    parts.append(content)
+                    payload_size += content.size
 
-        resp_header = protocol.ResponseHeader(self.version, protocol.ResponseCodes.GET_UNREAD_MESSAGES_SUCCESS.value, len(payload))
+        resp_header = protocol.ResponseHeader(self.version, protocol.ResponseCodes.GET_UNREAD_MESSAGES_SUCCESS.value, payload_size)
         resp_buffer = resp_header.pack()
         if not resp_buffer:
             logging.error("Error while trying to pack GET_UNREAD_MESSAGES_SUCCESS response.")
             return False
-        if self.write(conn, resp_buffer+payload, protocol.ResponseCodes.GET_UNREAD_MESSAGES_SUCCESS.name):
+        def delivered():
             for id in msg_ids:
                 self.db_handler.delete_msg(id)
-            return True
-        else:
-            return False
+        return self.write_parts(conn, [resp_buffer] + parts, protocol.ResponseCodes.GET_UNREAD_MESSAGES_SUCCESS.name, delivered)